@@ -1,4 +1,5 @@
 #include <sstream>
+#include <set>
 #include <print>
 #include <string>
 #include <regex>
@@ -64,7 +65,37 @@ std::string IRGenerator::getStorageType(const Symbol &symbol) {
     return "w";
 }
 
+// Offsets of the words that hold strings or objects, separated by ';', for the collector of the runtime
+std::string IRGenerator::getPointerMap(const Symbol &symbol) {
+    std::set<int> offsets;
+    auto addWords = [&offsets](const Symbol &value, int base) {
+        if (value.data_type != SymbolDataType::STRING && value.data_type != SymbolDataType::OBJECT) return;
+        int size = (value.dimentions.empty()) ? 4 : value.size;
+        for (int offset = 0; offset < size; offset += 4) offsets.insert(base + offset);
+    };
+
+    if (symbol.type != SymbolType::CLASS) addWords(symbol, 0);
+    // Fields of the class and the ones it inherits
+    for (auto parent = symbol.name; symbol.type == SymbolType::CLASS && !parent.empty();) {
+        auto symbol_exists = table->lookup(parent, false);
+        if (!symbol_exists.second || !symbol_exists.first.definition.lock()) break;
+        auto class_symbol = symbol_exists.first;
+        for (auto &[name, member]: class_symbol.definition.lock()->table)
+            if (name != "this" && (member.type == SymbolType::VARIABLE || member.type == SymbolType::CONSTANT))
+                addWords(member, member.offset);
+        parent = class_symbol.parent;
+    }
+
+    std::string map;
+    for (auto offset: offsets) map += (map.empty() ? "" : ";") + std::to_string(offset);
+    return map;
+}
+
 std::string IRGenerator::getTAC() {
+    return CompiScript::getTAC(quadruplets);
+}
+
+std::string CompiScript::getTAC(const std::vector<Quad> &quadruplets) {
     std::string tac;
     for (auto quad: quadruplets) {
         auto temp = quad.op + " " + quad.arg1 + " " + quad.arg2 + "\n";
@@ -104,7 +135,8 @@ std::any IRGenerator::visitVariableDeclaration(CompiScriptParser::VariableDeclar
         temp_count = 0;
     } else {
         if (!dest.dimentions.empty()) {
-            quadruplets.push_back({.op = "alloc", .arg1 = std::to_string(dest.size), .result = dest.label + dest.name});
+            quadruplets.push_back({.op = "alloc", .arg1 = std::to_string(dest.size), .arg2 = getPointerMap(dest),
+                .result = dest.label + dest.name});
             std::stringstream value_stream (dest.value);
             std::string value;
             int offset = 0;
@@ -139,7 +171,8 @@ std::any IRGenerator::visitConstantDeclaration(CompiScriptParser::ConstantDeclar
         temp_count = 0;
     } else {
         if (!dest.dimentions.empty()) {
-            quadruplets.push_back({.op = "alloc", .arg1 = std::to_string(dest.size), .result = dest.label + dest.name});
+            quadruplets.push_back({.op = "alloc", .arg1 = std::to_string(dest.size), .arg2 = getPointerMap(dest),
+                .result = dest.label + dest.name});
             std::stringstream value_stream (dest.value);
             std::string value;
             int offset = 0;
@@ -228,10 +261,16 @@ std::any IRGenerator::visitIfStatement(CompiScriptParser::IfStatementContext *ct
 
     quadruplets.push_back({.op = "tag", .arg1 = label});
     visitBlock(ctx->block().at(0));
-    quadruplets.push_back({.op = "tag", .arg1 = else_label});
 
-    if (ctx->block().size() == 2)
+    if (ctx->block().size() == 2) {
+        auto end_label = "l" + std::to_string(label_count++);
+        quadruplets.push_back({.op = "goto", .arg1 = end_label});
+        quadruplets.push_back({.op = "tag", .arg1 = else_label});
         visitBlock(ctx->block().at(1));
+        quadruplets.push_back({.op = "tag", .arg1 = end_label});
+    } else {
+        quadruplets.push_back({.op = "tag", .arg1 = else_label});
+    }
 
     return std::any();
 }
@@ -542,6 +581,7 @@ std::any IRGenerator::visitTernaryExpr(CompiScriptParser::TernaryExprContext *ct
         symbol.label = "";
         symbol.type = SymbolType::VARIABLE;
         symbol.data_type = expr1.data_type;
+        return makeAny(symbol);
     }
     return visitChildren(ctx);
 }
@@ -603,16 +643,11 @@ std::any IRGenerator::visitEqualityExpr(CompiScriptParser::EqualityExprContext *
             auto op = ctx->children.at(op_index)->getText();
             op_index += 2;
             if (first_symbol.data_type == SymbolDataType::STRING) {
-                if (op == "==")
-                    quadruplets.push_back({.op = "streql", .arg1 = arg1, .arg2 = arg2, .result = temp});
-
-                if (op == "!=")
-                    quadruplets.push_back({.op = "strneq", .arg1 = arg1, .arg2 = arg2, .result = temp});
-
-                continue;
-            } 
-
-            optimize.push_back({.op = op, .arg1 = arg1, .arg2 = arg2, .result = temp});
+                optimize.push_back({.op = (op == "==") ? "streql" : "strneq", .arg1 = arg1, .arg2 = arg2, .result = temp});
+                first_symbol.data_type = SymbolDataType::BOOLEAN;
+            } else {
+                optimize.push_back({.op = op, .arg1 = arg1, .arg2 = arg2, .result = temp});
+            }
 
             first_symbol.name = temp;
             first_symbol.label = "";
@@ -839,7 +874,8 @@ std::any IRGenerator::visitNewExpr(CompiScriptParser::NewExprContext *ctx) {
     auto constructor = table->get_property(class_symbol.name, "constructor").first;
     auto temp = "t" + std::to_string(temp_count++);
 
-    optimize.push_back({.op = "alloc", .arg1 = std::to_string(class_symbol.size), .result = temp});
+    optimize.push_back({.op = "alloc", .arg1 = std::to_string(class_symbol.size), .arg2 = getPointerMap(class_symbol),
+        .result = temp});
     optimize.push_back({.op = "param", .arg1 = temp});
     if (ctx->arguments() != nullptr) {
         auto args = castSymbol(visitArguments(ctx->arguments()));
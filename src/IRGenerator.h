@@ -16,6 +16,8 @@ struct Quad {
     std::string result;
 };
 
+std::string getTAC(const std::vector<Quad> &quadruplets);
+
 class IRGenerator: public CompiScriptBaseVisitor
 {
 private:
@@ -43,6 +45,7 @@ public:
 
     int getSymbolSize(const Symbol &symbol);
     std::string getStorageType(const Symbol &symbol);
+    std::string getPointerMap(const Symbol &symbol);
 
     std::any visitProgram(CompiScriptParser::ProgramContext *ctx); 
 
@@ -0,0 +1,830 @@
+#include <algorithm>
+#include <unordered_map>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <map>
+#include <optional>
+#include <tuple>
+
+#include "MachineCode.h"
+
+using namespace CompiScript;
+
+static const std::vector<std::pair<Opcode, std::string>> mnemonics = {
+    {ADD, "add"}, {ADDU, "addu"}, {ADDI, "addi"}, {ADDIU, "addiu"}, {SUB, "sub"}, {SUBU, "subu"},
+    {AND, "and"}, {ANDI, "andi"}, {OR, "or"}, {ORI, "ori"}, {XOR, "xor"}, {XORI, "xori"}, {NOR, "nor"},
+    {SLT, "slt"}, {SLTI, "slti"}, {SLTU, "sltu"}, {SLTIU, "sltiu"}, {SLL, "sll"}, {SRL, "srl"}, {SRA, "sra"},
+    {SLLV, "sllv"}, {SRLV, "srlv"}, {SRAV, "srav"}, {MOVN, "movn"}, {MOVZ, "movz"},
+    {MUL, "mul"}, {MULT, "mult"}, {MULTU, "multu"}, {DIV, "div"}, {DIVU, "divu"},
+    {MFHI, "mfhi"}, {MFLO, "mflo"}, {MTHI, "mthi"}, {MTLO, "mtlo"},
+    {LUI, "lui"}, {LI, "li"}, {LA, "la"}, {MOVE, "move"}, {NOT, "not"}, {NEG, "neg"},
+    {SEQ, "seq"}, {SNE, "sne"}, {SGT, "sgt"}, {SGE, "sge"}, {SLE, "sle"}, {SGTU, "sgtu"}, {SGEU, "sgeu"},
+    {SLEU, "sleu"}, {ABS, "abs"}, {REM, "rem"}, {REMU, "remu"},
+    {LW, "lw"}, {LH, "lh"}, {LHU, "lhu"}, {LB, "lb"}, {LBU, "lbu"}, {SW, "sw"}, {SH, "sh"}, {SB, "sb"},
+    {B, "b"}, {J, "j"}, {JAL, "jal"}, {JR, "jr"}, {JALR, "jalr"}, {BEQ, "beq"}, {BNE, "bne"},
+    {BEQZ, "beqz"}, {BNEZ, "bnez"}, {BLTZ, "bltz"}, {BGTZ, "bgtz"}, {BLEZ, "blez"}, {BGEZ, "bgez"},
+    {BLT, "blt"}, {BGT, "bgt"}, {BLE, "ble"}, {BGE, "bge"},
+    {SYSCALL, "syscall"}, {NOP, "nop"}
+};
+
+// Cycles until a result can be used without stalling the simple in-order pipeline the scheduler models
+static const int load_latency = 2;
+static const int multiply_latency = 4;
+static const int divide_latency = 12;
+
+static std::string trim(const std::string &text) {
+    auto first = text.find_first_not_of(" \t");
+    if (first == std::string::npos) return "";
+    return text.substr(first, text.find_last_not_of(" \t") - first + 1);
+}
+
+MachineInstr CompiScript::parseInstr(const std::string &line) {
+    static const std::regex immediate("-?[0-9]+|0x[0-9a-fA-F]+|'.+'");
+    static std::unordered_map<std::string, Opcode> opcodes;
+    if (opcodes.empty()) for (auto &[opcode, mnemonic]: mnemonics) opcodes[mnemonic] = opcode;
+
+    MachineInstr instr;
+    auto hash = line.find('#');
+    if (hash != std::string::npos) instr.comment = trim(line.substr(hash + 1));
+    auto code = trim(line.substr(0, hash));
+    if (code.empty()) return instr;
+
+    auto space = code.find_first_of(" \t");
+    auto mnemonic = code.substr(0, space);
+    if (opcodes.contains(mnemonic)) instr.opcode = opcodes.at(mnemonic);
+    else {
+        instr.opcode = UNKNOWN;
+        instr.name = mnemonic;
+    }
+    if (space == std::string::npos) return instr;
+
+    std::istringstream stream(code.substr(space));
+    for (std::string text; std::getline(stream, text, ',');) {
+        MachineOperand operand;
+        text = trim(text);
+        auto open = text.find('(');
+        if (text.starts_with("$")) operand.kind = MachineOperand::REG;
+        else if (open != std::string::npos) {
+            operand.kind = MachineOperand::MEM;
+            operand.base = text.substr(open + 1, text.find(')') - open - 1);
+            text = text.substr(0, open);
+        }
+        else if (std::regex_match(text, immediate)) operand.kind = MachineOperand::IMM;
+        operand.value = text;
+        instr.operands.push_back(operand);
+    }
+    // A trailing comma leaves an empty operand that getline does not return
+    if (code.ends_with(",")) instr.operands.push_back(MachineOperand());
+    return instr;
+}
+
+// Lines of hand written assembly, a line with only a label keeps it in the label of the instruction
+std::vector<MachineInstr> CompiScript::parseCode(const std::string &text) {
+    std::vector<MachineInstr> code;
+    std::istringstream lines(text);
+    for (std::string line; std::getline(lines, line);) {
+        auto label = trim(line.substr(0, line.find('#')));
+        if (!label.ends_with(":")) {
+            code.push_back(parseInstr(line));
+            continue;
+        }
+        auto hash = line.find('#');
+        code.push_back({.comment = (hash == std::string::npos) ? "" : trim(line.substr(hash + 1)),
+            .label = label.substr(0, label.size() - 1)});
+    }
+    return code;
+}
+
+std::string CompiScript::printInstr(const MachineInstr &instr) {
+    if (!instr.label.empty()) return instr.label + ":" + (instr.comment.empty() ? "" : " # " + instr.comment);
+    if (instr.opcode == NONE) return instr.comment.empty() ? "" : "# " + instr.comment;
+
+    auto mnemonic = instr.name;
+    for (auto &[opcode, name]: mnemonics) if (opcode == instr.opcode) mnemonic = name;
+    auto text = mnemonic;
+    for (size_t k = 0; k < instr.operands.size(); k++) {
+        auto &operand = instr.operands.at(k);
+        text += (k == 0) ? " " : ", ";
+        text += operand.value;
+        if (operand.kind == MachineOperand::MEM) text += "(" + operand.base + ")";
+    }
+    if (!instr.comment.empty()) text += "    # " + instr.comment;
+    return text;
+}
+
+InstrInfo CompiScript::getInstrInfo(const MachineInstr &instr) {
+    InstrInfo info;
+    auto &operands = instr.operands;
+    auto is_register = [](const MachineOperand &operand) { return operand.kind == MachineOperand::REG; };
+    static const std::regex decimal("-?[0-9]{1,10}");
+    auto fits = [](const MachineOperand &operand) {
+        if (operand.kind != MachineOperand::IMM) return false;
+        if (!std::regex_match(operand.value, decimal)) return operand.value.starts_with("'");
+        auto value = std::stoll(operand.value);
+        return -32768 <= value && value <= 65535;
+    };
+    auto op = instr.opcode;
+    // Operands left empty by the code generator make the instruction opaque
+    if (std::any_of(operands.begin(), operands.end(), [](const MachineOperand &operand) {
+        return operand.value.empty() && operand.kind != MachineOperand::MEM;
+    })) op = UNKNOWN;
+
+    switch (op) {
+        case NONE:
+        case NOP:
+            break;
+        case B: case J: case JAL: case JR: case JALR: case BEQ: case BNE: case BEQZ: case BNEZ:
+        case BLTZ: case BGTZ: case BLEZ: case BGEZ: case BLT: case BGT: case BLE: case BGE:
+            info.branch = true;
+            for (auto &operand: operands) if (is_register(operand)) info.uses.insert(operand.value);
+            if (op == JAL || op == JALR) info.defs.insert("$ra");
+            info.macro = op == BLT || op == BGT || op == BLE || op == BGE;
+            break;
+        case LW: case LH: case LHU: case LB: case LBU: case SW: case SH: case SB: {
+            if (operands.size() != 2 || !is_register(operands.front())) {
+                info.barrier = true;
+                break;
+            }
+            auto &address = operands.back();
+            if (address.kind == MachineOperand::MEM) info.uses.insert(address.base);
+            else info.macro = true;
+            if (op == SW || op == SH || op == SB) {
+                info.uses.insert(operands.front().value);
+                info.stores = true;
+            } else {
+                info.defs.insert(operands.front().value);
+                info.loads = true;
+                info.latency = load_latency;
+            }
+            break;
+        }
+        case MFHI: case MFLO:
+            if (operands.size() != 1) {
+                info.barrier = true;
+                break;
+            }
+            info.defs.insert(operands.front().value);
+            info.uses.insert((op == MFHI) ? "hi" : "lo");
+            break;
+        case MTHI: case MTLO:
+            if (operands.size() != 1) {
+                info.barrier = true;
+                break;
+            }
+            info.uses.insert(operands.front().value);
+            info.defs.insert((op == MTHI) ? "hi" : "lo");
+            break;
+        case SYSCALL:
+            // The services used by the runtime read their arguments from $v0 and $a0-$a3 and answer in $v0
+            info.barrier = true;
+            info.uses = {"$v0", "$a0", "$a1", "$a2", "$a3"};
+            info.defs = {"$v0"};
+            info.loads = info.stores = true;
+            break;
+        case UNKNOWN:
+            info.barrier = true;
+            break;
+        default: {
+            if (operands.empty() || !is_register(operands.front())) {
+                info.barrier = true;
+                break;
+            }
+            // mult and div with two operands only write hi and lo
+            if ((op == MULT || op == MULTU || op == DIV || op == DIVU) && operands.size() == 2) {
+                info.uses = {operands.at(0).value, operands.at(1).value};
+                info.defs = {"hi", "lo"};
+                info.latency = (op == MULT || op == MULTU) ? multiply_latency : divide_latency;
+                break;
+            }
+            info.defs.insert(operands.front().value);
+            // Two operand forms like addi $sp, -4 also read the destination, and so do the conditional moves
+            if ((operands.size() == 2 && !is_register(operands.back()) && op != LI && op != LA && op != LUI) ||
+                op == MOVN || op == MOVZ)
+                info.uses.insert(operands.front().value);
+            for (size_t k = 1; k < operands.size(); k++) {
+                if (is_register(operands.at(k))) info.uses.insert(operands.at(k).value);
+                else if (!fits(operands.at(k))) info.macro = true;
+            }
+            if (op == LA || op == SEQ || op == SNE || op == SGT || op == SGE || op == SLE || op == SGTU ||
+                op == SGEU || op == SLEU || op == ABS || op == REM || op == REMU || op == DIV || op == DIVU ||
+                op == MULT || op == MULTU)
+                info.macro = true;
+            if (op == MUL || op == MULT || op == MULTU) {
+                info.defs.insert({"hi", "lo"});
+                info.latency = multiply_latency;
+            }
+            if (op == DIV || op == DIVU || op == REM || op == REMU) {
+                info.defs.insert({"hi", "lo"});
+                info.latency = divide_latency;
+            }
+        }
+    }
+    // Pseudoinstructions expand through the assembler temporary
+    if (info.macro) info.defs.insert("$at");
+    return info;
+}
+
+// Register or memory dependence between two instructions, in either direction
+static bool conflicts(const InstrInfo &first, const InstrInfo &second) {
+    auto intersects = [](const std::set<std::string> &a, const std::set<std::string> &b) {
+        return std::any_of(a.begin(), a.end(), [&b](const std::string &reg) { return b.contains(reg); });
+    };
+    return intersects(first.defs, second.uses) || intersects(first.defs, second.defs) ||
+        intersects(first.uses, second.defs) ||
+        (first.stores && (second.loads || second.stores)) || (first.loads && second.stores);
+}
+
+// Cycles the later instruction has to wait after the earlier one issues, 0 if they are independent
+static int getLatency(const InstrInfo &earlier, const InstrInfo &later) {
+    if (earlier.barrier || later.barrier || earlier.branch || later.branch || conflicts(earlier, later)) {
+        bool reads = std::any_of(earlier.defs.begin(), earlier.defs.end(),
+            [&later](const std::string &reg) { return later.uses.contains(reg); });
+        return reads ? earlier.latency : 1;
+    }
+    return 0;
+}
+
+static int countStalls(const std::vector<InstrInfo> &infos, const std::vector<size_t> &order) {
+    int cycle = 0, stalls = 0;
+    std::vector<int> issued(order.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        int start = cycle;
+        for (size_t j = 0; j < i; j++)
+            start = std::max(start, issued.at(j) + getLatency(infos.at(order.at(j)), infos.at(order.at(i))));
+        stalls += start - cycle;
+        issued.at(i) = start;
+        cycle = start + 1;
+    }
+    return stalls;
+}
+
+// List scheduling of a run of instructions: each cycle issues the ready instruction with the longest latency path to
+// the end of the run, and the branch that ends it stays last
+static std::vector<size_t> scheduleRun(const std::vector<InstrInfo> &infos) {
+    size_t n = infos.size();
+    std::vector<std::vector<std::pair<size_t, int>>> successors(n);
+    std::vector<int> predecessors(n, 0), priority(n, 0), ready(n, 0);
+    for (size_t i = 0; i < n; i++)
+        for (size_t j = i + 1; j < n; j++)
+            if (auto latency = getLatency(infos.at(i), infos.at(j))) {
+                successors.at(i).push_back({j, latency});
+                predecessors.at(j)++;
+            }
+    for (size_t i = n; i-- > 0;)
+        for (auto [j, latency]: successors.at(i)) priority.at(i) = std::max(priority.at(i), latency + priority.at(j));
+
+    std::vector<size_t> order;
+    std::vector<bool> done(n, false);
+    int cycle = 0;
+    while (order.size() < n) {
+        size_t best = n;
+        for (size_t i = 0; i < n; i++) {
+            if (done.at(i) || predecessors.at(i)) continue;
+            if (best == n) { best = i; continue; }
+            int start = std::max(cycle, ready.at(i)), best_start = std::max(cycle, ready.at(best));
+            if (start < best_start || (start == best_start && priority.at(i) > priority.at(best))) best = i;
+        }
+        cycle = std::max(cycle, ready.at(best));
+        done.at(best) = true;
+        order.push_back(best);
+        for (auto [j, latency]: successors.at(best)) {
+            ready.at(j) = std::max(ready.at(j), cycle + latency);
+            predecessors.at(j)--;
+        }
+        cycle++;
+    }
+    return order;
+}
+
+// Instructions the peephole rules look ahead from the one they start at
+static const size_t peephole_window = 8;
+
+static MachineInstr makeMove(const std::string &target, const std::string &source) {
+    MachineInstr move;
+    move.opcode = MOVE;
+    move.operands = {{MachineOperand::REG, target, ""}, {MachineOperand::REG, source, ""}};
+    return move;
+}
+
+// addi $sp, k or addi $sp, $sp, k
+static std::optional<int> getStackAdjust(const MachineInstr &instr) {
+    static const std::regex decimal("-?[0-9]{1,5}");
+    auto &operands = instr.operands;
+    if ((instr.opcode != ADDI && instr.opcode != ADDIU) || operands.empty() || operands.front().value != "$sp")
+        return std::nullopt;
+    if (operands.size() == 3 && operands.at(1).value != "$sp") return std::nullopt;
+    if (operands.size() < 2 || operands.size() > 3 || !std::regex_match(operands.back().value, decimal))
+        return std::nullopt;
+    return std::stoi(operands.back().value);
+}
+
+static void setStackAdjust(MachineInstr &instr, int amount) {
+    instr.operands.back().value = std::to_string(amount);
+}
+
+// sw $x, A followed by lw $y, A: the load becomes move $y, $x
+static bool forwardStore(MachineFunction &function, size_t b, size_t i) {
+    auto &instrs = function.blocks.at(b).instrs;
+    auto store = instrs.at(i);
+    if (store.opcode != SW || getInstrInfo(store).barrier) return false;
+    auto &value = store.operands.front().value;
+    auto &address = store.operands.back();
+    for (size_t k = i + 1; k < instrs.size() && k <= i + peephole_window; k++) {
+        auto &instr = instrs.at(k);
+        if (instr.opcode == NONE) continue;
+        auto info = getInstrInfo(instr);
+        if (instr.opcode == LW && !info.barrier && instr.operands.back().kind == address.kind &&
+            instr.operands.back().value == address.value && instr.operands.back().base == address.base) {
+            if (instr.operands.front().value == value) instrs.erase(instrs.begin() + k);
+            else instr = makeMove(instr.operands.front().value, value);
+            return true;
+        }
+        if (info.stores || info.branch || info.barrier || info.defs.contains(value) ||
+            (address.kind == MachineOperand::MEM && info.defs.contains(address.base)))
+            return false;
+    }
+    return false;
+}
+
+// move A, B followed by a read of A: the read uses B while neither changes
+static bool propagateCopy(MachineFunction &function, size_t b, size_t i) {
+    auto &instrs = function.blocks.at(b).instrs;
+    auto copy = instrs.at(i);
+    if (copy.opcode != MOVE || getInstrInfo(copy).barrier) return false;
+    auto &target = copy.operands.at(0).value;
+    auto &source = copy.operands.at(1).value;
+    if (target == source) return false;
+    for (size_t k = i + 1; k < instrs.size() && k <= i + peephole_window; k++) {
+        auto &instr = instrs.at(k);
+        if (instr.opcode == NONE) continue;
+        auto info = getInstrInfo(instr);
+        if (info.barrier) return false;
+        if (info.uses.contains(target) && !info.defs.contains(target)) {
+            for (auto &operand: instr.operands) {
+                if (operand.kind == MachineOperand::REG && operand.value == target) operand.value = source;
+                if (operand.kind == MachineOperand::MEM && operand.base == target) operand.base = source;
+            }
+            return true;
+        }
+        if (info.branch || info.defs.contains(target) || info.defs.contains(source)) return false;
+    }
+    return false;
+}
+
+// move A, A, or move A, B when A is written again in the block before anything reads it
+static bool removeMove(MachineFunction &function, size_t b, size_t i) {
+    auto &instrs = function.blocks.at(b).instrs;
+    auto &copy = instrs.at(i);
+    if (copy.opcode != MOVE || getInstrInfo(copy).barrier) return false;
+    auto target = copy.operands.at(0).value;
+    bool dead = target == copy.operands.at(1).value;
+    for (size_t k = i + 1; !dead && k < instrs.size() && k <= i + peephole_window; k++) {
+        if (instrs.at(k).opcode == NONE) continue;
+        auto info = getInstrInfo(instrs.at(k));
+        if (info.uses.contains(target) || info.branch || (info.barrier && instrs.at(k).opcode != SYSCALL)) return false;
+        dead = info.defs.contains(target);
+    }
+    if (dead) instrs.erase(instrs.begin() + i);
+    return dead;
+}
+
+// Two stack adjustments with only $sp based accesses between them become one. Pushes keep the first adjustment and
+// pops the last, so nothing is written or read below $sp
+static bool mergeStackAdjust(MachineFunction &function, size_t b, size_t i) {
+    static const std::regex decimal("-?[0-9]{0,5}");
+    auto &instrs = function.blocks.at(b).instrs;
+    auto first = getStackAdjust(instrs.at(i));
+    if (!first) return false;
+    std::vector<size_t> between;
+    for (size_t k = i + 1; k < instrs.size() && k <= i + peephole_window; k++) {
+        auto &instr = instrs.at(k);
+        if (instr.opcode == NONE) continue;
+        auto second = getStackAdjust(instr);
+        if (second) {
+            if (!between.empty() && ((*first < 0) != (*second < 0))) return false;
+            bool keep_first = *first < 0 || between.empty();
+            for (auto j: between)
+                for (auto &operand: instrs.at(j).operands) {
+                    if (operand.kind != MachineOperand::MEM || operand.base != "$sp") continue;
+                    int offset = operand.value.empty() ? 0 : std::stoi(operand.value);
+                    operand.value = std::to_string(keep_first ? offset - *second : offset + *first);
+                }
+            auto kept = keep_first ? i : k, removed = keep_first ? k : i;
+            setStackAdjust(instrs.at(kept), *first + *second);
+            bool empty = *first + *second == 0;
+            instrs.erase(instrs.begin() + removed);
+            if (empty) instrs.erase(instrs.begin() + kept - (removed < kept ? 1 : 0));
+            return true;
+        }
+        auto info = getInstrInfo(instr);
+        if (info.branch || info.barrier) return false;
+        for (auto &operand: instr.operands) {
+            if (operand.kind == MachineOperand::REG && operand.value == "$sp") return false;
+            if (operand.kind == MachineOperand::MEM && operand.base == "$sp" && !std::regex_match(operand.value, decimal))
+                return false;
+        }
+        between.push_back(k);
+    }
+    return false;
+}
+
+// A branch to the label right after it
+static bool removeBranchToNext(MachineFunction &function, size_t b, size_t i) {
+    auto &instrs = function.blocks.at(b).instrs;
+    auto &branch = instrs.at(i);
+    auto info = getInstrInfo(branch);
+    if (!info.branch || branch.opcode == JAL || branch.opcode == JR || branch.opcode == JALR) return false;
+    if (branch.operands.empty() || branch.operands.back().kind != MachineOperand::LABEL) return false;
+    for (size_t k = i + 1; k < instrs.size(); k++) if (instrs.at(k).opcode != NONE) return false;
+    auto &target = branch.operands.back().value;
+    for (size_t c = b + 1; c < function.blocks.size(); c++) {
+        auto &block = function.blocks.at(c);
+        if (block.label == target) {
+            instrs.erase(instrs.begin() + i);
+            return true;
+        }
+        if (std::any_of(block.instrs.begin(), block.instrs.end(), [](const MachineInstr &instr) {
+            return instr.opcode != NONE;
+        })) return false;
+    }
+    return false;
+}
+
+// Longest instruction sequence the outliner moves to a stub
+static const size_t outline_length = 12;
+
+// Function code with its own labels numbered in order and without comments, equal for copies under other labels
+static std::string getCanonicalText(const MachineFunction &function) {
+    std::unordered_map<std::string, std::string> local;
+    for (auto &block: function.blocks) {
+        auto number = "%" + std::to_string(local.size());
+        if (!block.label.empty()) local[block.label] = number;
+    }
+    std::string text;
+    for (auto &block: function.blocks) {
+        text += (block.label.empty() ? "" : local.at(block.label)) + ":\n";
+        for (auto instr: block.instrs) {
+            if (instr.opcode == NONE) continue;
+            instr.comment.clear();
+            for (auto &operand: instr.operands)
+                if (operand.kind == MachineOperand::LABEL && local.contains(operand.value))
+                    operand.value = local.at(operand.value);
+            text += printInstr(instr) + "\n";
+        }
+    }
+    return text;
+}
+
+// The function ends in an unconditional jump, so it never falls into the code after it
+static bool endsInJump(const MachineFunction &function) {
+    for (auto block = function.blocks.rbegin(); block != function.blocks.rend(); block++)
+        for (auto instr = block->instrs.rbegin(); instr != block->instrs.rend(); instr++)
+            if (instr->opcode != NONE) return instr->opcode == B || instr->opcode == J || instr->opcode == JR;
+    return false;
+}
+
+// Instructions a stub can run instead: no branches, comments, opaque instructions or uses of $ra
+static bool isOutlinable(const MachineInstr &instr) {
+    if (instr.opcode == NONE || instr.opcode == UNKNOWN) return false;
+    auto info = getInstrInfo(instr);
+    if (info.branch || (info.barrier && instr.opcode != SYSCALL)) return false;
+    return !info.uses.contains("$ra") && !info.defs.contains("$ra");
+}
+
+static const std::vector<PeepholeRule> peephole_rules = {
+    {"store-to-load", forwardStore},
+    {"copy-propagation", propagateCopy},
+    {"redundant-move", removeMove},
+    {"stack-merge", mergeStackAdjust},
+    {"branch-to-next", removeBranchToNext}
+};
+
+MachineCode::MachineCode(const std::vector<MachineInstr> &code, const std::set<std::string> &entries,
+    const std::set<std::string> &data_labels): data_labels(data_labels) {
+    // A branch ends its block, the next instruction starts an unlabeled one
+    bool open = false;
+    for (auto &instr: code) {
+        if (!instr.label.empty()) {
+            if (functions.empty() || entries.contains(instr.label)) functions.push_back({instr.label, {}});
+            functions.back().blocks.push_back({instr.label, instr.comment, {}});
+            open = true;
+            continue;
+        }
+        if (functions.empty()) functions.push_back({"", {}});
+        if (!open) functions.back().blocks.push_back({});
+        open = true;
+        functions.back().blocks.back().instrs.push_back(instr);
+        if (getInstrInfo(instr).branch) open = false;
+    }
+}
+
+MachineCode::MachineCode(const std::string &text, const std::set<std::string> &entries,
+    const std::set<std::string> &data_labels): MachineCode(parseCode(text), entries, data_labels) {}
+
+void MachineCode::peephole() {
+    std::vector<int> hits(peephole_rules.size(), 0);
+    for (auto &function: functions) {
+        for (size_t b = 0; b < function.blocks.size(); b++) {
+            // A rewrite can enable a rule at an earlier instruction, so the block is scanned until nothing changes
+            bool changed = true;
+            while (changed) {
+                changed = false;
+                for (size_t i = 0; i < function.blocks.at(b).instrs.size(); i++) {
+                    for (size_t r = 0; r < peephole_rules.size(); r++) {
+                        if (!peephole_rules.at(r).apply(function, b, i)) continue;
+                        hits.at(r)++;
+                        changed = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    report += "peephole:";
+    for (size_t r = 0; r < peephole_rules.size(); r++)
+        report += std::string((r == 0) ? " " : ", ") + peephole_rules.at(r).name + " " + std::to_string(hits.at(r));
+    report += "\n";
+}
+
+// Functions with the same code under different labels keep the first copy, and the references to the others go to it.
+// The data section can't be redirected, so functions with labels it references are kept
+void MachineCode::foldIdentical() {
+    std::unordered_map<std::string, std::set<size_t>> references;
+    for (size_t f = 0; f < functions.size(); f++)
+        for (auto &block: functions.at(f).blocks)
+            for (auto &instr: block.instrs)
+                for (auto &operand: instr.operands)
+                    if (operand.kind == MachineOperand::LABEL) references[operand.value].insert(f);
+
+    std::unordered_map<std::string, size_t> copies;
+    std::unordered_map<std::string, std::string> renames;
+    std::vector<bool> removed(functions.size(), false);
+    for (size_t f = 0; f < functions.size(); f++) {
+        auto &function = functions.at(f);
+        if (function.name.empty() || function.name == "main" || !endsInJump(function)) continue;
+        if (std::any_of(function.blocks.begin(), function.blocks.end(), [this](const MachineBasicBlock &block) {
+            return data_labels.contains(block.label);
+        })) continue;
+        auto text = getCanonicalText(function);
+        if (!copies.contains(text)) {
+            copies[text] = f;
+            continue;
+        }
+        // Other code jumping inside the copy, or the previous function falling into it, keeps it
+        bool entered = std::any_of(function.blocks.begin() + 1, function.blocks.end(), [&](const MachineBasicBlock &block) {
+            return !block.label.empty() && references.contains(block.label) &&
+                std::any_of(references.at(block.label).begin(), references.at(block.label).end(),
+                    [f](size_t other) { return other != f; });
+        });
+        if (entered || !endsInJump(functions.at(f - 1))) continue;
+        renames[function.name] = functions.at(copies.at(text)).name;
+        removed.at(f) = true;
+    }
+
+    std::vector<MachineFunction> kept;
+    for (size_t f = 0; f < functions.size(); f++) {
+        if (removed.at(f)) continue;
+        kept.push_back(functions.at(f));
+        for (auto &block: kept.back().blocks)
+            for (auto &instr: block.instrs)
+                for (auto &operand: instr.operands)
+                    if (operand.kind == MachineOperand::LABEL && renames.contains(operand.value))
+                        operand.value = renames.at(operand.value);
+    }
+    functions = kept;
+    report += "fold: " + std::to_string(renames.size()) + " identical functions folded\n";
+}
+
+// Repeated instruction sequences move to stubs that end in jr $ra, and each copy becomes a jal. The jal overwrites $ra,
+// so only functions that save it in their prologue are outlined, between the save and the restore
+void MachineCode::outline() {
+    struct Site {
+        size_t function, block, instr;
+    };
+    int sequences = 0, saved = 0;
+    std::vector<MachineFunction> stubs;
+    while (true) {
+        std::unordered_map<std::string, std::vector<Site>> candidates;
+        for (size_t f = 0; f < functions.size(); f++) {
+            bool saves = false;
+            for (size_t b = 0; b < functions.at(f).blocks.size(); b++) {
+                auto &instrs = functions.at(f).blocks.at(b).instrs;
+                std::vector<std::string> texts;
+                for (auto instr: instrs) {
+                    instr.comment.clear();
+                    texts.push_back(printInstr(instr) + "\n");
+                }
+                size_t start = 0, end = instrs.size();
+                for (size_t k = 0; k < instrs.size(); k++) {
+                    auto info = getInstrInfo(instrs.at(k));
+                    if (instrs.at(k).opcode == SW && info.uses.contains("$ra")) {
+                        saves = true;
+                        start = k + 1;
+                    }
+                    if (info.defs.contains("$ra") && !info.branch && end == instrs.size()) end = k;
+                }
+                if (!saves) continue;
+                for (size_t i = start; i < end; i++) {
+                    std::string key;
+                    for (size_t length = 1; length <= outline_length && i + length <= end; length++) {
+                        if (!isOutlinable(instrs.at(i + length - 1))) break;
+                        key += texts.at(i + length - 1);
+                        if (length > 1) candidates[key].push_back({f, b, i});
+                    }
+                }
+            }
+        }
+
+        // Each copy costs a jal, and the stub adds its jr $ra
+        std::vector<Site> best_sites;
+        size_t best_length = 0;
+        int best_benefit = 0;
+        for (auto &[key, sites]: candidates) {
+            size_t length = std::count(key.begin(), key.end(), '\n');
+            std::vector<Site> chosen;
+            for (auto &site: sites) {
+                if (!chosen.empty() && chosen.back().function == site.function && chosen.back().block == site.block &&
+                    site.instr < chosen.back().instr + length) continue;
+                chosen.push_back(site);
+            }
+            int n = chosen.size(), size = length, benefit = n * size - n - size - 1;
+            auto first = [](const Site &site) { return std::tie(site.function, site.block, site.instr); };
+            if (benefit > best_benefit || (benefit == best_benefit && benefit > 0 &&
+                (first(chosen.front()) < first(best_sites.front()) ||
+                (first(chosen.front()) == first(best_sites.front()) && length > best_length)))) {
+                best_sites = chosen;
+                best_length = length;
+                best_benefit = benefit;
+            }
+        }
+        if (best_benefit <= 0) break;
+
+        auto name = "outlined" + std::to_string(stubs.size());
+        auto &model = functions.at(best_sites.front().function).blocks.at(best_sites.front().block).instrs;
+        MachineBasicBlock body = {name, "", {model.begin() + best_sites.front().instr,
+            model.begin() + best_sites.front().instr + best_length}};
+        body.instrs.push_back(parseInstr("jr $ra"));
+        stubs.push_back({name, {body}});
+        for (auto site = best_sites.rbegin(); site != best_sites.rend(); site++) {
+            auto &instrs = functions.at(site->function).blocks.at(site->block).instrs;
+            instrs.erase(instrs.begin() + site->instr, instrs.begin() + site->instr + best_length);
+            instrs.insert(instrs.begin() + site->instr, parseInstr("jal " + name));
+        }
+        sequences += best_sites.size();
+        saved += best_benefit;
+    }
+
+    // Each jal ends its block, so its delay slot is filled like any other
+    for (auto &function: functions) {
+        for (size_t b = 0; b < function.blocks.size(); b++) {
+            auto &instrs = function.blocks.at(b).instrs;
+            for (size_t k = 0; k < instrs.size(); k++) {
+                if (!getInstrInfo(instrs.at(k)).branch) continue;
+                if (std::all_of(instrs.begin() + k + 1, instrs.end(), [](const MachineInstr &instr) {
+                    return instr.opcode == NONE;
+                })) break;
+                MachineBasicBlock rest = {"", "", {instrs.begin() + k + 1, instrs.end()}};
+                instrs.resize(k + 1);
+                function.blocks.insert(function.blocks.begin() + b + 1, rest);
+                break;
+            }
+        }
+    }
+    functions.insert(functions.end(), stubs.begin(), stubs.end());
+    report += "outline: " + std::to_string(sequences) + " sequences into " + std::to_string(stubs.size()) + " stubs, " +
+        std::to_string(saved) + " instructions saved\n";
+}
+
+void MachineCode::schedule() {
+    int before = 0, after = 0, reordered = 0;
+    for (auto &function: functions) {
+        for (auto &block: function.blocks) {
+            // Comments, blank lines and barriers split the block in runs that are scheduled separately
+            auto &instrs = block.instrs;
+            size_t start = 0;
+            for (size_t i = 0; i <= instrs.size(); i++) {
+                bool boundary = i == instrs.size() || instrs.at(i).opcode == NONE || getInstrInfo(instrs.at(i)).barrier;
+                if (!boundary) continue;
+                if (i > start) {
+                    std::vector<InstrInfo> infos;
+                    std::vector<size_t> original;
+                    for (size_t k = start; k < i; k++) {
+                        infos.push_back(getInstrInfo(instrs.at(k)));
+                        original.push_back(original.size());
+                    }
+                    auto order = scheduleRun(infos);
+                    int stalls = countStalls(infos, original), order_stalls = countStalls(infos, order);
+                    before += stalls;
+                    after += std::min(stalls, order_stalls);
+                    // Keep the original order unless it saves cycles
+                    if (order_stalls < stalls) {
+                        std::vector<MachineInstr> run;
+                        for (auto k: order) run.push_back(instrs.at(start + k));
+                        std::copy(run.begin(), run.end(), instrs.begin() + start);
+                        reordered++;
+                    }
+                }
+                start = i + 1;
+            }
+        }
+    }
+    report += "schedule: " + std::to_string(before) + " -> " + std::to_string(after) + " stall cycles, " +
+        std::to_string(reordered) + " blocks reordered\n";
+}
+
+// With .set noreorder the instruction after a branch always runs, so it is taken from the same block when the branch
+// and the instructions between them do not depend on it, and a nop fills the slot otherwise
+void MachineCode::fillDelaySlots() {
+    noreorder = true;
+    int branches = 0, filled = 0;
+    std::vector<std::pair<size_t, size_t>> jumps;
+    for (size_t f = 0; f < functions.size(); f++) {
+        for (size_t b = 0; b < functions.at(f).blocks.size(); b++) {
+            auto &instrs = functions.at(f).blocks.at(b).instrs;
+            size_t last = instrs.size();
+            while (last > 0 && instrs.at(last - 1).opcode == NONE) last--;
+            if (last == 0) continue;
+            auto branch = getInstrInfo(instrs.at(last - 1));
+            if (!branch.branch) continue;
+            branches++;
+
+            MachineInstr slot;
+            slot.opcode = NOP;
+            std::vector<InstrInfo> between;
+            for (size_t k = last - 1; k-- > 0;) {
+                if (instrs.at(k).opcode == NONE) continue;
+                auto candidate = getInstrInfo(instrs.at(k));
+                if (candidate.barrier) break;
+                bool independent = !candidate.macro && instrs.at(k).opcode != NOP && !conflicts(candidate, branch) &&
+                    std::none_of(between.begin(), between.end(),
+                        [&candidate](const InstrInfo &other) { return conflicts(candidate, other); });
+                if (independent) {
+                    slot = instrs.at(k);
+                    instrs.erase(instrs.begin() + k);
+                    last--;
+                    filled++;
+                    break;
+                }
+                between.push_back(candidate);
+            }
+            auto opcode = instrs.at(last - 1).opcode;
+            if (slot.opcode == NOP && (opcode == B || opcode == J)) jumps.push_back({f, b});
+            instrs.insert(instrs.begin() + last, slot);
+        }
+    }
+
+    // An unconditional jump that found nothing before it takes the first instruction of its target and skips it there
+    std::unordered_map<std::string, std::pair<size_t, size_t>> targets;
+    for (size_t f = 0; f < functions.size(); f++)
+        for (size_t b = 0; b < functions.at(f).blocks.size(); b++)
+            if (!functions.at(f).blocks.at(b).label.empty()) targets[functions.at(f).blocks.at(b).label] = {f, b};
+    std::map<std::pair<size_t, size_t>, std::string> entries;
+    for (auto [f, b]: jumps) {
+        auto &instrs = functions.at(f).blocks.at(b).instrs;
+        auto jump = std::find_if(instrs.rbegin(), instrs.rend(), [](const MachineInstr &instr) {
+            return instr.opcode == B || instr.opcode == J;
+        });
+        auto &label = jump->operands.back().value;
+        if (!targets.contains(label)) continue;
+        auto [tf, tb] = targets.at(label);
+        auto &blocks = functions.at(tf).blocks;
+        while (tb < blocks.size() && blocks.at(tb).instrs.empty()) tb++;
+        if (tb == blocks.size()) continue;
+        auto &first = blocks.at(tb).instrs.front();
+        auto info = getInstrInfo(first);
+        if (first.opcode == NONE || info.macro || info.branch || info.barrier) continue;
+        if (!entries.contains({tf, tb})) entries[{tf, tb}] = label + "_slot";
+        label = entries.at({tf, tb});
+        *(jump.base()) = first;
+        filled++;
+    }
+    for (auto entry = entries.rbegin(); entry != entries.rend(); entry++) {
+        auto [f, b] = entry->first;
+        auto &blocks = functions.at(f).blocks;
+        MachineBasicBlock rest = {entry->second, "", {blocks.at(b).instrs.begin() + 1, blocks.at(b).instrs.end()}};
+        blocks.at(b).instrs.resize(1);
+        blocks.insert(blocks.begin() + b + 1, rest);
+    }
+
+    report += "delay slots: " + std::to_string(filled) + " of " + std::to_string(branches) + " filled\n";
+}
+
+std::vector<MachineFunction>& MachineCode::getFunctions() {
+    return functions;
+}
+
+std::string MachineCode::print() {
+    std::string text = (noreorder) ? ".set noreorder\n" : "";
+    for (auto &function: functions) {
+        for (auto &block: function.blocks) {
+            if (!block.label.empty()) text += block.label + ":" + (block.comment.empty() ? "" : " # " + block.comment) + "\n";
+            for (auto &instr: block.instrs) text += printInstr(instr) + "\n";
+        }
+    }
+    return text;
+}
+
+std::string MachineCode::getReport() {
+    return report;
+}
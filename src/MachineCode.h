@@ -0,0 +1,130 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <set>
+
+namespace CompiScript {
+
+enum Opcode {
+    NONE,
+    ADD, ADDU, ADDI, ADDIU, SUB, SUBU, AND, ANDI, OR, ORI, XOR, XORI, NOR,
+    SLT, SLTI, SLTU, SLTIU, SLL, SRL, SRA, SLLV, SRLV, SRAV,
+    MOVN, MOVZ, MUL, MULT, MULTU, DIV, DIVU, MFHI, MFLO, MTHI, MTLO,
+    LUI, LI, LA, MOVE, NOT, NEG, SEQ, SNE, SGT, SGE, SLE, SGTU, SGEU, SLEU, ABS, REM, REMU,
+    LW, LH, LHU, LB, LBU, SW, SH, SB,
+    B, J, JAL, JR, JALR, BEQ, BNE, BEQZ, BNEZ, BLTZ, BGTZ, BLEZ, BGEZ, BLT, BGT, BLE, BGE,
+    SYSCALL, NOP,
+    UNKNOWN
+};
+
+/*
+Operando de una instruccion de maquina.
+kind - Registro, inmediato, etiqueta o direccion de memoria
+value - Registro con $, valor del inmediato, etiqueta, o desplazamiento de la direccion (puede ser vacio)
+base - Registro base de una direccion offset(base)
+*/
+struct MachineOperand {
+    enum Kind { REG, IMM, LABEL, MEM } kind = LABEL;
+    std::string value;
+    std::string base;
+};
+
+/*
+Instruccion de maquina.
+opcode - Operacion, NONE para comentarios y lineas en blanco que solo se conservan en la salida
+operands - Operandos en el orden del ensamblador
+comment - Comentario al final de la linea, sin #
+name - Mnemonico de las instrucciones UNKNOWN, que no estan en la tabla
+label - Etiqueta de la linea, solo en el codigo que aun no se separa en bloques
+*/
+struct MachineInstr {
+    Opcode opcode = NONE;
+    std::vector<MachineOperand> operands;
+    std::string comment;
+    std::string name;
+    std::string label;
+};
+
+/*
+Bloque basico de instrucciones de maquina. Empieza en una etiqueta o despues de un salto y termina en un salto.
+label - Etiqueta del bloque, vacia si se entra solo desde el bloque anterior
+comment - Comentario en la linea de la etiqueta
+instrs - Instrucciones del bloque, el salto que lo termina va al final
+*/
+struct MachineBasicBlock {
+    std::string label;
+    std::string comment;
+    std::vector<MachineInstr> instrs;
+};
+
+/*
+Subrutina, programa principal o rutina del runtime en codigo de maquina.
+name - Etiqueta de entrada, la etiqueta del primer bloque
+blocks - Bloques basicos en el orden en que se emiten
+*/
+struct MachineFunction {
+    std::string name;
+    std::vector<MachineBasicBlock> blocks;
+};
+
+/*
+Registros y memoria que usa una instruccion, para reordenarla.
+defs, uses - Registros que escribe y lee, incluyendo $at en las pseudoinstrucciones y hi/lo en mult y div
+loads, stores - Lee o escribe memoria
+branch - Salto o llamada, termina el bloque y tiene un delay slot
+barrier - syscall u otra instruccion que no se mueve ni permite mover nada a traves de ella
+macro - Pseudoinstruccion que el ensamblador expande en varias instrucciones, no puede ir en un delay slot
+latency - Ciclos hasta que su resultado puede usarse sin detener el pipeline
+*/
+struct InstrInfo {
+    std::set<std::string> defs;
+    std::set<std::string> uses;
+    bool loads = false;
+    bool stores = false;
+    bool branch = false;
+    bool barrier = false;
+    bool macro = false;
+    int latency = 1;
+};
+
+/*
+Regla del optimizador de mirilla.
+name - Nombre con el que se reportan sus aplicaciones
+apply - Intenta aplicar la regla empezando en una instruccion de un bloque, indica si cambio el codigo
+*/
+struct PeepholeRule {
+    std::string name;
+    bool (*apply)(MachineFunction &function, size_t block, size_t instr);
+};
+
+MachineInstr parseInstr(const std::string &line);
+std::vector<MachineInstr> parseCode(const std::string &text);
+std::string printInstr(const MachineInstr &instr);
+InstrInfo getInstrInfo(const MachineInstr &instr);
+
+class MachineCode {
+    private:
+    std::vector<MachineFunction> functions;
+    // Labels that the data section references, like the try ranges and handlers of err_table
+    std::set<std::string> data_labels;
+    std::string report;
+    bool noreorder = false;
+
+    public:
+    MachineCode(const std::vector<MachineInstr> &code, const std::set<std::string> &entries,
+        const std::set<std::string> &data_labels = {});
+    MachineCode(const std::string &text, const std::set<std::string> &entries,
+        const std::set<std::string> &data_labels = {});
+
+    void peephole();
+    void foldIdentical();
+    void outline();
+    void schedule();
+    void fillDelaySlots();
+
+    std::vector<MachineFunction>& getFunctions();
+    std::string print();
+    std::string getReport();
+};
+
+}
@@ -1,88 +1,619 @@
+#include <algorithm>
+#include <optional>
+#include <bit>
+#include <cstdint>
 #include <regex>
+#include <sstream>
+#include <stdexcept>
 #include <print>
 #include <string>
 #include <stack>
 #include <set>
+#include <tuple>
 
 #include "Mips.h"
 
 using namespace CompiScript;
 
-Mips::Mips(const std::vector<Quad> &quadruplets): quadruplets(quadruplets) {}
+Mips::Mips(const std::vector<Quad> &quadruplets, RegisterAllocation allocation, bool promote_globals,
+    bool schedule, bool noreorder, bool peephole, bool optimize_size, bool garbage_collect):
+    quadruplets(quadruplets),
+    allocation(allocation),
+    promote_globals(promote_globals),
+    schedule(schedule),
+    noreorder(noreorder),
+    peephole(peephole),
+    optimize_size(optimize_size),
+    garbage_collect(garbage_collect)
+{}
+
+// Literal second operand that fits in the 16 bit field of the immediate form of the operation.
+// Literals on the left of commutative operations are swapped to the right first
+static std::optional<int> takeImmediate(Quad &quad) {
+    auto literal = [](const std::string &value) -> std::optional<long long> {
+        if (value == "true") return 1;
+        if (value == "false" || value == "null") return 0;
+        if (!std::regex_match(value, std::regex("-?[0-9]{1,10}"))) return std::nullopt;
+        return std::stoll(value);
+    };
+    auto &op = quad.op;
+    bool commutative = op == "+" || op == "*" || op == "&&" || op == "||" || op == "==" || op == "!=";
+    if (commutative && literal(quad.arg1) && !literal(quad.arg2)) std::swap(quad.arg1, quad.arg2);
+
+    auto value = literal(quad.arg2);
+    if (!value) return std::nullopt;
+    auto in = [](long long value, long long low, long long high) { return low <= value && value <= high; };
+    bool fits =
+        (op == "+" || op == "<" || op == ">=") ? in(*value, -32768, 32767) :
+        (op == "-") ? in(-*value, -32768, 32767) :
+        (op == "<=" || op == ">") ? in(*value + 1, -32768, 32767) :
+        (op == "==" || op == "!=" || op == "&&" || op == "||") ? in(*value, 0, 65535) :
+        (op == "*" || op == "/" || op == "%") ? in(*value, INT32_MIN, INT32_MAX) :
+        false;
+    if (!fits) return std::nullopt;
+
+    quad.arg2.clear();
+    return *value;
+}
+
+// Multiplier and shift of the signed division by a constant (Hacker's Delight, 10-1)
+static std::pair<int, int> getMagic(uint32_t divisor) {
+    const uint32_t two31 = 0x80000000;
+    uint32_t anc = two31 - 1 - two31 % divisor;
+    uint32_t q1 = two31 / anc, r1 = two31 - q1 * anc;
+    uint32_t q2 = two31 / divisor, r2 = two31 - q2 * divisor;
+    uint32_t delta;
+    int p = 31;
+    do {
+        p++;
+        q1 *= 2; r1 *= 2;
+        if (r1 >= anc) { q1++; r1 -= anc; }
+        q2 *= 2; r2 *= 2;
+        if (r2 >= divisor) { q2++; r2 -= divisor; }
+        delta = divisor - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    return {int(q2 + 1), p - 32};
+}
+
+// Operands of the instructions that code selection builds
+static MachineOperand reg(const std::string &name) {
+    return {MachineOperand::REG, name, ""};
+}
+
+static MachineOperand imm(const std::string &value) {
+    return {MachineOperand::IMM, value, ""};
+}
+
+static MachineOperand imm(long long value) {
+    return imm(std::to_string(value));
+}
+
+static MachineOperand label(const std::string &name) {
+    return {MachineOperand::LABEL, name, ""};
+}
+
+static MachineOperand mem(const std::string &base) {
+    return {MachineOperand::MEM, "", base};
+}
+
+static MachineOperand mem(int offset, const std::string &base) {
+    return {MachineOperand::MEM, std::to_string(offset), base};
+}
+
+static void append(std::vector<MachineInstr> &code, const std::vector<MachineInstr> &more) {
+    code.insert(code.end(), more.begin(), more.end());
+}
+
+// The sequences below keep intermediate values in $at, no pseudo-instruction that needs it is emitted in between.
+// Multiplication by a constant, with shifts when it has at most two terms of the form 2^a +- 2^b
+static std::vector<MachineInstr> multiplyByConstant(const std::string &rx, const std::string &ry, int value) {
+    uint64_t magnitude = (value < 0) ? -int64_t(value) : value;
+    int low = std::countr_zero(magnitude);
+
+    if (value == 0) return {{MOVE, {reg(rx), reg("$zero")}}};
+    if (value == 1) return (rx == ry) ? std::vector<MachineInstr>{} : std::vector<MachineInstr>{{MOVE, {reg(rx), reg(ry)}}};
+    if (value == -1) return {{SUBU, {reg(rx), reg("$zero"), reg(ry)}}};
+    if (std::has_single_bit(magnitude)) {
+        std::vector<MachineInstr> code = {{SLL, {reg(rx), reg(ry), imm(low)}}};
+        if (value < 0) code.push_back({SUBU, {reg(rx), reg("$zero"), reg(rx)}});
+        return code;
+    }
+    if (value > 0 && (std::popcount(magnitude) == 2 || std::has_single_bit(magnitude + (1ull << low)))) {
+        bool add = std::popcount(magnitude) == 2;
+        int high = (add) ? std::bit_width(magnitude) - 1 : std::countr_zero(magnitude + (1ull << low));
+        std::vector<MachineInstr> code = {{SLL, {reg("$at"), reg(ry), imm(high)}}};
+        if (low > 0) code.push_back({SLL, {reg(rx), reg(ry), imm(low)}});
+        auto term = (low > 0) ? rx : ry;
+        code.push_back({(add) ? ADDU : SUBU, {reg(rx), reg("$at"), reg(term)}});
+        return code;
+    }
+    return {{LI, {reg("$at"), imm(value)}}, {MUL, {reg(rx), reg(ry), reg("$at")}}};
+}
+
+// Division and modulo by a constant, rounding towards zero like div. Powers of two use shifts that add
+// 2^k - 1 to negative dividends, other divisors multiply by their magic number and keep the high word
+static std::vector<MachineInstr> divideByConstant(const std::string &rx, const std::string &ry, int value, bool modulo) {
+    uint64_t magnitude = (value < 0) ? -int64_t(value) : value;
+    int bits = std::countr_zero(magnitude);
+    std::vector<MachineInstr> code;
+
+    if (magnitude == 1) {
+        if (modulo) return {{MOVE, {reg(rx), reg("$zero")}}};
+        if (value == 1) return (rx == ry) ? code : std::vector<MachineInstr>{{MOVE, {reg(rx), reg(ry)}}};
+        return {{SUBU, {reg(rx), reg("$zero"), reg(ry)}}};
+    }
+    if (std::has_single_bit(magnitude) && (!modulo || bits <= 16)) {
+        if (bits == 1) code.push_back({SRL, {reg("$at"), reg(ry), imm(31)}});
+        else {
+            code.push_back({SRA, {reg("$at"), reg(ry), imm(31)}});
+            code.push_back({SRL, {reg("$at"), reg("$at"), imm(32 - bits)}});
+        }
+        if (modulo) {
+            code.push_back({ADDU, {reg(rx), reg(ry), reg("$at")}});
+            code.push_back({ANDI, {reg(rx), reg(rx), imm(magnitude - 1)}});
+            code.push_back({SUBU, {reg(rx), reg(rx), reg("$at")}});
+        } else {
+            code.push_back({ADDU, {reg("$at"), reg("$at"), reg(ry)}});
+            code.push_back({SRA, {reg(rx), reg("$at"), imm(bits)}});
+        }
+    } else if (magnitude > 1 && !std::has_single_bit(magnitude) && (!modulo || rx != ry)) {
+        // The quotient is truncated by adding one when it is negative, the remainder needs the dividend after it
+        auto [magic, shift] = getMagic(magnitude);
+        code.push_back({LI, {reg("$at"), imm(magic)}});
+        code.push_back({MULT, {reg(ry), reg("$at")}});
+        code.push_back({MFHI, {reg("$at")}});
+        if (magic < 0) code.push_back({ADDU, {reg("$at"), reg("$at"), reg(ry)}});
+        if (shift > 0) code.push_back({SRA, {reg("$at"), reg("$at"), imm(shift)}});
+        code.push_back({SRL, {reg(rx), reg("$at"), imm(31)}});
+        code.push_back({ADDU, {reg(rx), reg(rx), reg("$at")}});
+        if (modulo) {
+            code.push_back({LI, {reg("$at"), imm(magnitude)}});
+            code.push_back({MUL, {reg("$at"), reg(rx), reg("$at")}});
+            code.push_back({SUBU, {reg(rx), reg(ry), reg("$at")}});
+        }
+    } else {
+        code.push_back({LI, {reg("$at"), imm(value)}});
+        code.push_back({DIV, {reg(ry), reg("$at")}});
+        code.push_back({(modulo) ? MFHI : MFLO, {reg(rx)}});
+        return code;
+    }
+    if (value < 0 && !modulo) code.push_back({SUBU, {reg(rx), reg("$zero"), reg(rx)}});
+    return code;
+}
+
+// Placeholders for the saved registers a subroutine uses, known once all of its code is generated
+static const MachineInstr save_marker = {.comment = "save"};
+static const MachineInstr restore_marker = {.comment = "restore"};
+
+// Allocations of objects, and the string operations, are the ones that take memory from heap_alloc.
+// Allocations into S variables always become regions in .data
+static bool usesHeap(const std::vector<Quad> &quadruplets) {
+    return std::any_of(quadruplets.begin(), quadruplets.end(), [](const Quad &quad) {
+        return (quad.op == "alloc" && !quad.result.starts_with("S")) || quad.op == "to_str" || quad.op == "concat" ||
+            quad.op == "append" || quad.op == "free";
+    });
+}
+
+// Locals and parameters used only by one top level subroutine get a slot in its frame, so
+// recursive calls don't share them and they don't need a label in .data
+void Mips::buildFrames() {
+    auto var_regex = std::regex("[WBS][0-9]+_.*");
+    std::set<std::string> assigned;
+    std::set<std::string> shared;
+    std::unordered_map<std::string, std::vector<std::string>> referenced;
+    std::unordered_map<std::string, int> arg_counts;
+
+    std::stack<std::string> regions;
+    for (auto &quad: quadruplets) {
+        if (quad.op == "begin") regions.push(quad.arg1);
+        auto name = (regions.empty()) ? "main" : regions.top();
+        auto &frame = frames[name];
+        if (quad.op == "call" || quad.op == "to_str" || quad.op == "concat" || quad.op == "append" || quad.op == "streql" ||
+            quad.op == "strneq" || quad.op == "alloc" || quad.op == "free")
+            frame.leaf = false;
+        if (quad.op == "arg") frame.stack_args = std::max(++arg_counts[name] - 4, 0);
+
+        bool local = regions.size() == 1 && name.starts_with("F");
+        for (auto &var: {quad.arg1, quad.arg2, quad.result}) {
+            if (!std::regex_match(var, var_regex) || quad.op == "begin" || quad.op == "end" || quad.op == "call") continue;
+            if (!local) shared.insert(var);
+            else if (std::ranges::find(referenced[name], var) == referenced[name].end())
+                referenced[name].push_back(var);
+        }
+        if (quad.op == "alloc") shared.insert(quad.result);
+        else if (!quad.result.empty()) assigned.insert(quad.result);
+        if (quad.op == "end") regions.pop();
+    }
+    // The program reports the collections before returning
+    if (garbage_collect && usesHeap(quadruplets)) frames["main"].leaf = false;
+
+    // Arguments never assigned stay in their registers
+    for (auto &[name, vars]: referenced) {
+        int offset = 0;
+        for (auto &var: vars) {
+            if (!assigned.contains(var) || shared.contains(var)) continue;
+            frames[name].locals[var] = offset;
+            offset += 4;
+        }
+    }
+}
+
+MachineOperand Mips::getAddress(const std::string &var) {
+    auto frame = frames.find(region);
+    if (frame == frames.end() || !frame->second.locals.contains(var)) return label(var);
+
+    auto current = (allocator) ? allocator->getRegion(region) : nullptr;
+    int slots = (current) ? current->slots : 0;
+    return mem(4 * (slots + 1) + frame->second.locals.at(var), "$fp");
+}
+
+// Subroutines with spill slots, locals or arguments after $a3 point $fp to their frame
+bool Mips::usesFramePointer(const std::string &name) {
+    auto current = (allocator) ? allocator->getRegion(name) : nullptr;
+    auto &frame = frames[name];
+    return (current && current->slots > 0) || !frame.locals.empty() || frame.stack_args > 0;
+}
+
+// The frame holds the caller's $fp, then the spill slots, the locals and $ra when the subroutine calls others.
+// Arguments after $a3 sit right above it, where the caller pushed them
+int Mips::getFrameSize(const std::string &name) {
+    auto current = (allocator) ? allocator->getRegion(name) : nullptr;
+    auto &frame = frames[name];
+    int slots = (current) ? current->slots : 0;
+    int words = (usesFramePointer(name)) ? slots + frame.locals.size() + 1 : 0;
+    return 4 * (words + (frame.leaf ? 0 : 1));
+}
+
+// Subroutines keep the $s registers of their caller, saving only the ones they use below the frame
+std::vector<MachineInstr> Mips::saveRegisters(const std::string &name, const std::vector<MachineInstr> &code) {
+    std::set<std::string> used;
+    if (name != "main") {
+        auto saved_regex = std::regex("\\$s[0-7]");
+        for (auto &instr: code)
+            for (auto &operand: instr.operands) {
+                auto &reg = (operand.kind == MachineOperand::MEM) ? operand.base : operand.value;
+                if (std::regex_match(reg, saved_regex)) used.insert(reg);
+            }
+    }
+
+    std::vector<MachineInstr> save, restore;
+    if (!used.empty()) {
+        save.push_back({ADDI, {reg("$sp"), imm(-4 * (long long) used.size())}});
+        int offset = 0;
+        for (auto &saved: used) {
+            save.push_back({SW, {reg(saved), mem(offset, "$sp")}});
+            restore.push_back({LW, {reg(saved), mem(offset, "$sp")}});
+            offset += 4;
+        }
+        restore.push_back({ADDI, {reg("$sp"), imm(4 * used.size())}});
+    }
+
+    std::vector<MachineInstr> result;
+    for (auto &instr: code) {
+        bool marker = instr.opcode == NONE && instr.label.empty();
+        if (marker && instr.comment == save_marker.comment) append(result, save);
+        else if (marker && instr.comment == restore_marker.comment) append(result, restore);
+        else result.push_back(instr);
+    }
+    return result;
+}
+
+// A push and pop around a call are only needed for a value used after the call that the callee may
+// change: an argument in a caller-saved $a register or a variable in .data that a recursive call reuses.
+// Locals in the frame survive the call in their own slot, except assigned arguments that the greedy mode
+// keeps in their $a register
+void Mips::removeCallSaves() {
+    auto var_regex = std::regex("[WBS][0-9]+_.*");
+
+    // Quads of each subroutine without the ones nested in it
+    std::vector<std::pair<std::string, std::vector<size_t>>> regions = {{"main", {}}};
+    std::stack<size_t> open;
+    open.push(0);
+    for (size_t i = 0; i < quadruplets.size(); i++) {
+        auto &quad = quadruplets.at(i);
+        if (quad.op == "begin") {
+            regions.push_back({quad.arg1, {}});
+            open.push(regions.size() - 1);
+        } else if (quad.op == "end") open.pop();
+        else regions.at(open.top()).second.push_back(i);
+    }
+
+    std::vector<bool> removed(quadruplets.size(), false);
+    for (auto &[name, positions]: regions) {
+        auto size = positions.size();
+        std::unordered_map<std::string, size_t> tags;
+        for (size_t k = 0; k < size; k++)
+            if (quadruplets.at(positions.at(k)).op == "tag") tags[quadruplets.at(positions.at(k)).arg1] = k;
+
+        std::vector<std::vector<size_t>> successors(size);
+        std::vector<std::set<std::string>> use(size), def(size);
+        for (size_t k = 0; k < size; k++) {
+            auto &quad = quadruplets.at(positions.at(k));
+            if (quad.op == "goto" && tags.contains(quad.arg1)) successors.at(k).push_back(tags.at(quad.arg1));
+            if ((quad.op == "if" || quad.op == "ifnot") && tags.contains(quad.arg2)) successors.at(k).push_back(tags.at(quad.arg2));
+            if (quad.op != "goto" && quad.op != "return" && k + 1 < size) successors.at(k).push_back(k + 1);
+
+            bool defines_arg = quad.op == "pop" || quad.op == "arg";
+            if (defines_arg) def.at(k).insert(quad.arg1);
+            else if (std::regex_match(quad.arg1, var_regex)) use.at(k).insert(quad.arg1);
+            if (std::regex_match(quad.arg2, var_regex)) use.at(k).insert(quad.arg2);
+            if (std::regex_match(quad.result, var_regex)) def.at(k).insert(quad.result);
+        }
+
+        std::vector<std::set<std::string>> live_in(size), live_out(size);
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (size_t k = size; k-- > 0;) {
+                std::set<std::string> out;
+                for (auto next: successors.at(k)) out.insert(live_in.at(next).begin(), live_in.at(next).end());
+                auto in = use.at(k);
+                for (auto &var: out) if (!def.at(k).contains(var)) in.insert(var);
+                if (in != live_in.at(k) || out != live_out.at(k)) changed = true;
+                live_in.at(k) = std::move(in);
+                live_out.at(k) = std::move(out);
+            }
+        }
+
+        auto &locals = frames[name].locals;
+        std::set<std::string> in_arg_registers;
+        if (allocation == GREEDY)
+            for (size_t k = 0; k < size && k < 4 && quadruplets.at(positions.at(k)).op == "arg"; k++)
+                in_arg_registers.insert(quadruplets.at(positions.at(k)).arg1);
+        int pushes = 0, eliminated = 0;
+        for (size_t k = 0; k < size; k++) {
+            if (quadruplets.at(positions.at(k)).op != "call") continue;
+
+            size_t first = k;
+            while (first > 0 && quadruplets.at(positions.at(first - 1)).op == "param") first--;
+            while (first > 0 && quadruplets.at(positions.at(first - 1)).op == "push") first--;
+            size_t last = k;
+            while (last + 1 < size && quadruplets.at(positions.at(last + 1)).op == "pop") last++;
+
+            for (auto push = first; push < k && quadruplets.at(positions.at(push)).op == "push"; push++) {
+                auto &var = quadruplets.at(positions.at(push)).arg1;
+                pushes++;
+                bool survives = locals.contains(var) && !in_arg_registers.contains(var);
+                if (live_out.at(last).contains(var) && !survives) continue;
+
+                for (auto pop = k + 1; pop <= last; pop++) {
+                    if (removed.at(positions.at(pop)) || quadruplets.at(positions.at(pop)).arg1 != var) continue;
+                    removed.at(positions.at(push)) = removed.at(positions.at(pop)) = true;
+                    eliminated++;
+                    break;
+                }
+            }
+        }
+        if (pushes > 0)
+            report += "saves: " + name + ": " + std::to_string(eliminated) + " of " + std::to_string(pushes) + " pushes eliminated\n";
+    }
+
+    std::vector<Quad> kept;
+    for (size_t i = 0; i < quadruplets.size(); i++)
+        if (!removed.at(i)) kept.push_back(quadruplets.at(i));
+    quadruplets = std::move(kept);
+}
 
 std::string Mips::generateDataSection() {
     std::string data_section;
+    buildFrames();
 
     auto string_regex = std::regex("\"([^\"\r\n])*\"");
-    auto int_regex = std::regex("[0-9]+");
+    auto int_regex = std::regex("-?[0-9]+");
+
+    // Only values stored once can be taken straight from .data: either the quad runs a
+    // single time (outside subroutines and loops) or the variable is never reassigned
+    std::unordered_map<std::string, int> assignments;
+    for (auto &quad: quadruplets) assignments[quad.result]++;
+
+    std::vector<bool> runs_once(quadruplets.size(), true);
+    std::unordered_map<std::string, size_t> tags;
+    int depth = 0;
+    for (size_t i = 0; i < quadruplets.size(); i++) {
+        auto &quad = quadruplets.at(i);
+        if (quad.op == "begin") depth++;
+        if (quad.op == "end") depth--;
+        if (quad.op == "tag") tags[quad.arg1] = i;
+        runs_once.at(i) = depth == 0 && quad.op != "end";
+
+        auto target = (quad.op == "goto") ? quad.arg1 : (quad.op == "if" || quad.op == "ifnot") ? quad.arg2 : "";
+        if (tags.contains(target))
+            std::fill(runs_once.begin() + tags.at(target), runs_once.begin() + i + 1, false);
+    }
+
+    // Size of .data so far, .space doesn't align itself like .word does
+    int offset = 0;
+    auto string_size = [](const std::string &literal) {
+        int size = 1;
+        for (size_t k = 1; k + 1 < literal.size(); k++, size++)
+            if (literal.at(k) == '\\') k++;
+        return size;
+    };
+
+    // Strings keep their length in the word before the characters. Equal literals share one label, so comparing them
+    // only compares the pointers
+    std::unordered_map<std::string, std::string> literals;
+    auto declareString = [&](std::string &literal) {
+        if (!literals.contains(literal)) {
+            auto string_var = "str" + std::to_string(literals.size());
+            data_section += "\t\t.word\t" + std::to_string(string_size(literal) - 1) + "\n";
+            data_section += string_var + ":\t\t.asciiz\t" + literal + "\n";
+            offset = (offset + 3) / 4 * 4 + 4 + string_size(literal);
+            literals[literal] = string_var;
+        }
+        literal = literals.at(literal);
+    };
+
+    // Words of an object or global that hold strings or objects: their count and then their offsets
+    bool collect = garbage_collect && usesHeap(quadruplets);
+    std::vector<std::pair<std::string, std::string>> roots;
+    auto declareMap = [&](const std::string &map) {
+        if (!pointer_maps.contains(map)) {
+            auto label = "gc_map" + std::to_string(pointer_maps.size());
+            auto count = std::count(map.begin(), map.end(), ';') + 1;
+            auto offsets = std::regex_replace(map, std::regex(";"), ", ");
+            data_section += label + ":\t\t.word\t" + std::to_string(count) + ", " + offsets + "\n";
+            offset = (offset + 3) / 4 * 4 + 4 * (count + 1);
+            pointer_maps[map] = label;
+        }
+        return pointer_maps.at(map);
+    };
 
-    int string_count = 0;
     std::set<std::string> variables;
+    for (auto &[name, frame]: frames)
+        for (auto &[var, offset]: frame.locals) variables.insert(var);
     for (int i = 0; i < quadruplets.size(); i++) {
         auto &quad = quadruplets.at(i);
         // Handle strings
-        if (std::regex_match(quad.arg1, string_regex)) {
-            auto string_var = "str" + std::to_string(string_count++);
-            auto string_declaration = string_var + ":\t\t.asciiz\t" + quad.arg1 + "\n";
-            quad.arg1 = string_var;
-            data_section += string_declaration;
-        }
+        if (std::regex_match(quad.arg1, string_regex)) declareString(quad.arg1);
+        if (std::regex_match(quad.arg2, string_regex)) declareString(quad.arg2);
 
-        if (std::regex_match(quad.arg2, string_regex)) {
-            auto string_var = "str" + std::to_string(string_count++);
-            auto string_declaration = string_var + ":\t\t.asciiz\t" + quad.arg2 + "\n";
-            quad.arg2 = string_var;
-            data_section += string_declaration;
+        // Pairs of digits that to_string copies after each division by 100
+        if (quad.op == "to_str" && !variables.contains("to_string_digits")) {
+            std::string digits;
+            for (int pair = 0; pair < 100; pair++) digits += std::to_string(pair / 10) + std::to_string(pair % 10);
+            data_section += "to_string_digits:\t.ascii\t\"" + digits + "\"\n";
+            offset += 200;
+            variables.insert("to_string_digits");
         }
 
         // Add error message
         if (quad.op == "iferr" && !variables.contains("err_bad_index_msg")) {
+            data_section += "\t\t.word\t32\n";
             data_section += "err_bad_index_msg:     .asciiz \"Out of bounds index was recieved\"\n";
+            offset = (offset + 3) / 4 * 4 + 4 + 33;
             variables.insert("err_bad_index_msg");
             continue;
         }
 
+        // Maps of the objects that go to the heap
+        if (collect && quad.op == "alloc" && !quad.result.starts_with("S") && !quad.arg2.empty()) declareMap(quad.arg2);
+
         // Handle variables
         if (quad.result.empty() || variables.contains(quad.result)) continue;
 
+        bool hoist = runs_once.at(i) || assignments[quad.result] == 1;
+        bool erase = false;
         std::string var_declaration;
         if (quad.result.starts_with("W")) {
             var_declaration = quad.result + ":\t\t.word\t";
-            if (std::regex_match(quad.arg1, int_regex)) {
+            offset = (offset + 3) / 4 * 4 + 4;
+            if (hoist && std::regex_match(quad.arg1, int_regex)) {
                 var_declaration += quad.arg1 + "\n";
-                quadruplets.erase(quadruplets.begin() + i);
+                erase = true;
             }
             else var_declaration += "0\n";
         }
         if (quad.result.starts_with("B")) {
             var_declaration = quad.result + ":\t\t.byte\t";
-            if (quad.arg1 == "false" || quad.arg1 == "null") {
+            offset += 1;
+            if (hoist && (quad.arg1 == "false" || quad.arg1 == "null")) {
                 var_declaration += "0\n";
-                quadruplets.erase(quadruplets.begin() + i);
-            } else if (quad.arg1 == "true") {
+                erase = true;
+            } else if (hoist && quad.arg1 == "true") {
                 var_declaration += "1\n";
-                quadruplets.erase(quadruplets.begin() + i);
+                erase = true;
             } 
             else var_declaration += "0\n";
         }
         if (quad.result.starts_with("S")) {
-            auto storage_type = (quad.op == "alloc") ? ":\t\t.space\t"+ quad.arg1: ":\t\t.word\t0";
+            // Globals that hold strings or objects are the roots of the collector, along with the stack and registers
+            auto map = (quad.op == "alloc") ? quad.arg2 : "0";
+            if (collect && !map.empty()) roots.push_back({quad.result, declareMap(map)});
+
             if (quad.op == "alloc") {
-                var_declaration = quad.result + ":\t\t.space\t"+ quad.arg1 + "\n";
-                quadruplets.erase(quadruplets.begin() + i);
+                auto size = std::stoi(quad.arg1);
+
+                // Constant stores right after a single allocation become the initial contents
+                std::string width;
+                std::vector<std::string> values;
+                size_t stores = 0;
+                for (size_t j = i + 1; runs_once.at(i) && j + 1 < quadruplets.size(); j += 2) {
+                    auto &address = quadruplets.at(j);
+                    auto &store = quadruplets.at(j + 1);
+                    if (address.op != "+" || address.result != "i" || address.arg1 != quad.result) break;
+                    if (!std::regex_match(address.arg2, int_regex) || !store.op.empty() || !store.result.starts_with("i*")) break;
+
+                    auto value = (store.arg1 == "true") ? "1" : (store.arg1 == "false" || store.arg1 == "null") ? "0" : store.arg1;
+                    auto store_width = store.result.substr(2);
+                    auto element_size = (store_width == "w") ? 4 : 1;
+                    auto position = std::stoi(address.arg2);
+                    if (!std::regex_match(value, int_regex) || (!width.empty() && width != store_width)) break;
+                    if (position % element_size != 0 || position + element_size > size || size % element_size != 0) break;
+
+                    width = store_width;
+                    values.resize(size / element_size, "0");
+                    values.at(position / element_size) = value;
+                    stores++;
+                }
+
+                if (stores > 0) {
+                    var_declaration = quad.result + ":\t\t" + (width == "w" ? ".word\t" : ".byte\t");
+                    for (size_t k = 0; k < values.size(); k++)
+                        var_declaration += (k > 0 ? ", " : "") + values.at(k);
+                    var_declaration += "\n";
+                    if (width == "w") offset = (offset + 3) / 4 * 4;
+                    offset += size;
+
+                    quadruplets.erase(quadruplets.begin() + i + 1, quadruplets.begin() + i + 1 + 2 * stores);
+                    runs_once.erase(runs_once.begin() + i + 1, runs_once.begin() + i + 1 + 2 * stores);
+                } else {
+                    if (offset % 4 != 0) var_declaration = "\t\t.align\t2\n";
+                    var_declaration += quad.result + ":\t\t.space\t"+ quad.arg1 + "\n";
+                    offset = (offset + 3) / 4 * 4 + size;
+                }
+                static_regions.insert(quad.result);
+                erase = true;
+            }
+            else {
+                var_declaration = quad.result + ":\t\t.word\t0" + "\n";
+                offset = (offset + 3) / 4 * 4 + 4;
             }
-            else var_declaration = quad.result + ":\t\t.word\t0" + "\n";
         }
 
         variables.insert(quad.result);
         data_section += var_declaration;
+
+        if (erase) {
+            quadruplets.erase(quadruplets.begin() + i);
+            runs_once.erase(runs_once.begin() + i);
+            i--;
+        }
+    }
+
+    // State of heap_alloc: the chunk being carved and the free lists, one per size class and one for larger blocks
+    if (usesHeap(quadruplets)) {
+        data_section += "heap_next:\t\t.word\t0\n";
+        data_section += "heap_left:\t\t.word\t0\n";
+        data_section += "heap_large:\t\t.word\t0\n";
+        data_section += "heap_free:\t\t.space\t132\n";
+    }
+
+    // State of the collector: where the heap and the stack start, the size that triggers the next collection,
+    // the statistics and the table of globals with their maps
+    if (collect) {
+        data_section += "gc_heap_start:\t.word\t0\n";
+        data_section += "gc_stack_top:\t.word\t0\n";
+        data_section += "gc_threshold:\t.word\t65536\n";
+        data_section += "gc_collections:\t.word\t0\n";
+        data_section += "gc_reclaimed:\t.word\t0\n";
+        data_section += "gc_roots:\t\t.word\t";
+        for (auto &[var, map]: roots) data_section += var + ", " + map + ", ";
+        data_section += "0\n";
+        data_section += "gc_msg_start:\t.asciiz\t\"\\ngc: \"\n";
+        data_section += "gc_msg_collections:\t.asciiz\t\" collections, \"\n";
+        data_section += "gc_msg_reclaimed:\t.asciiz\t\" bytes reclaimed, \"\n";
+        data_section += "gc_msg_heap:\t.asciiz\t\" bytes of heap\\n\"\n";
+
+        // Frames have no maps of their own, only objects, static regions and globals are scanned precisely
+        report += "gc: " + std::to_string(pointer_maps.size()) + " pointer maps, " + std::to_string(roots.size()) +
+            " global roots, stack and registers scanned conservatively\n";
     }
 
     return data_section;
 }
 
 Register Mips::spill_or_assign(const std::string &var) {
-    auto var_is_integer = std::regex_match(var, std::regex("[0-9]+"));
+    auto var_is_integer = std::regex_match(var, std::regex("-?[0-9]+"));
     std::array<std::string, 8> *registers = (var.contains("_")) ? &saved: &temporaries;
     std::string reg_type = (var.contains("_")) ? "$s": "$t";
 
@@ -91,443 +622,1519 @@ Register Mips::spill_or_assign(const std::string &var) {
         auto reg_value = &registers->at(i);
         if (variables.count(*reg_value) > 1) {
             auto range = variables.equal_range(registers->at(i));
-            auto reg = reg_type + std::to_string(i);
-            std::string inst = 
-                (var_is_integer) ? "li ": 
-                (var.starts_with("str") || var.starts_with("S")) ? "la ": 
-                (var.starts_with("B")) ? "lb": "lw ";
-            std::string text = inst + reg + ", " + var;
+            auto name = reg_type + std::to_string(i);
+            MachineInstr load =
+                (var_is_integer) ? MachineInstr{LI, {reg(name), imm(var)}}:
+                (var.starts_with("str") || static_regions.contains(var)) ? MachineInstr{LA, {reg(name), label(var)}}:
+                MachineInstr{(var.starts_with("B")) ? LB: LW, {reg(name), getAddress(var)}};
 
             registers->at(i) = var;
-            if (!var_is_integer) variables.insert({var, reg});
+            if (!var_is_integer) variables.insert({var, name});
             for (auto it = range.first; it != range.second; it++) {
-                if (it->second == reg) {
+                if (it->second == name) {
                     variables.erase(it);
                     break;
                 }
             }
 
-            return {reg, text + "\n"};
+            return {name, {load}};
         }
     }
 
-    return {"", ""};
+    return Register{};
 }
 
 Register Mips::getRegister(const std::string &var) {
     if (var.empty() || var.starts_with("l") || var.starts_with("err_")) return Register{};
+    if (var == "true") return getRegister("1");
+    if (var == "false" || var == "null" || var == "0") return Register{"$zero"};
 
-    if (var == "i" || var == "err" || var == "switch") return Register("$t8","");
-    if (var == "catch" || var == "case") return Register("$t9","");
-    if (var.starts_with("i*")) return Register("($t8)","");
-    if (var == "ret") return Register{"$v0", ""};
-    if (var == "p") return Register{"$v1", ""};
+    if (var == "i" || var == "switch") return Register{"$t8"};
+    if (var == "err" || var == "case") return Register{"$t9"};
+    if (var.starts_with("i*")) return Register{"$t8", {}, true};
+    if (var == "ret") return Register{"$v0"};
+    if (var == "p") return Register{"$v1"};
     // Find var in register descriptors
     for (int i = 0; i < temporaries.size(); i++) {
         if (var == temporaries.at(i))
-            return {"$t" + std::to_string(i), ""};
+            return {"$t" + std::to_string(i)};
     }
 
     for (int i = 0; i < saved.size(); i++) {
         if (var == saved.at(i))
-            return {"$s" + std::to_string(i), ""};
+            return {"$s" + std::to_string(i)};
     }
 
     for (int i = 0; i < args.size(); i++) {
         if (var == args.at(i))
-            return {"$a" + std::to_string(i), ""};
+            return {"$a" + std::to_string(i)};
     }
 
     // find empty register in apropiate descriptor
-    auto is_integer = std::regex_match(var, std::regex("[0-9]+"));
+    auto is_integer = std::regex_match(var, std::regex("-?[0-9]+"));
     std::array<std::string, 8> *registers = (var.contains("_")) ? &saved: &temporaries;
     std::string reg_type = (var.contains("_")) ? "$s": "$t";
 
     for (int i = 0; i < registers->size(); i++) {
         if (registers->at(i).empty()) {
-            auto reg = reg_type + std::to_string(i);
-            std::string inst = 
-                (is_integer) ? "li ": 
-                (var.starts_with("str") || var.starts_with("S")) ? "la ": 
-                (var.starts_with("B")) ? "lb ": "lw ";
-            std::string text = inst + reg + ", " + var;
+            auto name = reg_type + std::to_string(i);
+            MachineInstr load =
+                (is_integer) ? MachineInstr{LI, {reg(name), imm(var)}}:
+                (var.starts_with("str") || static_regions.contains(var)) ? MachineInstr{LA, {reg(name), label(var)}}:
+                MachineInstr{(var.starts_with("B")) ? LB: LW, {reg(name), getAddress(var)}};
 
             registers->at(i) = var;
-            if (!is_integer) variables.insert({var, reg});
+            if (!is_integer) variables.insert({var, name});
 
-            return {reg, text + "\n"};
+            return {name, {load}};
         }
     }
 
     return spill_or_assign(var);
 }
 
-std::string Mips::generateTextSection() {
+Register Mips::getOperand(const std::string &var, size_t position, const std::string &scratch) {
+    if (var.empty() || var.starts_with("l") || var.starts_with("err_")) return Register{};
+    if (var == "true") return getOperand("1", position, scratch);
+    if (var == "false" || var == "null" || var == "0") return Register{"$zero"};
+
+    // The handler finds the message of the error in $v0, case is read right after the comparison that leaves it
+    if (var == "err") return Register{"$v0"};
+    if (var == "case") return Register{"$t6"};
+    if (var.starts_with("i*")) {
+        auto address = getOperand("i", position, scratch);
+        return {address.reg, address.code, true};
+    }
+    if (var == "ret") return Register{"$v0"};
+    if (var == "p") return Register{"$v1"};
+
+    if (std::regex_match(var, std::regex("-?[0-9]+"))) return {scratch, {{LI, {reg(scratch), imm(var)}}}};
+    if (var.starts_with("str") || static_regions.contains(var)) return {scratch, {{LA, {reg(scratch), label(var)}}}};
+
+    auto location = allocator->getUse(position, var);
+    if (location && !location->reg.empty()) return {location->reg};
+    if (location && !location->constant.empty()) return getOperand(location->constant, position, scratch);
+
+    // Values without a register are read from the frame or from their label
+    reloads[region]++;
+    if (location && location->slot >= 0) return {scratch, {{LW, {reg(scratch), mem(4 * (location->slot + 1), "$fp")}}}};
+    return {scratch, {{(var.starts_with("B")) ? LB : LW, {reg(scratch), getAddress(var)}}}};
+}
+
+// The code of the returned register is the store that must follow the instruction
+Register Mips::getDestination(const std::string &var, size_t position) {
+    if (var.empty()) return Register{};
+    if (var == "err" || var == "case") return Register{"$t6"};
+    if (var == "ret") return Register{"$v0"};
+    if (var == "p") return Register{"$v1"};
+
+    auto location = allocator->getDef(position, var);
+    auto name = (location && !location->reg.empty()) ? location->reg : "$t6";
+    if (location && location->slot >= 0) {
+        spills[region]++;
+        return {name, {{SW, {reg(name), mem(4 * (location->slot + 1), "$fp")}}}};
+    }
+
+    // Variables are written through so calls and other subroutines see them, promoted ones wait until a call or exit
+    auto current = allocator->getRegion(region);
+    for (auto &promotion: current->promoted)
+        if (promotion.name == var) return {name};
+    if (allocator->isMemory(var)) return {name, {{(var.starts_with("B")) ? SB : SW, {reg(name), getAddress(var)}}}};
+    return {name};
+}
+
+std::vector<MachineInstr> Mips::getPrologue(const std::string &name) {
+    std::vector<MachineInstr> code;
+    auto size = getFrameSize(name);
+    if (size > 0) code.push_back({ADDI, {reg("$sp"), imm(-size)}});
+    if (usesFramePointer(name)) code.push_back({SW, {reg("$fp"), mem("$sp")}});
+    if (!frames[name].leaf) code.push_back({SW, {reg("$ra"), mem(size - 4, "$sp")}});
+    if (usesFramePointer(name)) code.push_back({MOVE, {reg("$fp"), reg("$sp")}});
+    if (name != "main") code.push_back(save_marker);
+
+    auto region = (allocator) ? allocator->getRegion(name) : nullptr;
+    if (!region) return code;
+
+    append(code, getPromotedLoads(name));
+    for (auto &var: region->entry_loads) {
+        auto location = allocator->getUse(region->quads.front(), var);
+        if (!location || location->reg.empty()) continue;
+        code.push_back({(var.starts_with("B")) ? LB : LW, {reg(location->reg), getAddress(var)}});
+        reloads[name]++;
+    }
+    return code;
+}
+
+std::vector<MachineInstr> Mips::getEpilogue(const std::string &name) {
+    auto code = (allocator) ? getWriteBack(name) : std::vector<MachineInstr>{};
+    if (name != "main") code.push_back(restore_marker);
+    auto size = getFrameSize(name);
+    if (size == 0) return code;
+
+    // Pushes are balanced at every exit, so $sp is back at the frame
+    if (!frames[name].leaf) code.push_back({LW, {reg("$ra"), mem(size - 4, "$sp")}});
+    if (usesFramePointer(name)) code.push_back({LW, {reg("$fp"), mem("$sp")}});
+    code.push_back({ADDI, {reg("$sp"), imm(size)}});
+    return code;
+}
+
+std::vector<MachineInstr> Mips::getWriteBack(const std::string &name) {
+    std::vector<MachineInstr> code;
+    auto region = allocator->getRegion(name);
+    if (!region) return code;
+
+    for (auto &promotion: region->promoted) {
+        if (!promotion.written) continue;
+        code.push_back({(promotion.name.starts_with("B")) ? SB : SW, {reg(promotion.reg), getAddress(promotion.name)}});
+    }
+    return code;
+}
+
+std::vector<MachineInstr> Mips::getPromotedLoads(const std::string &name) {
+    std::vector<MachineInstr> code;
+    auto region = allocator->getRegion(name);
+    if (!region) return code;
+
+    for (auto &promotion: region->promoted)
+        code.push_back({(promotion.name.starts_with("B")) ? LB : LW, {reg(promotion.reg), getAddress(promotion.name)}});
+    return code;
+}
+
+std::vector<MachineInstr> Mips::generateTextSection() {
     enum Subroutines {
-        BAD_INDEX = 0,
+        BAD_INDEX = 1,
         TO_STRING = 2,
-        CONCAT_STRING = 4
-    } subroutines_to_add;
+        CONCAT_STRING = 4,
+        ERROR_THROW = 8,
+        EQUAL_STRING = 16,
+        HEAP = 32,
+        HEAP_CALLOC = 64,
+        HEAP_RELEASE = 128,
+        GARBAGE_COLLECT = 256,
+        APPEND_STRING = 512
+    } subroutines_to_add = {};
+    bool collect = garbage_collect && usesHeap(quadruplets);
+
+    removeCallSaves();
+    if (allocation != GREEDY) {
+        allocator = std::make_unique<RegisterAllocator>(quadruplets, static_regions);
+        if (promote_globals) allocator->promoteGlobals();
+        if (allocation == LINEAR) allocator->allocateLinear();
+        if (allocation == COLORING) allocator->allocateColoring();
+    }
 
-    std::stack<std::string> subrutine_sections;
-    std::string text_section = "main:\n";
+    std::stack<std::vector<MachineInstr>> subrutine_sections;
+    std::stack<std::vector<MachineInstr>> finished_sections;
+    std::stack<std::string> regions;
+    // Subroutines nested in the current one, already complete
+    std::vector<MachineInstr> finished;
+    region = "main";
+    std::vector<MachineInstr> text_section = {{.label = "main"}};
+    // The collector scans the stack up to where main starts
+    if (collect) text_section.push_back({SW, {reg("$sp"), label("gc_stack_top")}});
+    append(text_section, getPrologue(region));
     int arg_count = 0;
     int err_labels = 0;
-    for (auto quad: quadruplets) {
-        if (quad.result == "t0" && !(quad.arg1 == "t0" || quad.arg2 == "t0"))
+    // Open try blocks: number, handler and subroutine
+    std::vector<std::tuple<int, std::string, std::string>> tries;
+    int try_count = 0;
+    bool has_handlers = std::any_of(quadruplets.begin(), quadruplets.end(), [](const Quad &quad) {
+        return quad.op.empty() && quad.result == "catch" && quad.arg1 != "0";
+    });
+    bool has_checks = std::any_of(quadruplets.begin(), quadruplets.end(), [](const Quad &quad) {
+        return quad.op == "iferr";
+    });
+    // A call inside a try saves err_handler and leaves its handler there, for the checks of the callee that are
+    // outside every range. Pushed at the first param, below the arguments after $a3
+    bool handler_pushed = false;
+    auto pushHandler = [this, &tries, &has_checks, &handler_pushed]() -> std::vector<MachineInstr> {
+        if (!has_checks || handler_pushed || tries.empty() || std::get<2>(tries.back()) != region) return {};
+        handler_pushed = true;
+        return {{LW, {reg("$v1"), label("err_handler")}}, {ADDI, {reg("$sp"), imm(-4)}}, {SW, {reg("$v1"), mem("$sp")}},
+            {LA, {reg("$v1"), label(std::get<1>(tries.back()))}}, {SW, {reg("$v1"), label("err_handler")}}};
+    };
+    // Shared stubs by their printed code, each check only loads where to resume
+    std::unordered_map<std::string, std::string> shared_stubs;
+    auto closeTry = [this, &tries]() {
+        auto [number, handler, name] = tries.back();
+        tries.pop_back();
+        try_table += "try" + std::to_string(number) + ", try" + std::to_string(number) + "_end, " + handler + ", ";
+        return MachineInstr{.label = "try" + std::to_string(number) + "_end"};
+    };
+    // The comparison before an iferr leaves 0 in err when the check fails
+    bool err_inverted = false;
+    // A subroutine that already returned ends in jr $ra and a blank line
+    auto returned = [](const std::vector<MachineInstr> &code) {
+        if (code.size() < 2) return false;
+        auto &jump = code.at(code.size() - 2);
+        auto &blank = code.back();
+        return jump.opcode == JR && jump.operands.size() == 1 && jump.operands.front().value == "$ra" &&
+            jump.comment.empty() && blank.opcode == NONE && blank.comment.empty() && blank.label.empty();
+    };
+    // A value read through i is in memory at the address in the register
+    auto operand = [](const Register &r) { return (r.indirect) ? mem(r.reg) : reg(r.reg); };
+
+    // The callee may have changed any variable kept in a register
+    auto reload = [this](size_t position) {
+        auto code = getPromotedLoads(region);
+        for (auto &[var, name]: allocator->getReloads(position)) {
+            code.push_back({(var.starts_with("B")) ? LB : LW, {reg(name), getAddress(var)}});
+            reloads[region]++;
+        }
+        return code;
+    };
+
+    for (size_t i = 0; i < quadruplets.size(); i++) {
+        auto quad = quadruplets.at(i);
+        // Statements start by assigning t0 without reading other temporaries
+        auto temporary = std::regex("t[0-9]+");
+        if (!allocator && quad.result == "t0" && !std::regex_match(quad.arg1, temporary) && !std::regex_match(quad.arg2, temporary))
             for (auto &reg: temporaries) if (reg.starts_with("t")) reg.clear(); 
 
         if (quad.op == "arg") {
-            args.at(arg_count++) = quad.arg1;
+            // Arguments after $a3 are read from the caller's pushes, the last one is on top
+            auto &frame = frames[region];
+            auto index = arg_count++;
+            auto arg_reg = "$a" + std::to_string(index);
+            auto stack_arg = mem(getFrameSize(region) + 4 * (frame.stack_args + 3 - index), "$fp");
+            if (allocator) {
+                auto rx = getDestination(quad.arg1, i);
+                if (index >= 4) text_section.push_back({LW, {reg(rx.reg), stack_arg}});
+                else if (rx.reg != arg_reg) text_section.push_back({MOVE, {reg(rx.reg), reg(arg_reg)}});
+                else moves_removed[region]++;
+                append(text_section, rx.code);
+                continue;
+            }
+            if (index >= 4) text_section.push_back({LW, {reg(getRegister(quad.arg1).reg), stack_arg}});
+            else args.at(index) = quad.arg1;
             continue;
         }
         if (quad.op == "param") {
-            auto ry = getRegister(quad.arg1);
-            auto arg_reg = "$a" + std::to_string(arg_count++);
-            text_section += ry.text + "move " + arg_reg + ", " + ry.reg + "\n";
+            if (arg_count == 0) append(text_section, pushHandler());
+            auto index = arg_count++;
+            auto arg_reg = (index < 4) ? "$a" + std::to_string(index) : (allocator) ? "$t6" : "$v1";
+            auto ry = (allocator) ? getOperand(quad.arg1, i, arg_reg) : getRegister(quad.arg1);
+            auto inst = (ry.indirect) ? (quad.arg1 == "i*b") ? LB : LW : MOVE;
+            append(text_section, ry.code);
+            if (index >= 4) {
+                if (ry.indirect) text_section.push_back({inst, {reg(arg_reg), operand(ry)}});
+                else arg_reg = ry.reg;
+                text_section.push_back({ADDI, {reg("$sp"), imm(-4)}});
+                text_section.push_back({SW, {reg(arg_reg), mem("$sp")}});
+            }
+            else if (ry.indirect || ry.reg != arg_reg) text_section.push_back({inst, {reg(arg_reg), operand(ry)}});
             continue;
         }
-        if (arg_count > 0) arg_count = 0;
+        int stack_args = std::max(arg_count - 4, 0);
+        arg_count = 0;
 
         if (quad.op == "tag") {
-            text_section += quad.arg1 + ":\n";
+            text_section.push_back({.label = quad.arg1});
             continue;
         }
 
         if (quad.op == "begin") {
             for (auto &temp: temporaries) temp.clear();
             subrutine_sections.push(text_section);
-            text_section.clear();
-            text_section += quad.arg1 + ":\n";
+            finished_sections.push(finished);
+            finished.clear();
+            regions.push(region);
+            region = quad.arg1;
+            text_section = {{.label = quad.arg1}};
+            append(text_section, getPrologue(region));
             continue;
         }
 
         if (quad.op == "end") {
             for (auto &temp: temporaries) temp.clear();
-            if (!text_section.ends_with("jr $ra\n\n")) text_section += "jr $ra\n\n";
-            text_section += subrutine_sections.top();
+            if (!returned(text_section)) {
+                append(text_section, getEpilogue(region));
+                text_section.push_back({JR, {reg("$ra")}});
+                text_section.push_back({});
+            }
+            // The optimizer keeps every catch quad, so a try still open here would silently cover the rest
+            if (!tries.empty() && std::get<2>(tries.back()) == region) throw std::runtime_error("UNCLOSED_TRY");
+            append(finished, saveRegisters(region, text_section));
+            text_section = subrutine_sections.top();
+            append(finished, finished_sections.top());
             subrutine_sections.pop();
+            finished_sections.pop();
+            region = regions.top();
+            regions.pop();
             continue;
         }
         if (quad.op == "call") {
-            text_section += "addi $sp, -4\n";
-            text_section += "sw $ra, ($sp)\n";
-            text_section += "jal " + quad.arg1 + "\n";
-            text_section += "lw $ra, ($sp)\n";
-            text_section += "addi $sp, 4\n";
+            if (allocator) append(text_section, getWriteBack(region));
+            append(text_section, pushHandler());
+            text_section.push_back({JAL, {label(quad.arg1)}});
+            if (stack_args > 0) text_section.push_back({ADDI, {reg("$sp"), imm(4 * stack_args)}});
+            if (handler_pushed) {
+                text_section.push_back({LW, {reg("$v1"), mem("$sp")}});
+                text_section.push_back({SW, {reg("$v1"), label("err_handler")}});
+                text_section.push_back({ADDI, {reg("$sp"), imm(4)}});
+                handler_pushed = false;
+            }
+            if (allocator) append(text_section, reload(i));
             continue;
         }
         if (quad.op == "goto") {
-            text_section += "b " + quad.arg1 + "\n";
+            text_section.push_back({B, {label(quad.arg1)}});
+            continue;
+        }
+        // The range of a try block goes to err_table, entering and leaving it runs nothing
+        if (quad.op.empty() && quad.result == "catch") {
+            if (quad.arg1 != "0") {
+                tries.push_back({try_count, quad.arg1, region});
+                text_section.push_back({.label = "try" + std::to_string(try_count++)});
+            }
+            else if (!tries.empty() && std::get<2>(tries.back()) == region) text_section.push_back(closeTry());
             continue;
         }
         if (quad.op == "print") {
-            text_section += "addi $sp, -4\n";
-            text_section += "sw $a0, ($sp)\n";
-            text_section += "move $a0, $v1\n";
-            text_section += "li $v0, 4\n";
-            text_section += "syscall\n";
-            text_section += "lw $a0, ($sp)\n";
-            text_section += "addi $sp, 4\n";
-            text_section += "move $v0, $zero\n";
-            text_section += "move $v1, $zero\n";
+            if (allocator) append(text_section, getWriteBack(region));
+            text_section.push_back({ADDI, {reg("$sp"), imm(-4)}});
+            text_section.push_back({SW, {reg("$a0"), mem("$sp")}});
+            text_section.push_back({MOVE, {reg("$a0"), reg("$v1")}});
+            text_section.push_back({LI, {reg("$v0"), imm(4)}});
+            text_section.push_back({SYSCALL});
+            text_section.push_back({LW, {reg("$a0"), mem("$sp")}});
+            text_section.push_back({ADDI, {reg("$sp"), imm(4)}});
+            text_section.push_back({MOVE, {reg("$v0"), reg("$zero")}});
+            text_section.push_back({MOVE, {reg("$v1"), reg("$zero")}});
             continue;
         }
 
-        auto ry = getRegister(quad.arg1);
-        auto rz = getRegister(quad.arg2);
-        auto rx = getRegister(quad.result);
+        // The pointer map of an allocation is not an operand
+        std::string pointer_map;
+        if (quad.op == "alloc") std::swap(pointer_map, quad.arg2);
+
         auto op = quad.op;
+        auto immediate = takeImmediate(quad);
+        Register ry, rz, rx;
+        if (allocator) {
+            // Rematerialized constants are loaded where they are used instead
+            auto location = allocator->getDef(i, quad.result);
+            if (op.empty() && location && !location->constant.empty()) continue;
 
-        text_section += ry.text + rz.text;
-        if (op.empty()) {
-            if (rx.reg.starts_with("(")) {
-                std::string inst = (quad.result.starts_with("*b")) ? "sb ": "sw ";
-                text_section += inst + ry.reg + ", " + rx.reg + "\n";
-            } else if (ry.reg.starts_with("(")) {
-                std::string inst = (quad.arg1.starts_with("*b")) ? "lb ": "lw ";
-                text_section += inst + rx.reg + ", " + ry.reg + "\n";
+            // A store through i reads the address like an operand, a spilled one is loaded along with the value
+            auto store = quad.result.starts_with("i*");
+            rx = (store) ? getOperand(quad.result, i, "$t7") : (op == "pop") ? getDestination(quad.arg1, i) :
+                getDestination(quad.result, i);
+            auto scratch = (op.empty() && !rx.indirect && rx.reg.starts_with("$")) ? rx.reg : (op == "return") ? "$v0" :
+                (op == "movn") ? "$at" : "$t6";
+            if (op != "pop") ry = getOperand(quad.arg1, i, scratch);
+            rz = getOperand(quad.arg2, i, "$t7");
+            // A spilled movn result is loaded first because it keeps its value when the condition is zero
+            if (op == "movn") {
+                auto kept = getOperand(quad.result, i, rx.reg).code;
+                ry.code.insert(ry.code.begin(), kept.begin(), kept.end());
             }
+            if (store) std::swap(rx.code, rz.code);
+        } else {
+            // The thrower leaves the message of the error in $v0
+            ry = (quad.arg1 == "err") ? Register{"$v0"} : getRegister(quad.arg1);
+            rz = getRegister(quad.arg2);
+            rx = getRegister(quad.result);
+        }
+
+        append(text_section, ry.code);
+        append(text_section, rz.code);
+        if (op.empty()) {
+            if (rx.indirect) text_section.push_back({(quad.result.starts_with("*b")) ? SB : SW, {operand(ry), operand(rx)}});
+            else if (ry.indirect) text_section.push_back({(quad.arg1.starts_with("*b")) ? LB : LW, {operand(rx), operand(ry)}});
             else {
-                text_section += "move " + rx.reg + ", " + ry.reg + "\n";
-                if (rx.reg.starts_with("$s")) {
-                    std::string inst = (quad.result.starts_with("B")) ? "sb ": "sw ";
-                    text_section += inst + rx.reg + ", " + quad.result + "\n";
-                }
+                if (!allocator || rx.reg != ry.reg) text_section.push_back({MOVE, {operand(rx), operand(ry)}});
+                else if (ry.code.empty()) moves_removed[region]++;
+                if (!allocator && rx.reg.starts_with("$s"))
+                    text_section.push_back({(quad.result.starts_with("B")) ? SB : SW, {reg(rx.reg), getAddress(quad.result)}});
             }
         }
         if (op == "alloc") {
-            text_section += "addi $sp, -4\n";
-            text_section += "sw $a0, ($sp)\n";
-            text_section += "move $a0, " + ry.reg + "\n";
-            text_section += "li $v0, 9\n";
-            text_section += "syscall\n";
-            text_section += "lw $a0, ($sp)\n";
-            text_section += "addi $sp, 4\n";
-            text_section += "move " + rx.reg + ", $v0\n";
+            text_section.push_back({ADDI, {reg("$sp"), imm(-4)}});
+            text_section.push_back({SW, {reg("$a0"), mem("$sp")}});
+            text_section.push_back({MOVE, {reg("$a0"), operand(ry)}});
+            if (collect) {
+                text_section.push_back((pointer_map.empty()) ? MachineInstr{MOVE, {reg("$v1"), reg("$zero")}} :
+                    MachineInstr{LA, {reg("$v1"), label(pointer_maps.at(pointer_map))}});
+                text_section.push_back({JAL, {label("gc_object")}});
+            }
+            else text_section.push_back({JAL, {label("heap_calloc")}});
+            text_section.push_back({LW, {reg("$a0"), mem("$sp")}});
+            text_section.push_back({ADDI, {reg("$sp"), imm(4)}});
+            text_section.push_back({MOVE, {operand(rx), reg("$v0")}});
+            subroutines_to_add = (Subroutines) (subroutines_to_add | HEAP | HEAP_CALLOC);
+        }
+        if (op == "free") {
+            text_section.push_back({ADDI, {reg("$sp"), imm(-4)}});
+            text_section.push_back({SW, {reg("$a0"), mem("$sp")}});
+            text_section.push_back({ADDI, {reg("$a0"), operand(ry), imm(-4)}});
+            text_section.push_back({JAL, {label("heap_release")}});
+            text_section.push_back({LW, {reg("$a0"), mem("$sp")}});
+            text_section.push_back({ADDI, {reg("$sp"), imm(4)}});
+            subroutines_to_add = (Subroutines) (subroutines_to_add | HEAP_RELEASE);
         }
         if (op == "return") {
-            text_section += "move $v0, " + ry.reg + "\n";
-            text_section += "jr $ra\n\n";
+            auto inst = (ry.indirect) ? (quad.arg1 == "i*b") ? LB : LW : MOVE;
+            if (!allocator || ry.indirect || ry.reg != "$v0") text_section.push_back({inst, {reg("$v0"), operand(ry)}});
+            append(text_section, getEpilogue(region));
+            text_section.push_back({JR, {reg("$ra")}});
+            text_section.push_back({});
         }
         if (op == "if") {
-            text_section += "bne $zero, " + ry.reg + ", " + quad.arg2 +"\n";
+            text_section.push_back({BNE, {reg("$zero"), operand(ry), label(quad.arg2)}});
         }
         if (op == "ifnot") {
-            text_section += "beq $zero, " + ry.reg + ", " + quad.arg2 +"\n";
+            text_section.push_back({BEQ, {reg("$zero"), operand(ry), label(quad.arg2)}});
         }
         if (op == "iferr") {
-            text_section += "beq $zero, $t8, no_err" + std::to_string(err_labels) + "\n";
-            text_section += "beq $zero, $t9, " + quad.arg1 + "\n";
-            if (quad.arg1 == "err_bad_index") {
-                text_section += "la $t8, err_bad_index_msg\n";
+            // The check is a single branch to code out of line. Without catch blocks the default handler ends the
+            // program, otherwise the check passes the address after it to a stub that calls the thrower
+            auto branch = (err_inverted) ? BEQ : BNE;
+            auto flag = (allocator) ? "$t6" : "$t9";
+            err_inverted = false;
+            if (!has_handlers) text_section.push_back({branch, {reg("$zero"), reg(flag), label(quad.arg1)}});
+            else {
+                auto site = std::to_string(err_labels++);
+                text_section.push_back({branch, {reg("$zero"), reg(flag), label("err_throw" + site)}});
+                text_section.push_back({.label = "err_resume" + site});
+                // Promoted variables are written back for the handler and the variables in registers are loaded again
+                std::vector<MachineInstr> body;
+                if (allocator) body = getWriteBack(region);
+                // Every $t register may hold a value, so the check saves $ra and passes the address to resume in it.
+                // The thrower reads it from the stack, and it comes back in $at once the reloads no longer need $at
+                body.push_back({ADDI, {reg("$sp"), reg("$sp"), imm(-4)}});
+                body.push_back({SW, {reg("$ra"), mem(0, "$sp")}});
+                body.push_back({JAL, {label(quad.arg1 + "_throw")}});
+                if (allocator) append(body, reload(i));
+                body.push_back({LW, {reg("$at"), mem(0, "$sp")}});
+                body.push_back({LW, {reg("$ra"), mem(4, "$sp")}});
+                body.push_back({ADDI, {reg("$sp"), reg("$sp"), imm(8)}});
+                body.push_back({JR, {reg("$at")}});
+                std::string key;
+                for (auto &instr: body) key += printInstr(instr) + "\n";
+                if (!shared_stubs.contains(key)) {
+                    auto stub = quad.arg1 + "_stub" + std::to_string(shared_stubs.size());
+                    shared_stubs[key] = stub;
+                    error_stubs.push_back({.label = stub});
+                    append(error_stubs, body);
+                    error_stubs.push_back({});
+                    error_labels.insert(stub);
+                }
+                error_stubs.push_back({.label = "err_throw" + site});
+                error_stubs.push_back({ADDI, {reg("$sp"), reg("$sp"), imm(-4)}});
+                error_stubs.push_back({SW, {reg("$ra"), mem(0, "$sp")}});
+                error_stubs.push_back({LA, {reg("$ra"), label("err_resume" + site)}});
+                error_stubs.push_back({B, {label(shared_stubs.at(key))}});
+                error_stubs.push_back({});
+                error_labels.insert("err_throw" + site);
+                subroutines_to_add = (Subroutines) (subroutines_to_add | ERROR_THROW);
             }
-            text_section += "addi $sp, -4\n";
-            text_section += "sw $ra, ($sp)\n";
-            text_section += "la $ra, clean_err" + std::to_string(err_labels) + "\n";
-            text_section += "jr $t9\n";
-            text_section += "clean_err" + std::to_string(err_labels) + ":\n";
-            text_section += "la $ra, ($sp)\n";
-            text_section += "addi $sp, 4\n";
-            text_section += "no_err" + std::to_string(err_labels) + ":\n";
-            text_section += "move $t8, $zero\n";
-            text_section += "move $t9, $zero\n";
-            err_labels++;
             subroutines_to_add = (Subroutines) (subroutines_to_add | BAD_INDEX);
         }
         if (op == "to_str") {
-            text_section += "addi $sp, -4\n";
-            text_section += "sw $a0, ($sp)\n";
-            text_section += "addi $sp, -4\n";
-            text_section += "sw $a1, ($sp)\n";
-
-            if (ry.reg.starts_with("(")) 
-                text_section += "lw $a0, " + ry.reg + "\n";
-            else
-                text_section += "move $a0, " + ry.reg + "\n";
-
-            if (rz.reg.starts_with("(")) 
-                text_section += "lw $a1, " + rz.reg + "\n";
-            else
-                text_section += "move $a1, " + rz.reg + "\n";
-
-            text_section += "addi $sp, -4\n";
-            text_section += "sw $ra, ($sp)\n";
-            text_section += "jal to_string\n";
-            text_section += "lw $ra, ($sp)\n";
-            text_section += "addi $sp, 4\n";
-            text_section += "lw $a1, ($sp)\n";
-            text_section += "addi $sp, 4\n";
-            text_section += "lw $a0, ($sp)\n";
-            text_section += "addi $sp, 4\n";
-            text_section += "move " + rx.reg + ", $v0\n"; 
-            subroutines_to_add = (Subroutines) (subroutines_to_add | TO_STRING);
+            text_section.push_back({ADDI, {reg("$sp"), imm(-4)}});
+            text_section.push_back({SW, {reg("$a0"), mem("$sp")}});
+            text_section.push_back({ADDI, {reg("$sp"), imm(-4)}});
+            text_section.push_back({SW, {reg("$a1"), mem("$sp")}});
+            text_section.push_back({(ry.indirect) ? LW : MOVE, {reg("$a0"), operand(ry)}});
+            text_section.push_back({(rz.indirect) ? LW : MOVE, {reg("$a1"), operand(rz)}});
+            text_section.push_back({JAL, {label("to_string")}});
+            text_section.push_back({LW, {reg("$a1"), mem("$sp")}});
+            text_section.push_back({ADDI, {reg("$sp"), imm(4)}});
+            text_section.push_back({LW, {reg("$a0"), mem("$sp")}});
+            text_section.push_back({ADDI, {reg("$sp"), imm(4)}});
+            text_section.push_back({MOVE, {operand(rx), reg("$v0")}});
+            subroutines_to_add = (Subroutines) (subroutines_to_add | TO_STRING | HEAP);
         }
         if (op == "push") {
-            text_section += "addi $sp, -4\n";
-            text_section += "sw " + ry.reg + ", ($sp)\n";
+            text_section.push_back({ADDI, {reg("$sp"), imm(-4)}});
+            text_section.push_back({SW, {operand(ry), mem("$sp")}});
         }
         if (op == "pop") {
-            text_section += "lw " + ry.reg + ", ($sp)\n";
-            text_section += "addi $sp, 4\n";
-        }
-        if (op == "concat") {
-            text_section += "addi $sp, -4\n";
-            text_section += "sw $a0, ($sp)\n";
-            text_section += "addi $sp, -4\n";
-            text_section += "sw $a1, ($sp)\n";
-
-            if (ry.reg.starts_with("(")) 
-                text_section += "lw $a0, " + ry.reg + "\n";
-            else
-                text_section += "move $a0, " + ry.reg + "\n";
-
-            if (rz.reg.starts_with("(")) {
-                text_section += "lw $a1, " + rz.reg + "\n";
-            } else if (rz.reg == "$a0") {
-                text_section += "lw $a1, 4($sp)\n";
-            } else {
-                text_section += "move $a1, " + rz.reg + "\n";
-            }
+            text_section.push_back({LW, {operand((allocator) ? rx : ry), mem("$sp")}});
+            text_section.push_back({ADDI, {reg("$sp"), imm(4)}});
+        }
+        if (op == "concat" || op == "append" || op == "streql" || op == "strneq") {
+            text_section.push_back({ADDI, {reg("$sp"), imm(-4)}});
+            text_section.push_back({SW, {reg("$a0"), mem("$sp")}});
+            text_section.push_back({ADDI, {reg("$sp"), imm(-4)}});
+            text_section.push_back({SW, {reg("$a1"), mem("$sp")}});
+            text_section.push_back({(ry.indirect) ? LW : MOVE, {reg("$a0"), operand(ry)}});
+            if (rz.indirect) text_section.push_back({LW, {reg("$a1"), operand(rz)}});
+            else if (rz.reg == "$a0") text_section.push_back({LW, {reg("$a1"), mem(4, "$sp")}});
+            else text_section.push_back({MOVE, {reg("$a1"), operand(rz)}});
 
-            text_section += "addi $sp, -4\n";
-            text_section += "sw $ra, ($sp)\n";
-            text_section += "jal concat_strings\n";
-            text_section += "lw $ra, ($sp)\n";
-            text_section += "addi $sp, 4\n";
-            text_section += "lw $a1, ($sp)\n";
-            text_section += "addi $sp, 4\n";
-            text_section += "lw $a0, ($sp)\n";
-            text_section += "addi $sp, 4\n";
-            text_section += "move " + rx.reg + ", $v0\n";
-            subroutines_to_add = (Subroutines) (subroutines_to_add | CONCAT_STRING);
-        }
-        if (op == "+") text_section += "add " + rx.reg + ", " + ry.reg + ", " + rz.reg + "\n";
-        if (op == "-") text_section += "sub " + rx.reg + ", " + ry.reg + ", " + rz.reg + "\n";
-        if (op == "*") {
-            text_section += "mult " + ry.reg + ", " + rz.reg + "\n";
-            text_section += "mflo " + rx.reg + "\n";
-        }
-        if (op == "/") {
-            text_section += "div " + ry.reg + ", " + rz.reg + "\n";
-            text_section += "mflo " + rx.reg + "\n";
-        }
-        if (op == "<") text_section += "slt " + rx.reg + ", " + ry.reg + ", " + rz.reg + "\n";
-        if (op == ">") text_section += "sgt " + rx.reg + ", " + ry.reg + ", " + rz.reg + "\n";
-        if (op == "<=") text_section += "sle " + rx.reg + ", " + ry.reg + ", " + rz.reg + "\n";
-        if (op == ">=") text_section += "sge " + rx.reg + ", " + ry.reg + ", " + rz.reg + "\n";
-        if (op == "!=") text_section += "seq " + rx.reg + ", " + ry.reg + ", " + rz.reg + "\n";
-        if (op == "==") text_section += "sne " + rx.reg + ", " + ry.reg + ", " + rz.reg + "\n";
-        if (op == "&&") text_section += "and " + rx.reg + ", " + ry.reg + ", " + rz.reg + "\n";
-        if (op == "||") text_section += "or " + rx.reg + ", " + ry.reg + ", " + rz.reg + "\n";
-        if (op == "!") text_section += "not " + rx.reg + ", " + ry.reg + "\n";
+            auto routine = (op == "concat") ? "concat_strings" : (op == "append") ? "append_string" : "equal_strings";
+            text_section.push_back({JAL, {label(routine)}});
+            text_section.push_back({LW, {reg("$a1"), mem("$sp")}});
+            text_section.push_back({ADDI, {reg("$sp"), imm(4)}});
+            text_section.push_back({LW, {reg("$a0"), mem("$sp")}});
+            text_section.push_back({ADDI, {reg("$sp"), imm(4)}});
+            text_section.push_back((op == "strneq") ? MachineInstr{XORI, {operand(rx), reg("$v0"), imm(1)}} :
+                MachineInstr{MOVE, {operand(rx), reg("$v0")}});
+            subroutines_to_add = (Subroutines) (subroutines_to_add | ((op == "concat") ? CONCAT_STRING | HEAP :
+                (op == "append") ? APPEND_STRING | HEAP | HEAP_RELEASE : EQUAL_STRING));
+        }
+        if (immediate) {
+            auto value = imm(*immediate);
+            auto next = imm(*immediate + 1);
+            auto x = operand(rx), y = operand(ry);
+            if (op == "+") text_section.push_back({ADDI, {x, y, value}});
+            if (op == "-") text_section.push_back({ADDI, {x, y, imm(-*immediate)}});
+            if (op == "*") append(text_section, multiplyByConstant(rx.reg, ry.reg, *immediate));
+            if (op == "/" || op == "%") append(text_section, divideByConstant(rx.reg, ry.reg, *immediate, op == "%"));
+            if (op == "<" || op == ">=") text_section.push_back({SLTI, {x, y, value}});
+            if (op == "<=" || op == ">") text_section.push_back({SLTI, {x, y, next}});
+            err_inverted = op == ">=" && quad.result == "err" && i + 1 < quadruplets.size() &&
+                quadruplets.at(i + 1).op == "iferr";
+            if ((op == ">=" && !err_inverted) || op == ">") text_section.push_back({XORI, {x, x, imm(1)}});
+            if ((op == "==" || op == "!=") && *immediate != 0) text_section.push_back({XORI, {x, y, value}});
+            auto difference = (*immediate != 0) ? x : y;
+            if (op == "==") text_section.push_back({SLTIU, {x, difference, imm(1)}});
+            if (op == "!=") text_section.push_back({SLTU, {x, reg("$zero"), difference}});
+            if (op == "&&") text_section.push_back({ANDI, {x, y, value}});
+            if (op == "||") text_section.push_back({ORI, {x, y, value}});
+            op.clear();
+        }
+        // Operations with both operands in registers
+        static const std::unordered_map<std::string, Opcode> operations = {
+            {"+", ADD}, {"-", SUB}, {"*", MUL}, {"<", SLT}, {">", SGT}, {"<=", SLE}, {">=", SGE}, {"!=", SNE},
+            {"==", SEQ}, {"&&", AND}, {"||", OR}, {"movn", MOVN}
+        };
+        if (operations.contains(op)) text_section.push_back({operations.at(op), {operand(rx), operand(ry), operand(rz)}});
+        if (op == "/" || op == "%") {
+            text_section.push_back({DIV, {operand(ry), operand(rz)}});
+            text_section.push_back({(op == "/") ? MFLO : MFHI, {operand(rx)}});
+        }
+        if (op == "!") text_section.push_back({XORI, {operand(rx), operand(ry), imm(1)}});
+
+        if (allocator) {
+            append(text_section, rx.code);
+            continue;
+        }
 
         // Clear registers with inmediate values
-        for (auto &reg: temporaries) if (std::regex_match(reg, std::regex("[0-9]+"))) reg.clear();
+        for (auto &reg: temporaries) if (std::regex_match(reg, std::regex("-?[0-9]+"))) reg.clear();
+    }
+    if (collect) {
+        text_section.push_back({JAL, {label("gc_stats")}});
+        subroutines_to_add = (Subroutines) (subroutines_to_add | GARBAGE_COLLECT);
+    }
+    append(finished, text_section);
+    append(finished, getEpilogue("main"));
+    text_section = std::move(finished);
+    if (!tries.empty()) throw std::runtime_error("UNCLOSED_TRY");
+    if (allocator) {
+        for (auto &region: allocator->getRegions()) {
+            if (region.quads.empty()) continue;
+            report += "regalloc: " + region.name + ": " + std::to_string(region.intervals.size()) + " intervals, " +
+                std::to_string(spills[region.name]) + " spills, " + std::to_string(reloads[region.name]) + " reloads, " +
+                std::to_string(moves_removed[region.name]) + " moves removed\n";
+        }
+    }
+    // The runtime routines are written by hand, they are parsed once and go before the generated code
+    std::string runtime;
+    if (subroutines_to_add & ERROR_THROW) {
+        runtime = R"(err_bad_index_throw:
+    # 0($sp): direccion despues del chequeo que fallo, la deja ahi el stub
+    # Guardar los registros que el manejador puede modificar y el manejador de la llamada actual
+    addi $sp, $sp, -72
+    sw $t0, 0($sp)
+    sw $t1, 4($sp)
+    sw $t2, 8($sp)
+    sw $t3, 12($sp)
+    sw $t4, 16($sp)
+    sw $t5, 20($sp)
+    sw $t6, 24($sp)
+    sw $t7, 28($sp)
+    sw $a0, 32($sp)
+    sw $a1, 36($sp)
+    sw $a2, 40($sp)
+    sw $a3, 44($sp)
+    sw $v0, 48($sp)
+    sw $v1, 52($sp)
+    sw $ra, 56($sp)
+    sw $t8, 60($sp)
+    lw $t0, err_handler
+    sw $t0, 64($sp)
+    sw $t9, 68($sp)
+    lw $t9, 72($sp)
+
+    # Buscar el primer rango con inicio < $t9 <= fin, los internos se cierran antes y van primero en la tabla
+    la $t0, err_table
+    move $t1, $zero
+buscar_rango:
+    lw $t2, 0($t0)         # inicio, 0 al final de la tabla
+    beq $t2, $zero, fin_busqueda
+    sltu $t3, $t2, $t9
+    beq $t3, $zero, siguiente_rango
+    lw $t2, 4($t0)         # fin
+    sltu $t3, $t2, $t9
+    bne $t3, $zero, siguiente_rango
+    lw $t1, 8($t0)         # manejador
+    j fin_busqueda
+siguiente_rango:
+    addi $t0, $t0, 12
+    j buscar_rango
+
+fin_busqueda:
+    # Fuera de todo rango el chequeo está en una función llamada dentro de un try, y se usa el manejador que
+    # dejó la llamada. Mientras corre, sus propios errores ya no vuelven a él
+    bne $t1, $zero, llamar_manejador
+    lw $t1, 64($sp)
+    sw $zero, err_handler
+    # Sin manejador se usa el de por defecto, que termina el programa
+    beq $t1, $zero, err_bad_index
+llamar_manejador:
+    la $v0, err_bad_index_msg
+    jalr $t1
+
+    lw $t0, 64($sp)
+    sw $t0, err_handler
+    lw $t0, 0($sp)
+    lw $t1, 4($sp)
+    lw $t2, 8($sp)
+    lw $t3, 12($sp)
+    lw $t4, 16($sp)
+    lw $t5, 20($sp)
+    lw $t6, 24($sp)
+    lw $t7, 28($sp)
+    lw $a0, 32($sp)
+    lw $a1, 36($sp)
+    lw $a2, 40($sp)
+    lw $a3, 44($sp)
+    lw $v0, 48($sp)
+    lw $v1, 52($sp)
+    lw $ra, 56($sp)
+    lw $t8, 60($sp)
+    lw $t9, 68($sp)
+    addi $sp, $sp, 72
+    jr $ra
+
+)" + runtime;
     }
     if (subroutines_to_add & BAD_INDEX) {
-        text_section = R"(err_bad_index:
+        runtime = R"(err_bad_index:
         li $v0, 4
         la $a0, err_bad_index_msg
         syscall
         li $v0, 10
         syscall
-        )" + text_section;
+)" + runtime;
     }
-    if (subroutines_to_add & CONCAT_STRING) {
-        text_section = R"(concat_strings:
-# Calcular longitud de cadena1
-    move $t0, $a0
-    li $t3, 0
-len1_loop:
-    lb $t1, 0($t0)
-    beq $t1, $zero, len1_done
+    if (subroutines_to_add & EQUAL_STRING) {
+        runtime = R"(equal_strings:
+# Mismo puntero: iguales sin leerlas
+    li $v0, 1
+    beq $a0, $a1, equal_done
+    li $v0, 0
+    beq $a0, $zero, equal_done
+    beq $a1, $zero, equal_done
+
+    # Con longitudes distintas no hace falta comparar los caracteres
+    lw $t0, -4($a0)
+    lw $t1, -4($a1)
+    bne $t0, $t1, equal_done
+
+    # Las dos cadenas empiezan alineadas, se comparan las palabras completas y después los 0 a 3 bytes restantes
+    move $t2, $a0
+    move $t3, $a1
+    srl $t4, $t0, 2
+    andi $t0, $t0, 3
+equal_palabras:
+    beq $t4, $zero, equal_bytes
+    lw $t5, 0($t2)
+    lw $t6, 0($t3)
+    bne $t5, $t6, equal_done
+    addi $t2, $t2, 4
+    addi $t3, $t3, 4
+    addi $t4, $t4, -1
+    j equal_palabras
+equal_bytes:
+    beq $t0, $zero, equal_si
+    lbu $t5, 0($t2)
+    lbu $t6, 0($t3)
+    bne $t5, $t6, equal_done
+    addi $t2, $t2, 1
     addi $t3, $t3, 1
-    addi $t0, $t0, 1
-    j len1_loop
-len1_done:
-
-    # Calcular longitud de cadena2
-    move $t0, $a1
-    li $t4, 0
-len2_loop:
-    lb $t1, 0($t0)
-    beq $t1, $zero, len2_done
-    addi $t4, $t4, 1
-    addi $t0, $t0, 1
-    j len2_loop
-len2_done:
+    addi $t0, $t0, -1
+    j equal_bytes
+equal_si:
+    li $v0, 1
+equal_done:
+    jr $ra
 
-    # Calcular tamaño total = len1 + len2 + 1 (para '\0')
-    add $t5, $t3, $t4
-    addi $t5, $t5, 1
+)" + runtime;
+    }
+    if (subroutines_to_add & APPEND_STRING) {
+        runtime = R"(append_string:
+# $a0: cadena de una variable que nadie más ve, $a1: la que se agrega. Si $a0 está en un buffer de append_string con
+# espacio, $a1 se copia al final; si no, las dos pasan a un buffer nuevo con el doble de la longitud. Como
+# concat_strings, solo usa $t0 a $t6
+    lw $t3, -4($a0)        # longitud actual
+    lw $t4, -4($a1)        # longitud que se agrega
+    addu $t5, $t3, $t4
+    move $t0, $a0
+    move $t6, $a0
+    la $t1, heap_free
+    sltu $t1, $t1, $a0
+    beq $t1, $zero, append_crecer   # literal en .data
+    lw $t1, -8($a0)
+    andi $t2, $t1, 4
+    beq $t2, $zero, append_crecer   # cadena de concat o to_str, otra variable puede tenerla
+    li $t2, -8
+    and $t1, $t1, $t2
+    addi $t1, $t1, -9      # caracteres que caben sin el encabezado, la longitud ni el '\0'
+    slt $t1, $t1, $t5
+    beq $t1, $zero, append_copiar
+
+append_crecer:
+    sll $a0, $t5, 1
+    addi $a0, $a0, 5
+    addi $sp, $sp, -4
+    sw $ra, 0($sp)
+    jal heap_alloc         # respeta los registros $t
+    lw $ra, 0($sp)
+    addi $sp, $sp, 4
+    lw $t1, -4($v0)
+    ori $t1, $t1, 4        # buffer de append_string
+    sw $t1, -4($v0)
+    addi $t6, $v0, 4
+    move $t1, $t0
+    move $t2, $t6
+    addu $a0, $t0, $t3
+append_anterior:
+    beq $t1, $a0, append_copiar
+    lbu $v0, 0($t1)
+    sb $v0, 0($t2)
+    addi $t1, $t1, 1
+    addi $t2, $t2, 1
+    j append_anterior
+
+append_copiar:
+    # $a1 va después de los caracteres actuales. El '\0' se escribe aparte porque $a1 puede ser la misma cadena.
+    # La cadena actual ya está en $t0, así que $a0 y $v0 quedan libres para copiar
+    addu $t2, $t6, $t3
+    move $t1, $a1
+    addu $a0, $a1, $t4
+append_byte:
+    beq $t1, $a0, append_fin
+    lbu $v0, 0($t1)
+    sb $v0, 0($t2)
+    addi $t1, $t1, 1
+    addi $t2, $t2, 1
+    j append_byte
+append_fin:
+    sb $zero, 0($t2)
+    sw $t5, -4($t6)
+    beq $t0, $t6, append_listo
+
+    # El buffer anterior solo lo tenía esta variable, vuelve a su lista
+    la $t1, heap_free
+    sltu $t1, $t1, $t0
+    beq $t1, $zero, append_listo
+    lw $t1, -8($t0)
+    andi $t2, $t1, 4
+    beq $t2, $zero, append_listo
+    xori $t1, $t1, 4
+    sw $t1, -8($t0)
+    addi $a0, $t0, -4
+    addi $sp, $sp, -4
+    sw $ra, 0($sp)
+    jal heap_release
+    lw $ra, 0($sp)
+    addi $sp, $sp, 4
+append_listo:
+    move $v0, $t6          # retorno: la misma cadena o la del buffer nuevo
+    jr $ra
+
+)" + runtime;
+    }
+    if (subroutines_to_add & CONCAT_STRING) {
+        runtime = R"(concat_strings:
+# Las longitudes están en la palabra anterior a cada cadena
+    lw $t3, -4($a0)
+    lw $t4, -4($a1)
 
+    # Reservar longitud + len1 + len2 + 1 (para '\0') en el heap. Solo se usan $t0 a $t6 y los registros que
+    # heap_alloc ya modifica, el resto de los $t siguen siendo de quien llama
     move $t0, $a0      # puntero cadena1
-    # Reservar memoria con sbrk
-    li $v0, 9          # syscall sbrk
-    move $a0, $t5      # tamaño en bytes
-    syscall
-    move $t6, $v0      # guardar dirección base en $t6 (retorno)
+    add $t5, $t3, $t4
+    addi $a0, $t5, 5
+    addi $sp, $sp, -4
+    sw $ra, 0($sp)
+    jal heap_alloc     # respeta los registros $t
+    lw $ra, 0($sp)
+    addi $sp, $sp, 4
+    sw $t5, 0($v0)
+    addi $t6, $v0, 4   # guardar dirección de los caracteres en $t6 (retorno)
 
-    # Copiar cadena1 al bloque
-    move $t2, $t6      # puntero destino
-copy1_loop:
-    lb $t1, 0($t0)
+    # Copiar cadena1 y después cadena2 con su '\0', $t0 origen, $t2 destino y $t5 bytes
+    move $t2, $t6
+    move $t5, $t3
+copy_alinear:
+    beq $t5, $zero, copy_siguiente
+    andi $t1, $t2, 3
+    beq $t1, $zero, copy_palabras
+    lbu $t1, 0($t0)
     sb $t1, 0($t2)
-    beq $t1, $zero, copy2_start
     addi $t0, $t0, 1
     addi $t2, $t2, 1
-    j copy1_loop
+    addi $t5, $t5, -1
+    j copy_alinear
+copy_palabras:
+    # Con el destino alineado se escriben palabras completas
+    slti $t1, $t5, 4
+    bne $t1, $zero, copy_bytes
+    andi $v0, $t0, 3
+    subu $t0, $t0, $v0
+    beq $v0, $zero, copy_alineadas
 
-copy2_start:
-    move $t0, $a1      # puntero cadena2
-copy2_loop:
-    lb $t1, 0($t0)
+    # Origen desalineado: cada palabra se arma con el final de una palabra alineada y el inicio de la siguiente.
+    # heap_alloc ya usó $a0 y $v1, así que quedan libres
+    sll $v0, $v0, 3        # bits que sobran al inicio de la palabra
+    subu $v1, $zero, $v0   # 32 - bits, sllv solo usa los 5 bits bajos
+    lw $t1, 0($t0)
+copy_desalineadas:
+    lw $a0, 4($t0)
+    srlv $t1, $t1, $v0
+    sllv $t3, $a0, $v1
+    or $t1, $t1, $t3
+    sw $t1, 0($t2)
+    move $t1, $a0
+    addi $t0, $t0, 4
+    addi $t2, $t2, 4
+    addi $t5, $t5, -4
+    slti $t3, $t5, 4
+    beq $t3, $zero, copy_desalineadas
+    srl $v0, $v0, 3
+    addu $t0, $t0, $v0
+    j copy_bytes
+
+copy_alineadas:
+    lw $t1, 0($t0)
+    sw $t1, 0($t2)
+    addi $t0, $t0, 4
+    addi $t2, $t2, 4
+    addi $t5, $t5, -4
+    slti $t1, $t5, 4
+    beq $t1, $zero, copy_alineadas
+
+copy_bytes:
+    # Los últimos 0 a 3 bytes
+    beq $t5, $zero, copy_siguiente
+    lbu $t1, 0($t0)
     sb $t1, 0($t2)
-    beq $t1, $zero, done
     addi $t0, $t0, 1
     addi $t2, $t2, 1
-    j copy2_loop
+    addi $t5, $t5, -1
+    j copy_bytes
+
+copy_siguiente:
+    bltz $t4, done     # cadena2 ya se copió
+    move $t0, $a1      # puntero cadena2
+    addi $t5, $t4, 1   # incluye el '\0'
+    li $t4, -1
+    j copy_alinear
 
 done:
     move $v0, $t6      # retorno: dirección del bloque concatenado
     jr $ra
 
-)" + text_section;
+)" + runtime;
     }
-    if (subroutines_to_add & TO_STRING) {
-    text_section = R"(to_string: 
-# Guardar el número en $t0
-    move $t0, $a0
+    if (subroutines_to_add & GARBAGE_COLLECT) {
+        runtime = R"(gc_object:
+# $a0: tamaño de los campos, $v1: mapa de punteros o 0. El mapa va en la palabra anterior a los campos
+    addi $sp, $sp, -8
+    sw $ra, 0($sp)
+    sw $v1, 4($sp)
+    addi $a0, $a0, 4
+    jal heap_calloc
+    lw $v1, 4($sp)
+    lw $ra, 0($sp)
+    addi $sp, $sp, 8
+    sw $v1, 0($v0)
+    beq $v1, $zero, gc_sin_punteros
+    lw $v1, -4($v0)
+    ori $v1, $v1, 2        # el recolector revisa los campos de este bloque
+    sw $v1, -4($v0)
+gc_sin_punteros:
+    addi $v0, $v0, 4       # retorno: dirección de los campos, 8 bytes después del bloque como en los strings
+    jr $ra
 
-    # Caso especial: si el número es 0
-    beq $t0, $zero, es_cero
-
-    # Calcular cantidad de dígitos
-    li $t1, 0              # contador de dígitos
-    move $t2, $t0
-contar_digitos:
-    beq $t2, $zero, reservar_memoria
-    li $t3, 10
-    div $t2, $t3
-    mflo $t2
-    addi $t1, $t1, 1
-    j contar_digitos
+gc_collect:
+# Mark-sweep. Las raíces son los registros, la pila y las variables globales de gc_roots; los campos de los objetos se
+# siguen con su mapa. Los trozos de sbrk están seguidos porque solo el runtime lo llama, así que los bloques se recorren
+# desde gc_heap_start hasta heap_next
+    addi $sp, $sp, -104
+    sw $t0, 0($sp)
+    sw $t1, 4($sp)
+    sw $t2, 8($sp)
+    sw $t3, 12($sp)
+    sw $t4, 16($sp)
+    sw $t5, 20($sp)
+    sw $t6, 24($sp)
+    sw $t7, 28($sp)
+    sw $t8, 32($sp)
+    sw $t9, 36($sp)
+    sw $s0, 40($sp)
+    sw $s1, 44($sp)
+    sw $s2, 48($sp)
+    sw $s3, 52($sp)
+    sw $s4, 56($sp)
+    sw $s5, 60($sp)
+    sw $s6, 64($sp)
+    sw $s7, 68($sp)
+    sw $a0, 72($sp)
+    sw $a1, 76($sp)
+    sw $a2, 80($sp)
+    sw $a3, 84($sp)
+    sw $v0, 88($sp)
+    sw $v1, 92($sp)
+    sw $fp, 96($sp)
+    sw $ra, 100($sp)
+    move $s7, $sp          # base de los registros guardados
+    lw $s0, gc_heap_start
+    lw $s1, heap_next
+    subu $s1, $s1, $s0     # bytes de bloques
 
-es_cero:
-    li $t1, 1              # solo un dígito para '0'
+    # Mapa de bits en la pila, un bit por cada 8 bytes del heap, para saber dónde empieza cada bloque
+    srl $t0, $s1, 8
+    addi $t0, $t0, 1
+    sll $t0, $t0, 2
+    subu $sp, $sp, $t0
+    move $s2, $sp
+gc_limpiar:
+    addi $t0, $t0, -4
+    addu $t1, $s2, $t0
+    sw $zero, 0($t1)
+    bne $t0, $zero, gc_limpiar
+    move $t0, $zero
+gc_inicios:
+    sltu $t1, $t0, $s1
+    beq $t1, $zero, gc_libres
+    srl $t1, $t0, 3
+    srl $t2, $t1, 5
+    sll $t2, $t2, 2
+    addu $t2, $t2, $s2
+    lw $t3, 0($t2)
+    li $t4, 1
+    sllv $t4, $t4, $t1
+    or $t3, $t3, $t4
+    sw $t3, 0($t2)
+    addu $t1, $t0, $s0
+    lw $t1, 0($t1)
+    li $t2, -8
+    and $t1, $t1, $t2      # tamaño sin las marcas
+    addu $t0, $t0, $t1
+    j gc_inicios
 
-reservar_memoria:
-    addi $t1, $t1, 1       # +1 para '\0'
-    li $v0, 9              # syscall sbrk
-    move $a0, $t1          # tamaño en bytes
+gc_libres:
+    # Los bloques que ya estaban libres no cuentan como recuperados. heap_large y heap_free están seguidas, y las listas
+    # se arman de nuevo al barrer
+    lw $t5, gc_reclaimed
+    la $t0, heap_large
+    addi $t1, $t0, 136
+gc_lista:
+    lw $t2, 0($t0)
+gc_lista_bloque:
+    beq $t2, $zero, gc_lista_siguiente
+    lw $t3, 0($t2)
+    subu $t5, $t5, $t3
+    lw $t2, 4($t2)
+    j gc_lista_bloque
+gc_lista_siguiente:
+    sw $zero, 0($t0)
+    addi $t0, $t0, 4
+    bne $t0, $t1, gc_lista
+    sw $t5, gc_reclaimed
+
+    # Cada palabra de la pila, desde los registros guardados hasta el inicio de main
+    move $s5, $s7
+    lw $s6, gc_stack_top
+gc_pila:
+    sltu $t0, $s5, $s6
+    beq $t0, $zero, gc_globales_inicio
+    lw $a0, 0($s5)
+    jal gc_marcar
+    addi $s5, $s5, 4
+    j gc_pila
+gc_globales_inicio:
+    la $s5, gc_roots
+gc_globales:
+    lw $s3, 0($s5)
+    beq $s3, $zero, gc_revisar
+    lw $s4, 4($s5)
+    jal gc_campos
+    addi $s5, $s5, 8
+    j gc_globales
+
+gc_revisar:
+    # Los objetos marcados que tienen punteros esperan en la pila hasta revisar sus campos
+    beq $sp, $s2, gc_barrer
+    lw $s3, 0($sp)
+    addi $sp, $sp, 4
+    lw $s4, -4($s3)        # mapa del objeto
+    jal gc_campos
+    j gc_revisar
+
+gc_barrer:
+    # Los bloques sin marca vuelven a la lista de su tamaño, a los marcados se les quita la marca
+    move $s3, $zero        # bytes vivos
+    lw $s5, gc_reclaimed
+    move $t0, $s0
+    addu $t5, $s0, $s1
+gc_bloque:
+    sltu $t1, $t0, $t5
+    beq $t1, $zero, gc_fin
+    lw $t1, 0($t0)
+    li $t2, -8
+    and $t2, $t1, $t2
+    andi $t3, $t1, 1
+    beq $t3, $zero, gc_liberar
+    xori $t1, $t1, 1
+    sw $t1, 0($t0)
+    addu $s3, $s3, $t2
+    j gc_siguiente
+gc_liberar:
+    sw $t2, 0($t0)         # el encabezado queda solo con el tamaño
+    addu $s5, $s5, $t2
+    la $t4, heap_large
+    slti $t3, $t2, 257
+    beq $t3, $zero, gc_enlazar
+    srl $t4, $t2, 1
+    la $t3, heap_free
+    addu $t4, $t4, $t3
+gc_enlazar:
+    lw $t3, 0($t4)
+    sw $t3, 4($t0)
+    sw $t0, 0($t4)
+gc_siguiente:
+    addu $t0, $t0, $t2
+    j gc_bloque
+
+gc_fin:
+    sw $s5, gc_reclaimed
+    lw $t0, gc_collections
+    addi $t0, $t0, 1
+    sw $t0, gc_collections
+    # La próxima recolección es cuando el heap llegue al doble de lo que sigue vivo, con 64 KB como mínimo
+    li $t1, 65536
+    sll $t0, $s3, 1
+    slt $t2, $t0, $t1
+    movn $t0, $t1, $t2
+    sw $t0, gc_threshold
+
+    move $sp, $s7
+    lw $t0, 0($sp)
+    lw $t1, 4($sp)
+    lw $t2, 8($sp)
+    lw $t3, 12($sp)
+    lw $t4, 16($sp)
+    lw $t5, 20($sp)
+    lw $t6, 24($sp)
+    lw $t7, 28($sp)
+    lw $t8, 32($sp)
+    lw $t9, 36($sp)
+    lw $s0, 40($sp)
+    lw $s1, 44($sp)
+    lw $s2, 48($sp)
+    lw $s3, 52($sp)
+    lw $s4, 56($sp)
+    lw $s5, 60($sp)
+    lw $s6, 64($sp)
+    lw $s7, 68($sp)
+    lw $a0, 72($sp)
+    lw $a1, 76($sp)
+    lw $a2, 80($sp)
+    lw $a3, 84($sp)
+    lw $v0, 88($sp)
+    lw $v1, 92($sp)
+    lw $fp, 96($sp)
+    lw $ra, 100($sp)
+    addi $sp, $sp, 104
+    jr $ra
+
+gc_marcar:
+# $a0: posible puntero. Se marca solo si está 8 bytes después del inicio de un bloque, y los objetos con mapa se apilan
+    addi $t0, $a0, -8
+    subu $t0, $t0, $s0
+    sltu $t1, $t0, $s1
+    beq $t1, $zero, gc_no_marcar
+    andi $t1, $t0, 7
+    bne $t1, $zero, gc_no_marcar
+    srl $t0, $t0, 3
+    srl $t1, $t0, 5
+    sll $t1, $t1, 2
+    addu $t1, $t1, $s2
+    lw $t1, 0($t1)
+    srlv $t1, $t1, $t0
+    andi $t1, $t1, 1
+    beq $t1, $zero, gc_no_marcar
+    lw $t1, -8($a0)
+    andi $t2, $t1, 1
+    bne $t2, $zero, gc_no_marcar
+    ori $t1, $t1, 1
+    sw $t1, -8($a0)
+    andi $t2, $t1, 2
+    beq $t2, $zero, gc_no_marcar
+    addi $sp, $sp, -4
+    sw $a0, 0($sp)
+gc_no_marcar:
+    jr $ra
+
+gc_campos:
+# $s3: dirección de un objeto o global, $s4: su mapa, la cantidad de punteros y sus desplazamientos
+    move $t9, $ra
+    lw $t3, 0($s4)
+gc_campo:
+    beq $t3, $zero, gc_campos_fin
+    addi $s4, $s4, 4
+    lw $t0, 0($s4)
+    addu $t0, $t0, $s3
+    lw $a0, 0($t0)
+    jal gc_marcar
+    addi $t3, $t3, -1
+    j gc_campo
+gc_campos_fin:
+    jr $t9
+
+gc_stats:
+# Al terminar: recolecciones, bytes recuperados y tamaño del heap
+    li $v0, 4
+    la $a0, gc_msg_start
     syscall
-    move $t3, $v0          # dirección base
-    addi $t4, $t3, 0       # puntero destino
+    li $v0, 1
+    lw $a0, gc_collections
+    syscall
+    li $v0, 4
+    la $a0, gc_msg_collections
+    syscall
+    li $v0, 1
+    lw $a0, gc_reclaimed
+    syscall
+    li $v0, 4
+    la $a0, gc_msg_reclaimed
+    syscall
+    lw $a0, heap_next
+    lw $v0, heap_left
+    addu $a0, $a0, $v0
+    lw $v0, gc_heap_start
+    subu $a0, $a0, $v0
+    li $v0, 1
+    syscall
+    li $v0, 4
+    la $a0, gc_msg_heap
+    syscall
+    jr $ra
 
-    # Si el número era 0, escribir '0' y terminar
-    beq $t0, $zero, escribir_cero
+)" + runtime;
+    }
+    if (subroutines_to_add & HEAP) {
+        runtime = R"(heap_alloc:
+# Bloque = palabra con su tamaño + contenido, redondeado a múltiplos de 8. Solo usa $v0, $v1 y $a0, y deja $v1 en cero si
+# la memoria es nueva
+    addi $a0, $a0, 11
+    srl $a0, $a0, 3
+    sll $a0, $a0, 3
+    slti $v1, $a0, 257
+    beq $v1, $zero, heap_grande
 
-    # Convertir número a ASCII (en orden inverso)
-    move $t2, $t0
-    add $t4, $t4, $t1     # puntero al final
-    addi $t4, $t4, -1      # retroceder para '\0'
+    # Clases de 8 a 256 bytes, cada una con su lista de bloques libres
+    srl $v1, $a0, 1
+    la $v0, heap_free
+    addu $v1, $v1, $v0
+    lw $v0, 0($v1)
+    beq $v0, $zero, heap_bump
+)" + std::string((collect) ? "heap_tomar:\n" : "") + R"(    lw $a0, 4($v0)         # siguiente bloque libre, en la primera palabra del contenido
+    sw $a0, 0($v1)
+    addi $v0, $v0, 4       # retorno: dirección del contenido
+    jr $ra
+
+heap_bump:
+    # Sin bloques libres se toma el inicio de la región que queda
+    lw $v1, heap_left
+    subu $v1, $v1, $a0
+    bltz $v1, heap_chunk
+    sw $v1, heap_left
+    lw $v0, heap_next
+    sw $a0, 0($v0)
+    addu $a0, $v0, $a0
+    sw $a0, heap_next
+    addi $v0, $v0, 4
+    move $v1, $zero        # memoria nueva de sbrk, ya está en cero
+    jr $ra
+
+heap_chunk:
+)" + std::string((collect) ? R"(    # Antes de pedir más memoria se recolecta, si el heap llegó al umbral
+    lw $v0, gc_heap_start
+    beq $v0, $zero, heap_pedir
+    lw $v1, heap_next
+    subu $v1, $v1, $v0
+    lw $v0, heap_left
+    addu $v1, $v1, $v0
+    lw $v0, gc_threshold
+    slt $v1, $v1, $v0
+    bne $v1, $zero, heap_pedir
+    addi $sp, $sp, -4
+    sw $ra, 0($sp)
+    jal gc_collect
+    lw $ra, 0($sp)
+    addi $sp, $sp, 4
+    # Se usa un bloque liberado de la clase si lo hay, si no se pide memoria
+    slti $v1, $a0, 257
+    beq $v1, $zero, heap_pedir
+    srl $v1, $a0, 1
+    la $v0, heap_free
+    addu $v1, $v1, $v0
+    lw $v0, 0($v1)
+    bne $v0, $zero, heap_tomar
+heap_pedir:
+)" : "") + R"(    # Pedir 64 KB con sbrk, o el bloque completo si es mayor
+    addi $sp, $sp, -8
+    sw $t0, 0($sp)
+    sw $t1, 4($sp)
+    move $t0, $a0
+    li $a0, 65536
+    slt $t1, $a0, $t0
+    movn $a0, $t0, $t1
+    li $v0, 9
+    syscall
+
+    # Si la memoria nueva no sigue a la región actual, lo que quedaba se pierde
+    lw $t1, heap_next
+    lw $v1, heap_left
+    addu $t1, $t1, $v1
+    beq $t1, $v0, heap_contigua
+    sw $v0, heap_next
+    move $v1, $zero
+)" + std::string((collect) ? R"(    lw $t1, gc_heap_start
+    movz $t1, $v0, $t1     # el primer trozo es donde empieza el recorrido del recolector
+    sw $t1, gc_heap_start
+)" : "") + R"(heap_contigua:
+    addu $v1, $v1, $a0
+    sw $v1, heap_left
+    move $a0, $t0
+    lw $t0, 0($sp)
+    lw $t1, 4($sp)
+    addi $sp, $sp, 8
+    j heap_bump
+
+heap_grande:
+    # Bloques mayores: el primero de la lista que alcance, sin dividirlo
+    addi $sp, $sp, -4
+    sw $t0, 0($sp)
+    la $v1, heap_large     # dirección del enlace al bloque actual
+heap_buscar:
+    lw $v0, 0($v1)
+    beq $v0, $zero, heap_sin_bloque
+    lw $t0, 0($v0)
+    slt $t0, $t0, $a0
+    beq $t0, $zero, heap_encontrado
+    addi $v1, $v0, 4
+    j heap_buscar
+heap_encontrado:
+    lw $t0, 4($v0)
+    sw $t0, 0($v1)
+    lw $t0, 0($sp)
+    addi $sp, $sp, 4
+    addi $v0, $v0, 4
+    jr $ra
+heap_sin_bloque:
+    lw $t0, 0($sp)
+    addi $sp, $sp, 4
+    j heap_bump
+
+)" + runtime;
+    }
+    if (subroutines_to_add & HEAP_CALLOC) {
+        runtime = R"(heap_calloc:
+# Objetos y arreglos empiezan en cero, solo hace falta limpiar los bloques reutilizados
+    addi $sp, $sp, -4
+    sw $ra, 0($sp)
+    jal heap_alloc
+    lw $ra, 0($sp)
+    addi $sp, $sp, 4
+    beq $v1, $zero, heap_limpio
+    lw $a0, -4($v0)
+    addu $a0, $a0, $v0
+    addi $a0, $a0, -4      # fin del bloque
+    move $v1, $v0
+heap_limpiar:
+    sw $zero, 0($v1)
+    addi $v1, $v1, 4
+    bne $v1, $a0, heap_limpiar
+heap_limpio:
+    jr $ra
+
+)" + runtime;
+    }
+    if (subroutines_to_add & HEAP_RELEASE) {
+        runtime = R"(heap_release:
+# $a0 es la dirección que devolvió heap_alloc, el bloque vuelve al inicio de la lista de su clase o a la de bloques grandes
+    lw $v0, -4($a0)        # tamaño del bloque
+    slti $v1, $v0, 257
+    beq $v1, $zero, heap_liberar_grande
+    srl $v0, $v0, 1
+    la $v1, heap_free
+    addu $v1, $v1, $v0
+    j heap_enlazar
+heap_liberar_grande:
+    la $v1, heap_large
+heap_enlazar:
+    lw $v0, 0($v1)
+    sw $v0, 0($a0)
+    addi $a0, $a0, -4
+    sw $a0, 0($v1)
+    jr $ra
+
+)" + runtime;
+    }
+    if (subroutines_to_add & TO_STRING) {
+    runtime = R"(to_string: 
+# Convertir en un buffer en la pila, de derecha a izquierda y dos dígitos por división
+    addi $sp, $sp, -16
+    addi $t4, $sp, 15      # puntero al final del buffer
     sb $zero, 0($t4)       # escribir terminador
-    addi $t4, $t4, -1
+    move $t0, $a0
+    bgez $t0, convertir
+    subu $t0, $zero, $t0   # valor absoluto, -2147483648 también es correcto sin signo
 
+convertir:
+    li $t6, 100
+    la $t7, to_string_digits
 convertir_loop:
-    beq $t2, $zero, fin_conversion
-    li $t6, 10
-    div $t2, $t6
-    mfhi $t5               # resto
-    mflo $t2               # cociente
-    addi $t5, $t5, 48      # convertir a ASCII
-    sb $t5, 0($t4)
+    divu $t0, $t6
+    mfhi $t5               # resto, de 0 a 99
+    mflo $t0               # cociente
+    sll $t1, $t5, 1
+    addu $t1, $t1, $t7     # par de dígitos en la tabla
+    lbu $t2, 0($t1)
+    lbu $t3, 1($t1)
+    sb $t2, -2($t4)
+    sb $t3, -1($t4)
+    addi $t4, $t4, -2
+    bne $t0, $zero, convertir_loop
+
+    # Quitar el cero a la izquierda si el último resto era de un dígito
+    slti $t1, $t5, 10
+    addu $t4, $t4, $t1
+    bgez $a0, reservar_memoria
+    li $t1, 45             # '-'
     addi $t4, $t4, -1
-    j convertir_loop
+    sb $t1, 0($t4)
 
-fin_conversion:
-    move $v0, $t3          # retorno: dirección base
-    jr $ra
+reservar_memoria:
+    addi $t2, $sp, 15
+    subu $t2, $t2, $t4     # longitud
+    addi $a0, $t2, 8
+    li $t1, -4
+    and $a0, $a0, $t1      # longitud + caracteres y '\0' en palabras completas
+    move $t6, $ra
+    jal heap_alloc         # respeta los registros $t
+    move $ra, $t6
+    sw $t2, 0($v0)
+    addi $v0, $v0, 4       # retorno: dirección del primer carácter
+    addu $t7, $v0, $t2
+    addi $t7, $t7, 1       # fin de la cadena con su '\0'
 
-escribir_cero:
-    li $t5, 48             # '0'
-    sb $t5, 0($t3)
-    sb $zero, 1($t3)
-    move $v0, $t3
+    # Copiar por palabras, cada una con el final de una palabra alineada del buffer y el inicio de la siguiente
+    andi $t5, $t4, 3
+    subu $t4, $t4, $t5
+    sll $t5, $t5, 3        # bits que sobran al inicio de la palabra
+    subu $t6, $zero, $t5   # 32 - bits, sllv solo usa los 5 bits bajos
+    move $t3, $v0
+    lw $t0, 0($t4)
+copiar_loop:
+    lw $t1, 4($t4)
+    srlv $t0, $t0, $t5
+    sllv $t2, $t1, $t6
+    movz $t2, $zero, $t5   # con el buffer alineado la palabra ya está completa
+    or $t0, $t0, $t2
+    sw $t0, 0($t3)
+    move $t0, $t1
+    addi $t4, $t4, 4
+    addi $t3, $t3, 4
+    sltu $t2, $t3, $t7
+    bne $t2, $zero, copiar_loop
+
+    addi $sp, $sp, 16
     jr $ra
 
-)" + text_section;
+)" + runtime;
     }
-    return text_section + "\n";
+    auto code = parseCode(runtime);
+    append(code, error_stubs);
+    append(code, text_section);
+    code.push_back({});
+    return code;
 }
 
 std::string Mips::generateAssembly() {
+    // The greedy allocator is the baseline the report compares against
+    Mips baseline(quadruplets, GREEDY, false, false, false, false, false, garbage_collect);
+    if (allocation != GREEDY) baseline.generateAssembly();
+
     assembly += ".data\n";
     assembly += generateDataSection();
+    auto instrs = generateTextSection();
+    instrs.push_back({JR, {reg("$ra")}});
+    instrs.push_back({});
+    // Ranges of the try blocks with their handler, inner blocks end first so the first range with the failed check is the
+    // innermost
+    if (!try_table.empty()) assembly += "err_table:\t\t.word\t" + try_table + "0\nerr_handler:\t\t.word\t0\n";
     assembly += ".text\n";
-    assembly += generateTextSection();
-    assembly += "jr $ra\n\n";
+    // Post-passes run on the machine code of each subroutine, printed back to text at the end
+    std::set<std::string> runtime = {"to_string", "concat_strings", "equal_strings", "err_bad_index", "err_bad_index_throw",
+        "heap_alloc", "heap_calloc", "heap_release", "gc_object", "gc_collect", "gc_marcar", "gc_campos", "gc_stats", "append_string"};
+    auto entries = runtime;
+    entries.insert("main");
+    entries.insert(error_labels.begin(), error_labels.end());
+    for (auto &quad: quadruplets) if (quad.op == "begin") entries.insert(quad.arg1);
+    std::set<std::string> data_labels;
+    std::stringstream ranges(try_table);
+    for (std::string label; std::getline(ranges >> std::ws, label, ',');) data_labels.insert(label);
+    auto code = MachineCode(instrs, entries, data_labels);
+    if (peephole) code.peephole();
+    if (optimize_size) {
+        code.foldIdentical();
+        code.outline();
+    }
+    if (schedule) code.schedule();
+    if (noreorder) code.fillDelaySlots();
+    assembly += code.print();
+    report += code.getReport();
+    machine_code = code.getFunctions();
+
+    if (allocation != GREEDY) {
+        // The runtime routines are the same with every allocator
+        auto count = [&runtime](const std::vector<MachineFunction> &functions, const std::set<Opcode> &opcodes) {
+            int total = 0;
+            for (auto &function: functions) {
+                if (runtime.contains(function.name)) continue;
+                for (auto &block: function.blocks)
+                    total += std::count_if(block.instrs.begin(), block.instrs.end(),
+                        [&opcodes](const MachineInstr &instr) { return opcodes.contains(instr.opcode); });
+            }
+            return total;
+        };
+        std::set<Opcode> memory = {LW, SW, LB, SB};
+        auto &greedy = baseline.getMachineCode();
+        report += "regalloc: greedy: " + std::to_string(count(greedy, {MOVE})) + " moves, " +
+            std::to_string(count(greedy, memory)) + " loads and stores\n";
+        report += "regalloc: " + std::string((allocation == LINEAR) ? "linear" : "coloring") + ": " +
+            std::to_string(count(machine_code, {MOVE})) + " moves, " + std::to_string(count(machine_code, memory)) +
+            " loads and stores\n";
+    }
 
     return assembly;
 }
+
+const std::vector<MachineFunction>& Mips::getMachineCode() {
+    return machine_code;
+}
+
+std::string Mips::getReport() {
+    return report;
+}
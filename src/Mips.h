@@ -3,37 +3,107 @@
 #include <vector>
 #include <string>
 #include <array>
+#include <memory>
+#include <set>
 
 #include "IRGenerator.h"
+#include "RegisterAllocator.h"
+#include "MachineCode.h"
 
 namespace CompiScript {
 
+/*
+Registro que tiene un operando del codigo intermedio.
+reg - Nombre del registro con $, vacio si el operando no usa uno
+code - Instrucciones que cargan el operando antes de usarlo, o que guardan el destino despues de escribirlo
+indirect - reg tiene la direccion del valor, que se lee o escribe en memoria (i*w, i*b)
+*/
 struct Register {
     std::string reg;
-    std::string text;
+    std::vector<MachineInstr> code;
+    bool indirect = false;
+};
+
+/*
+Marco de pila de una subrutina.
+locals - Desplazamiento de cada variable local o parametro que vive en el marco en lugar de .data
+leaf - La subrutina no llama a otras (call, to_str, concat ni manejadores de errores), asi que no guarda $ra
+stack_args - Cantidad de argumentos que llegan en la pila despues de $a3
+*/
+struct Frame {
+    std::unordered_map<std::string, int> locals;
+    bool leaf = true;
+    int stack_args = 0;
+};
+
+enum RegisterAllocation {
+    GREEDY,
+    LINEAR,
+    COLORING
 };
 
 class Mips {
     private:
     std::vector<Quad> quadruplets;
     std::string assembly;
+    std::string report;
+    std::vector<MachineFunction> machine_code;
+
+    RegisterAllocation allocation;
+    bool promote_globals;
+    bool schedule;
+    bool noreorder;
+    bool peephole;
+    bool optimize_size;
+    bool garbage_collect;
+    std::unique_ptr<RegisterAllocator> allocator;
+    std::string region;
+    std::unordered_map<std::string, int> spills;
+    std::unordered_map<std::string, int> reloads;
+    std::unordered_map<std::string, int> moves_removed;
+    std::unordered_map<std::string, Frame> frames;
 
     std::array<std::string, 8> temporaries;
     std::array<std::string, 8> saved;
     std::array<std::string, 4> args;
 
     std::unordered_multimap<std::string, std::string> variables;
+    std::set<std::string> static_regions;
+    // Out of line code of the checks inside try blocks, and the table of the blocks
+    std::vector<MachineInstr> error_stubs;
+    std::set<std::string> error_labels;
+    std::string try_table;
+    // Pointer maps of the objects and globals that the collector scans, by their text in alloc
+    std::unordered_map<std::string, std::string> pointer_maps;
 
     Register spill_or_assign(const std::string &var);
     Register getRegister(const std::string &var);
 
+    void buildFrames();
+    void removeCallSaves();
+    MachineOperand getAddress(const std::string &var);
+    bool usesFramePointer(const std::string &name);
+    int getFrameSize(const std::string &name);
+    std::vector<MachineInstr> saveRegisters(const std::string &name, const std::vector<MachineInstr> &code);
+
+    Register getOperand(const std::string &var, size_t position, const std::string &scratch);
+    Register getDestination(const std::string &var, size_t position);
+    std::vector<MachineInstr> getPrologue(const std::string &name);
+    std::vector<MachineInstr> getEpilogue(const std::string &name);
+    std::vector<MachineInstr> getWriteBack(const std::string &name);
+    std::vector<MachineInstr> getPromotedLoads(const std::string &name);
+
     public:
-    Mips(const std::vector<Quad> &quadruplets);
+    Mips(const std::vector<Quad> &quadruplets, RegisterAllocation allocation = GREEDY, bool promote_globals = false,
+        bool schedule = false, bool noreorder = false, bool peephole = false, bool optimize_size = false,
+        bool garbage_collect = false);
 
     std::string generateDataSection();    
-    std::string generateTextSection();
+    std::vector<MachineInstr> generateTextSection();
 
     std::string generateAssembly();
+    const std::vector<MachineFunction>& getMachineCode();
+    std::string getReport();
 };
 
 }
@@ -0,0 +1,1439 @@
+#include <unordered_map>
+#include <algorithm>
+#include <optional>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <stack>
+#include <map>
+#include <set>
+#include <sstream>
+
+#include "Optimizer.h"
+
+using namespace CompiScript;
+
+// Quads whose arguments are labels or storage names instead of values
+static const std::set<std::string> non_value_ops = {
+    "tag", "goto", "begin", "end", "call", "arg", "iferr", "print", "push", "pop"
+};
+
+static const std::set<std::string> arithmetic_ops = {
+    "+", "-", "*", "/", "%", "<", ">", "<=", ">=", "==", "!=", "&&", "||"
+};
+
+static bool isInteger(const std::string &value) {
+    size_t start = value.starts_with("-") ? 1 : 0;
+    return value.size() > start && std::all_of(value.begin() + start, value.end(), ::isdigit);
+}
+
+static bool isStringLiteral(const std::string &value) {
+    return value.size() >= 2 && value.front() == '"' && value.back() == '"';
+}
+
+static bool isConstant(const std::string &value) {
+    return isInteger(value) || isStringLiteral(value) || value == "true" || value == "false" || value == "null";
+}
+
+static bool isTemporary(const std::string &value) {
+    return value.size() > 1 && value.front() == 't' && std::all_of(value.begin() + 1, value.end(), ::isdigit);
+}
+
+static bool isVariable(const std::string &value) {
+    return value.size() > 2 &&
+        (value.front() == 'W' || value.front() == 'B' || value.front() == 'S') &&
+        std::isdigit(value.at(1)) && value.contains("_");
+}
+
+// Start (catch = handler) or end (catch = 0) of a try range
+static bool isCatch(const Quad &quad) {
+    return quad.op.empty() && quad.result == "catch";
+}
+
+// Storage shared with the runtime, a function that touches them has side effects
+static const std::set<std::string> runtime_storage = {
+    "i", "i*w", "i*b", "err", "catch", "p"
+};
+
+static bool readsArg1(const std::string &op) {
+    return !non_value_ops.contains(op);
+}
+
+static bool readsArg2(const std::string &op) {
+    return readsArg1(op) && op != "if" && op != "ifnot" && op != "to_str" && op != "param" && op != "return" && op != "alloc";
+}
+
+static int temporaryIndex(const std::string &value) {
+    return isTemporary(value) ? std::stoi(value.substr(1)) : -1;
+}
+
+// Width of the field accessed through i by the quad that follows the address computation
+static std::string fieldWidth(const Quad &quad) {
+    if (quad.arg1 == "i" || quad.arg2 == "i" || quad.result == "i") return "";
+
+    std::set<std::string> accesses;
+    for (auto name: {quad.arg1, quad.arg2, quad.result})
+        if (name == "i*w" || name == "i*b") accesses.insert(name);
+    if (accesses.size() != 1) return "";
+    return accesses.begin()->substr(2);
+}
+
+static std::optional<int> integerValue(const std::string &value) {
+    if (value == "true") return 1;
+    if (value == "false" || value == "null") return 0;
+    if (!isInteger(value)) return std::nullopt;
+    return static_cast<int32_t>(static_cast<uint32_t>(std::strtoll(value.c_str(), nullptr, 10)));
+}
+
+static std::optional<int> evaluate(const std::string &op, int32_t a, int32_t b) {
+    int64_t x = a, y = b, result;
+    if (op == "+") result = x + y;
+    else if (op == "-") result = x - y;
+    else if (op == "*") result = x * y;
+    else if (op == "/" || op == "%") {
+        if (y == 0 || (x == INT32_MIN && y == -1)) return std::nullopt;
+        result = (op == "/") ? x / y : x % y;
+    }
+    else if (op == "<") result = x < y;
+    else if (op == ">") result = x > y;
+    else if (op == "<=") result = x <= y;
+    else if (op == ">=") result = x >= y;
+    else if (op == "==") result = x == y;
+    else if (op == "!=") result = x != y;
+    else if (op == "&&") result = x && y;
+    else if (op == "||") result = x || y;
+    else return std::nullopt;
+
+    return static_cast<int32_t>(static_cast<uint32_t>(result));
+}
+
+// Replaces an operation over constants with a copy of its result
+static bool foldQuad(Quad &quad) {
+    auto a = integerValue(quad.arg1);
+    auto b = integerValue(quad.arg2);
+
+    std::optional<std::string> value;
+    if (arithmetic_ops.contains(quad.op) && !quad.arg2.empty() && a && b) {
+        auto result = evaluate(quad.op, *a, *b);
+        if (result) value = std::to_string(*result);
+    }
+    if (quad.op == "-" && quad.arg2.empty() && a) value = std::to_string(static_cast<int32_t>(-static_cast<uint32_t>(*a)));
+    if (quad.op == "!" && quad.arg2.empty() && a) value = std::to_string(!*a);
+    if (quad.op == "to_str" && a && !isStringLiteral(quad.arg1)) value = "\"" + std::to_string(*a) + "\"";
+    if (quad.op == "concat" && isStringLiteral(quad.arg1) && isStringLiteral(quad.arg2))
+        value = quad.arg1.substr(0, quad.arg1.size() - 1) + quad.arg2.substr(1);
+    if ((quad.op == "streql" || quad.op == "strneq") && isStringLiteral(quad.arg1) && isStringLiteral(quad.arg2))
+        value = std::to_string((quad.arg1 == quad.arg2) == (quad.op == "streql"));
+
+    if (!value) return false;
+    quad = {.arg1 = *value, .result = quad.result};
+    return true;
+}
+
+Optimizer::Optimizer(const std::vector<Quad> &quadruplets):
+    quadruplets(quadruplets),
+    report(),
+    label_count(0),
+    clone_count(0),
+    region_count(0)
+{
+    for (auto &quad: this->quadruplets) {
+        auto label = (quad.op == "tag" || quad.op == "begin") ? quad.arg1 : "";
+        if (label.size() > 1 && label.front() == 'l' && isInteger(label.substr(1)))
+            label_count = std::max(label_count, std::stoi(label.substr(1)) + 1);
+    }
+}
+
+const std::vector<Quad>& Optimizer::getQuadruplets() {
+    return quadruplets;
+}
+
+std::string Optimizer::getReport() {
+    return report;
+}
+
+std::vector<Function> Optimizer::getFunctions() {
+    std::vector<Function> functions;
+    std::stack<size_t> open;
+    for (size_t i = 0; i < quadruplets.size(); i++) {
+        auto &quad = quadruplets.at(i);
+        if (quad.op == "begin") {
+            if (!open.empty()) functions.at(open.top()).nested = true;
+            functions.push_back({.name = quad.arg1, .begin = i});
+            open.push(functions.size() - 1);
+        }
+        if (quad.op == "arg" && !open.empty())
+            functions.at(open.top()).args.push_back(quad.arg1);
+
+        if (quad.op == "end" && !open.empty()) {
+            functions.at(open.top()).end = i;
+            open.pop();
+        }
+    }
+    return functions;
+}
+
+std::vector<BasicBlock> Optimizer::getBasicBlocks(const std::vector<Quad> &body) {
+    std::vector<BasicBlock> blocks;
+    std::unordered_map<std::string, size_t> labels;
+    for (size_t i = 0; i < body.size(); i++) {
+        auto &quad = body.at(i);
+        bool leader = i == 0 || quad.op == "tag";
+        if (i > 0) {
+            auto &prev = body.at(i - 1).op;
+            leader |= prev == "goto" || prev == "if" || prev == "ifnot" || prev == "return";
+        }
+        if (leader) blocks.push_back({.first = i, .last = i});
+        blocks.back().last = i;
+        if (quad.op == "tag") labels.emplace(quad.arg1, blocks.size() - 1);
+    }
+
+    for (size_t b = 0; b < blocks.size(); b++) {
+        auto &last = body.at(blocks.at(b).last);
+        auto &successors = blocks.at(b).successors;
+        if (last.op == "goto" && labels.contains(last.arg1))
+            successors.push_back(labels.at(last.arg1));
+        if ((last.op == "if" || last.op == "ifnot") && labels.contains(last.arg2))
+            successors.push_back(labels.at(last.arg2));
+        if (last.op != "goto" && last.op != "return" && b + 1 < blocks.size())
+            successors.push_back(b + 1);
+    }
+    return blocks;
+}
+
+bool Optimizer::propagateConstants(std::vector<Quad> &body) {
+    bool changed = false;
+    std::unordered_map<std::string, std::string> values;
+    std::vector<Quad> result;
+
+    for (auto quad: body) {
+        if (quad.op == "tag") values.clear();
+
+        if (readsArg1(quad.op) && values.contains(quad.arg1)) {
+            quad.arg1 = values.at(quad.arg1);
+            changed = true;
+        }
+        if (readsArg2(quad.op) && values.contains(quad.arg2)) {
+            quad.arg2 = values.at(quad.arg2);
+            changed = true;
+        }
+        changed |= foldQuad(quad);
+
+        // Branches over a constant condition become a jump or disappear
+        if ((quad.op == "if" || quad.op == "ifnot") && integerValue(quad.arg1)) {
+            bool taken = (*integerValue(quad.arg1) != 0) == (quad.op == "if");
+            changed = true;
+            if (!taken) continue;
+            quad = {.op = "goto", .arg1 = quad.arg2};
+        }
+
+        // Subroutines and error handlers may write any variable
+        if (quad.op == "call" || quad.op == "iferr")
+            std::erase_if(values, [](const auto &entry) { return !isTemporary(entry.first); });
+
+        if (quad.op == "pop" || quad.op == "arg")
+            values.erase(quad.arg1);
+
+        if (isTemporary(quad.result) || isVariable(quad.result)) {
+            if (quad.op.empty() && isConstant(quad.arg1))
+                values.insert_or_assign(quad.result, quad.arg1);
+            else
+                values.erase(quad.result);
+        }
+        result.push_back(quad);
+    }
+
+    body = result;
+    return changed;
+}
+
+bool Optimizer::removeUnreachableCode(std::vector<Quad> &body) {
+    if (body.empty()) return false;
+
+    auto blocks = getBasicBlocks(body);
+    std::vector<bool> reachable(blocks.size(), false);
+    std::stack<size_t> pending;
+    pending.push(0);
+    while (!pending.empty()) {
+        auto b = pending.top();
+        pending.pop();
+        if (reachable.at(b)) continue;
+        reachable.at(b) = true;
+        for (auto next: blocks.at(b).successors) pending.push(next);
+    }
+
+    // The catch quads of unreachable blocks still close their try ranges
+    std::vector<Quad> result;
+    for (size_t b = 0; b < blocks.size(); b++)
+        for (size_t i = blocks.at(b).first; i <= blocks.at(b).last; i++)
+            if (reachable.at(b) || isCatch(body.at(i))) result.push_back(body.at(i));
+
+    bool changed = result.size() != body.size();
+    body = result;
+    return changed;
+}
+
+// Temporaries live at the start of each block
+std::vector<std::set<std::string>> Optimizer::getLiveTemporaries(const std::vector<Quad> &body,
+    const std::vector<BasicBlock> &blocks) {
+    std::vector<std::set<std::string>> live_in(blocks.size());
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t b = blocks.size(); b-- > 0;) {
+            std::set<std::string> live;
+            for (auto next: blocks.at(b).successors)
+                live.insert(live_in.at(next).begin(), live_in.at(next).end());
+
+            for (size_t i = blocks.at(b).last + 1; i-- > blocks.at(b).first;) {
+                auto &quad = body.at(i);
+                if (isTemporary(quad.result)) live.erase(quad.result);
+                if (isTemporary(quad.arg1)) live.insert(quad.arg1);
+                if (isTemporary(quad.arg2)) live.insert(quad.arg2);
+            }
+            if (live != live_in.at(b)) {
+                live_in.at(b) = live;
+                changed = true;
+            }
+        }
+    }
+    return live_in;
+}
+
+bool Optimizer::removeDeadTemporaries(std::vector<Quad> &body) {
+    if (body.empty()) return false;
+
+    auto blocks = getBasicBlocks(body);
+    auto live_in = getLiveTemporaries(body, blocks);
+
+    std::vector<bool> dead(body.size(), false);
+    for (size_t b = 0; b < blocks.size(); b++) {
+        std::set<std::string> live;
+        for (auto next: blocks.at(b).successors)
+            live.insert(live_in.at(next).begin(), live_in.at(next).end());
+
+        for (size_t i = blocks.at(b).last + 1; i-- > blocks.at(b).first;) {
+            auto &quad = body.at(i);
+            if (isTemporary(quad.result)) {
+                if (!live.contains(quad.result)) {
+                    dead.at(i) = true;
+                    continue;
+                }
+                live.erase(quad.result);
+            }
+            if (isTemporary(quad.arg1)) live.insert(quad.arg1);
+            if (isTemporary(quad.arg2)) live.insert(quad.arg2);
+        }
+    }
+
+    std::vector<Quad> result;
+    for (size_t i = 0; i < body.size(); i++)
+        if (!dead.at(i)) result.push_back(body.at(i));
+
+    bool changed = result.size() != body.size();
+    body = result;
+    return changed;
+}
+
+bool Optimizer::removeRedundantJumps(std::vector<Quad> &body) {
+    std::set<std::string> referenced;
+    auto collect = [&referenced](const Quad &quad) {
+        if (quad.op == "goto" || quad.op.empty()) referenced.insert(quad.arg1);
+        if (quad.op == "if" || quad.op == "ifnot") referenced.insert(quad.arg2);
+    };
+
+    std::vector<Quad> result;
+    for (size_t i = 0; i < body.size(); i++) {
+        auto &quad = body.at(i);
+        std::string target =
+            (quad.op == "goto") ? quad.arg1 :
+            (quad.op == "if" || quad.op == "ifnot") ? quad.arg2 : "";
+
+        // Jumps to the label that follows them
+        bool redundant = false;
+        for (size_t j = i + 1; !target.empty() && j < body.size() && body.at(j).op == "tag"; j++)
+            redundant |= body.at(j).arg1 == target;
+
+        if (!redundant) result.push_back(quad);
+    }
+
+    for (auto &quad: quadruplets) collect(quad);
+    for (auto &quad: result) collect(quad);
+    std::erase_if(result, [&referenced](const Quad &quad) {
+        return quad.op == "tag" && !referenced.contains(quad.arg1);
+    });
+
+    bool changed = result.size() != body.size();
+    body = result;
+    return changed;
+}
+
+void Optimizer::foldConstants(std::vector<Quad> &body) {
+    for (int pass = 0; pass < 8; pass++) {
+        bool changed = propagateConstants(body);
+        changed |= removeUnreachableCode(body);
+        changed |= removeDeadTemporaries(body);
+        changed |= removeRedundantJumps(body);
+        if (!changed) break;
+    }
+}
+
+void Optimizer::specializeFunctions(int growth_limit) {
+    const int min_budget = 32;
+    const int max_rounds = 3;
+    const int max_clones_per_function = 4;
+
+    struct Candidate {
+        std::string callee;
+        std::vector<std::string> constants;
+        std::vector<size_t> calls;
+    };
+
+    int budget = std::max(min_budget, (int) quadruplets.size() * growth_limit / 100);
+    int clones = 0;
+    int total_saved = 0;
+    std::unordered_map<std::string, int> clones_per_function;
+
+    for (int round = 0; round < max_rounds; round++) {
+        std::unordered_map<std::string, Function> functions;
+        for (auto &function: getFunctions())
+            functions.emplace(function.name, function);
+
+        // Arguments that are reassigned inside the body can't be replaced
+        auto isWritten = [this](const Function &function, const std::string &var) {
+            for (size_t i = function.begin; i < function.end; i++)
+                if (quadruplets.at(i).result == var) return true;
+            return false;
+        };
+
+        // Group call sites by callee and constant arguments
+        std::vector<Candidate> candidates;
+        for (size_t i = 0; i < quadruplets.size(); i++) {
+            auto &quad = quadruplets.at(i);
+            if (quad.op != "call" || !functions.contains(quad.arg1)) continue;
+
+            auto &function = functions.at(quad.arg1);
+            auto is_method = std::any_of(function.args.begin(), function.args.end(),
+                [](const std::string &arg) { return arg.ends_with("_this"); });
+            if (function.nested || function.args.empty() || is_method) continue;
+
+            size_t count = 0;
+            while (count < i && quadruplets.at(i - count - 1).op == "param") count++;
+            if (count != function.args.size()) continue;
+
+            std::vector<std::string> constants;
+            for (size_t k = 0; k < count; k++) {
+                auto &value = quadruplets.at(i - count + k).arg1;
+                bool usable = isConstant(value) && !isWritten(function, function.args.at(k));
+                constants.push_back(usable ? value : "");
+            }
+            if (std::all_of(constants.begin(), constants.end(), [](auto &value) { return value.empty(); }))
+                continue;
+
+            auto candidate = std::find_if(candidates.begin(), candidates.end(), [&](const Candidate &candidate) {
+                return candidate.callee == quad.arg1 && candidate.constants == constants;
+            });
+            if (candidate == candidates.end())
+                candidates.push_back({.callee = quad.arg1, .constants = constants, .calls = {i}});
+            else
+                candidate->calls.push_back(i);
+        }
+
+        std::stable_sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+            return a.calls.size() > b.calls.size();
+        });
+
+        struct Rewrite {
+            size_t call;
+            std::string name;
+            std::vector<std::string> constants;
+        };
+        std::vector<Rewrite> rewrites;
+        for (auto &candidate: candidates) {
+            auto &function = functions.at(candidate.callee);
+            if (clones_per_function[candidate.callee] >= max_clones_per_function) continue;
+
+            std::vector<Quad> body(quadruplets.begin() + function.begin + 1, quadruplets.begin() + function.end);
+
+            // Clones need their own labels
+            std::unordered_map<std::string, std::string> labels;
+            for (auto &quad: body)
+                if (quad.op == "tag") labels.emplace(quad.arg1, "l" + std::to_string(label_count + labels.size()));
+
+            std::unordered_map<std::string, std::string> constants;
+            for (size_t k = 0; k < candidate.constants.size(); k++)
+                if (!candidate.constants.at(k).empty())
+                    constants.emplace(function.args.at(k), candidate.constants.at(k));
+
+            std::vector<Quad> clone;
+            for (auto quad: body) {
+                if ((quad.op == "arg" || quad.op == "push" || quad.op == "pop") && constants.contains(quad.arg1))
+                    continue;
+                if ((quad.op == "tag" || quad.op == "goto" || quad.op.empty()) && labels.contains(quad.arg1))
+                    quad.arg1 = labels.at(quad.arg1);
+                if ((quad.op == "if" || quad.op == "ifnot") && labels.contains(quad.arg2))
+                    quad.arg2 = labels.at(quad.arg2);
+                if (readsArg1(quad.op) && constants.contains(quad.arg1))
+                    quad.arg1 = constants.at(quad.arg1);
+                if (readsArg2(quad.op) && constants.contains(quad.arg2))
+                    quad.arg2 = constants.at(quad.arg2);
+                clone.push_back(quad);
+            }
+            foldConstants(clone);
+
+            // Dropping the arg quads alone doesn't pay for a new copy of the function
+            int saved = (int) body.size() - (int) clone.size();
+            if (saved - (int) constants.size() < 1 || (int) clone.size() + 2 > budget) continue;
+
+            budget -= clone.size() + 2;
+            label_count += labels.size();
+            clones_per_function[candidate.callee]++;
+
+            auto name = candidate.callee + "__s" + std::to_string(clone_count++);
+            quadruplets.push_back({.op = "begin", .arg1 = name});
+            quadruplets.insert(quadruplets.end(), clone.begin(), clone.end());
+            quadruplets.push_back({.op = "end", .arg1 = name});
+
+            std::string signature;
+            for (auto &value: candidate.constants)
+                signature += (signature.empty() ? "" : ", ") + (value.empty() ? "_" : value);
+
+            report += "specialize: " + candidate.callee + "(" + signature + ") -> " + name +
+                " (" + std::to_string(candidate.calls.size()) + " call sites, " +
+                std::to_string(saved) + " instructions saved per call)\n";
+
+            clones++;
+            total_saved += saved * candidate.calls.size() + constants.size() * candidate.calls.size();
+            for (auto call: candidate.calls)
+                rewrites.push_back({.call = call, .name = name, .constants = candidate.constants});
+        }
+
+        if (rewrites.empty()) break;
+
+        // Rewrite call sites back to front so pending indexes stay valid
+        std::sort(rewrites.begin(), rewrites.end(), [](auto &a, auto &b) { return a.call > b.call; });
+        for (auto &rewrite: rewrites) {
+            quadruplets.at(rewrite.call).arg1 = rewrite.name;
+            auto count = rewrite.constants.size();
+            for (size_t k = count; k-- > 0;)
+                if (!rewrite.constants.at(k).empty())
+                    quadruplets.erase(quadruplets.begin() + (rewrite.call - count + k));
+        }
+    }
+
+    report += "specialize: " + std::to_string(clones) + " clones created, " +
+        std::to_string(total_saved) + " instructions saved\n";
+}
+
+std::vector<std::string> Optimizer::getOwners() {
+    std::vector<std::string> owners;
+    std::stack<std::string> open;
+    open.push("main");
+    for (auto &quad: quadruplets) {
+        if (quad.op == "begin") open.push(quad.arg1);
+        owners.push_back(open.top());
+        if (quad.op == "end" && open.size() > 1) open.pop();
+    }
+    return owners;
+}
+
+std::vector<bool> Optimizer::getRunsOnce() {
+    std::vector<bool> runs_once(quadruplets.size(), true);
+    std::unordered_map<std::string, size_t> tags;
+    int depth = 0;
+    for (size_t i = 0; i < quadruplets.size(); i++) {
+        auto &quad = quadruplets.at(i);
+        if (quad.op == "begin") depth++;
+        if (quad.op == "end") depth--;
+        if (quad.op == "tag") tags[quad.arg1] = i;
+        runs_once.at(i) = depth == 0 && quad.op != "end";
+
+        // Backward jumps close a loop
+        auto target = (quad.op == "goto") ? quad.arg1 : (quad.op == "if" || quad.op == "ifnot") ? quad.arg2 : "";
+        if (tags.contains(target))
+            std::fill(runs_once.begin() + tags.at(target), runs_once.begin() + i + 1, false);
+    }
+    return runs_once;
+}
+
+CallGraph Optimizer::getCallGraph() {
+    CallGraph graph;
+    graph.callees["main"];
+
+    auto owners = getOwners();
+    for (size_t i = 0; i < quadruplets.size(); i++) {
+        auto &quad = quadruplets.at(i);
+        auto &callees = graph.callees[owners.at(i)];
+        if (quad.op == "call") callees.insert(quad.arg1);
+        if (quad.op.empty() && quad.result == "catch" && quad.arg1 != "0") callees.insert(quad.arg1);
+    }
+    return graph;
+}
+
+std::set<std::string> Optimizer::getPureFunctions() {
+    auto owners = getOwners();
+
+    // Variables referenced by more than one subroutine are globals or captured by closures
+    std::unordered_map<std::string, std::set<std::string>> users;
+    for (size_t i = 0; i < quadruplets.size(); i++) {
+        auto &quad = quadruplets.at(i);
+        for (auto name: {quad.arg1, quad.arg2, quad.result})
+            if (isVariable(name)) users[name].insert(owners.at(i));
+    }
+
+    std::set<std::string> pure;
+    for (auto &function: getFunctions()) pure.insert(function.name);
+
+    for (size_t i = 0; i < quadruplets.size(); i++) {
+        auto &quad = quadruplets.at(i);
+        auto &owner = owners.at(i);
+        if (!pure.contains(owner)) continue;
+
+        bool side_effect = quad.op == "print" || quad.op == "alloc" || quad.op == "iferr";
+        for (auto name: {quad.arg1, quad.arg2, quad.result}) {
+            side_effect |= runtime_storage.contains(name);
+            side_effect |= isVariable(name) && users.at(name).size() > 1;
+        }
+        if (side_effect) pure.erase(owner);
+    }
+
+    // A subroutine is only pure if everything it calls is pure
+    auto graph = getCallGraph();
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto &[caller, callees]: graph.callees) {
+            if (!pure.contains(caller)) continue;
+            for (auto &callee: callees) {
+                if (pure.contains(callee)) continue;
+                pure.erase(caller);
+                changed = true;
+                break;
+            }
+        }
+    }
+    return pure;
+}
+
+std::optional<std::string> Optimizer::evaluateCall(const std::vector<Function> &functions, const std::string &name,
+    const std::vector<std::string> &args, int &steps, int depth) {
+    const int max_depth = 200;
+
+    auto function = std::find_if(functions.begin(), functions.end(), [&name](const Function &function) {
+        return function.name == name;
+    });
+    if (function == functions.end() || function->args.size() != args.size() || depth > max_depth)
+        return std::nullopt;
+
+    std::unordered_map<std::string, std::string> values;
+    for (size_t k = 0; k < args.size(); k++)
+        values.insert_or_assign(function->args.at(k), args.at(k));
+
+    std::unordered_map<std::string, size_t> labels;
+    std::unordered_map<size_t, size_t> nested;
+    for (auto &other: functions)
+        if (other.begin > function->begin && other.end < function->end) nested.emplace(other.begin, other.end);
+    for (size_t i = function->begin + 1; i < function->end; i++)
+        if (quadruplets.at(i).op == "tag") labels.emplace(quadruplets.at(i).arg1, i);
+
+    auto value = [&values](const std::string &name) -> std::optional<std::string> {
+        if (isConstant(name)) return name;
+        if (values.contains(name)) return values.at(name);
+        return std::nullopt;
+    };
+
+    std::vector<std::string> params;
+    size_t i = function->begin + 1;
+    while (i < function->end) {
+        if (--steps < 0) return std::nullopt;
+
+        auto quad = quadruplets.at(i++);
+        if (quad.op == "begin") {
+            if (!nested.contains(i - 1)) return std::nullopt;
+            i = nested.at(i - 1) + 1;
+            continue;
+        }
+        if (quad.op == "tag" || quad.op == "arg" || quad.op == "push" || quad.op == "pop")
+            continue;
+
+        if (quad.op == "goto" || quad.op == "if" || quad.op == "ifnot") {
+            auto condition = (quad.op == "goto") ? std::optional<int>(1) : integerValue(value(quad.arg1).value_or(""));
+            if (!condition) return std::nullopt;
+
+            auto target = (quad.op == "goto") ? quad.arg1 : quad.arg2;
+            bool taken = (*condition != 0) == (quad.op != "ifnot");
+            if (!taken) continue;
+            if (!labels.contains(target)) return std::nullopt;
+            i = labels.at(target);
+            continue;
+        }
+
+        if (quad.op == "param") {
+            auto arg = value(quad.arg1);
+            if (!arg) return std::nullopt;
+            params.push_back(*arg);
+            continue;
+        }
+
+        if (quad.op == "call") {
+            auto result = evaluateCall(functions, quad.arg1, params, steps, depth + 1);
+            if (!result) return std::nullopt;
+            values.insert_or_assign("ret", *result);
+            params.clear();
+            continue;
+        }
+
+        if (quad.op == "return") return value(quad.arg1);
+
+        if (quad.result.empty() || non_value_ops.contains(quad.op)) return std::nullopt;
+
+        auto a = value(quad.arg1);
+        auto b = quad.arg2.empty() || !readsArg2(quad.op) ? std::optional<std::string>(quad.arg2) : value(quad.arg2);
+        if (!a || !b) return std::nullopt;
+        quad.arg1 = *a;
+        quad.arg2 = *b;
+        if (!quad.op.empty() && !foldQuad(quad)) return std::nullopt;
+        values.insert_or_assign(quad.result, quad.arg1);
+    }
+    return std::nullopt;
+}
+
+void Optimizer::evaluatePureCalls(int step_limit) {
+    auto functions = getFunctions();
+    auto pure = getPureFunctions();
+    int folded = 0;
+
+    size_t i = 0;
+    while (i < quadruplets.size()) {
+        if (quadruplets.at(i).op != "call" || !pure.contains(quadruplets.at(i).arg1)) {
+            i++;
+            continue;
+        }
+        auto callee = quadruplets.at(i).arg1;
+
+        size_t first = i;
+        while (first > 0 && quadruplets.at(first - 1).op == "param") first--;
+
+        std::vector<std::string> args;
+        for (size_t k = first; k < i; k++) args.push_back(quadruplets.at(k).arg1);
+        int steps = step_limit;
+        auto result = std::all_of(args.begin(), args.end(), isConstant) ?
+            evaluateCall(functions, callee, args, steps) : std::nullopt;
+        if (!result) {
+            i++;
+            continue;
+        }
+
+        // The registry saved around the call is no longer clobbered
+        size_t last = i;
+        while (first > 0 && last + 1 < quadruplets.size() &&
+            quadruplets.at(first - 1).op == "push" && quadruplets.at(last + 1).op == "pop" &&
+            quadruplets.at(first - 1).arg1 == quadruplets.at(last + 1).arg1) {
+            first--;
+            last++;
+        }
+
+        for (size_t j = last + 1; j < quadruplets.size(); j++) {
+            auto &quad = quadruplets.at(j);
+            if (quad.op == "call" || quad.op == "tag" || quad.op == "begin" || quad.op == "end") break;
+            if (readsArg1(quad.op) && quad.arg1 == "ret") quad.arg1 = *result;
+            if (readsArg2(quad.op) && quad.arg2 == "ret") quad.arg2 = *result;
+            if (quad.result == "ret" || quad.op == "goto" || quad.op == "if" || quad.op == "ifnot" || quad.op == "return") break;
+        }
+
+        std::string signature;
+        for (auto &arg: args) signature += (signature.empty() ? "" : ", ") + arg;
+        report += "evaluate: " + callee + "(" + signature + ") = " + *result +
+            " (" + std::to_string(step_limit - steps) + " steps)\n";
+
+        quadruplets.erase(quadruplets.begin() + first, quadruplets.begin() + last + 1);
+        functions = getFunctions();
+        i = first;
+        folded++;
+    }
+
+    report += "evaluate: " + std::to_string(folded) + " calls folded\n";
+}
+
+void Optimizer::removeDeadFunctions() {
+    auto graph = getCallGraph();
+
+    std::set<std::string> reachable;
+    std::stack<std::string> pending;
+    pending.push("main");
+    while (!pending.empty()) {
+        auto name = pending.top();
+        pending.pop();
+        if (!reachable.insert(name).second) continue;
+        if (!graph.callees.contains(name)) continue;
+        for (auto &callee: graph.callees.at(name)) pending.push(callee);
+    }
+
+    std::vector<bool> dead(quadruplets.size(), false);
+    int removed = 0;
+    for (auto &function: getFunctions()) {
+        if (reachable.contains(function.name) || dead.at(function.begin)) continue;
+        std::fill(dead.begin() + function.begin, dead.begin() + function.end + 1, true);
+
+        report += "dead: " + function.name + " removed (" +
+            std::to_string(function.end - function.begin + 1) + " instructions)\n";
+        removed++;
+    }
+
+    std::vector<Quad> result;
+    for (size_t i = 0; i < quadruplets.size(); i++)
+        if (!dead.at(i)) result.push_back(quadruplets.at(i));
+
+    report += "dead: " + std::to_string(removed) + " functions removed, " +
+        std::to_string(quadruplets.size() - result.size()) + " instructions removed\n";
+    quadruplets = result;
+}
+
+bool Optimizer::argumentEscapes(const std::string &name, size_t index, std::set<std::string> &visiting) {
+    auto functions = getFunctions();
+    auto function = std::find_if(functions.begin(), functions.end(), [&name](const Function &function) {
+        return function.name == name;
+    });
+    if (function == functions.end() || index >= function->args.size()) return true;
+
+    // Recursive paths are assumed to escape
+    if (!visiting.insert(name + "#" + std::to_string(index)).second) return true;
+
+    auto owners = getOwners();
+    auto &arg = function->args.at(index);
+    for (size_t i = 0; i < quadruplets.size(); i++) {
+        auto &quad = quadruplets.at(i);
+        if (quad.arg1 != arg && quad.arg2 != arg) continue;
+        if (owners.at(i) != name) return true;
+
+        if (quad.op == "arg" || quad.op == "push" || quad.op == "pop") continue;
+        if (quad.op == "+" && quad.result == "i" && quad.arg1 == arg && isInteger(quad.arg2)) continue;
+
+        if (quad.op == "param") {
+            size_t first = i, call = i;
+            while (first > 0 && quadruplets.at(first - 1).op == "param") first--;
+            while (call < quadruplets.size() && quadruplets.at(call).op == "param") call++;
+            if (call < quadruplets.size() && quadruplets.at(call).op == "call" &&
+                !argumentEscapes(quadruplets.at(call).arg1, i - first, visiting))
+                continue;
+        }
+        return true;
+    }
+    return false;
+}
+
+bool Optimizer::promoteObject(size_t alloc) {
+    const int temporary_registers = 8;
+
+    auto &quad = quadruplets.at(alloc);
+    if (quad.op != "alloc" || !isTemporary(quad.result) || !isInteger(quad.arg1)) return false;
+    auto temp = quad.result;
+
+    // new expressions are: alloc, param of the new object, constructor params, call, store
+    size_t call = alloc + 1;
+    while (call < quadruplets.size() && quadruplets.at(call).op == "param") call++;
+    if (call == alloc + 1 || call + 1 >= quadruplets.size() || quadruplets.at(call).op != "call") return false;
+    if (quadruplets.at(alloc + 1).arg1 != temp) return false;
+
+    auto &store = quadruplets.at(call + 1);
+    if (!store.op.empty() || store.arg1 != temp || !isVariable(store.result) || !store.result.starts_with("S"))
+        return false;
+    auto object = store.result;
+    auto constructor = quadruplets.at(call).arg1;
+
+    auto owners = getOwners();
+    auto owner = owners.at(alloc);
+
+    // A recursive owner could still hold the previous object when the next one is created
+    auto graph = getCallGraph();
+    std::set<std::string> reached;
+    std::stack<std::string> pending;
+    for (auto &callee: graph.callees[owner]) pending.push(callee);
+    while (!pending.empty()) {
+        auto name = pending.top();
+        pending.pop();
+        if (name == owner) return false;
+        if (!reached.insert(name).second) continue;
+        for (auto &callee: graph.callees[name]) pending.push(callee);
+    }
+
+    std::set<std::string> visiting;
+    if (argumentEscapes(constructor, 0, visiting)) return false;
+
+    // Every use of the object must be a field access, a registry save or a call that keeps it local
+    bool scalar = true;
+    std::map<int, std::string> fields;
+    for (size_t i = 0; i < quadruplets.size(); i++) {
+        auto &use = quadruplets.at(i);
+        if (use.result == object && i != call + 1 && use.op != "pop") return false;
+        if (use.arg1 != object && use.arg2 != object) continue;
+        if (owners.at(i) != owner) return false;
+        if (use.op == "push" || use.op == "pop") continue;
+
+        if (use.op == "+" && use.result == "i" && use.arg1 == object && isInteger(use.arg2)) {
+            auto width = (i + 1 < quadruplets.size()) ? fieldWidth(quadruplets.at(i + 1)) : "";
+            auto offset = std::stoi(use.arg2);
+            if (width.empty() || (fields.contains(offset) && fields.at(offset) != width)) scalar = false;
+            else fields[offset] = width;
+            continue;
+        }
+
+        if (use.op == "param") {
+            size_t first = i, next = i;
+            while (first > 0 && quadruplets.at(first - 1).op == "param") first--;
+            while (next < quadruplets.size() && quadruplets.at(next).op == "param") next++;
+            visiting.clear();
+            if (next < quadruplets.size() && quadruplets.at(next).op == "call" &&
+                !argumentEscapes(quadruplets.at(next).arg1, i - first, visiting)) {
+                scalar = false;
+                continue;
+            }
+        }
+        return false;
+    }
+
+    // Scalar replacement inlines the constructor, so it must be straight-line code
+    static const std::set<std::string> control_ops = {
+        "tag", "goto", "if", "ifnot", "return", "begin", "call", "param", "push", "pop", "iferr", "alloc"
+    };
+    auto functions = getFunctions();
+    auto function = std::find_if(functions.begin(), functions.end(), [&constructor](const Function &function) {
+        return function.name == constructor;
+    });
+
+    std::set<int> initialized;
+    int caller_temps = 0, constructor_temps = 0;
+    for (size_t i = 0; i < quadruplets.size(); i++) {
+        if (owners.at(i) != owner) continue;
+        for (auto name: {quadruplets.at(i).arg1, quadruplets.at(i).arg2, quadruplets.at(i).result})
+            caller_temps = std::max(caller_temps, temporaryIndex(name) + 1);
+    }
+
+    scalar = scalar && !function->nested && function->args.size() == call - alloc - 1;
+    for (size_t i = function->begin + 1; scalar && i < function->end; i++) {
+        auto &body = quadruplets.at(i);
+        auto &self = function->args.front();
+        for (auto name: {body.arg1, body.arg2, body.result})
+            constructor_temps = std::max(constructor_temps, temporaryIndex(name) + 1);
+
+        auto writes = [&body](const std::string &value) { return value == body.result; };
+        bool writes_value = body.op != "arg" && (std::any_of(function->args.begin(), function->args.end(), writes) ||
+            std::any_of(quadruplets.begin() + alloc + 2, quadruplets.begin() + call, [&writes](const Quad &param) {
+                return writes(param.arg1);
+            }));
+        if (control_ops.contains(body.op) || writes_value) scalar = false;
+        if (body.op == "arg" || (body.arg1 != self && body.arg2 != self)) continue;
+        if (body.op != "+" || body.result != "i" || body.arg2.empty() || !isInteger(body.arg2)) {
+            scalar = false;
+            continue;
+        }
+
+        auto width = fieldWidth(quadruplets.at(i + 1));
+        auto offset = std::stoi(body.arg2);
+        if (width.empty() || (fields.contains(offset) && fields.at(offset) != width)) scalar = false;
+        fields[offset] = width;
+        if (quadruplets.at(i + 1).result.starts_with("i*")) initialized.insert(offset);
+    }
+    scalar = scalar && caller_temps + constructor_temps <= temporary_registers;
+
+    bool runs_once = getRunsOnce().at(alloc);
+    auto size = (std::stoi(quad.arg1) + 3) / 4 * 4;
+    auto pointer_map = quad.arg2;
+
+    if (!scalar) {
+        // Storage is reused by the next object, which can only be created once this one is dead
+        std::vector<Quad> allocation = {
+            {.op = "alloc", .arg1 = std::to_string(size), .arg2 = pointer_map, .result = object}
+        };
+        for (int offset = 0; !runs_once && offset < size; offset += 4) {
+            allocation.push_back({.op = "+", .arg1 = object, .arg2 = std::to_string(offset), .result = "i"});
+            allocation.push_back({.arg1 = "0", .result = "i*w"});
+        }
+        quadruplets.erase(quadruplets.begin() + call + 1);
+        quadruplets.at(alloc + 1).arg1 = object;
+        quadruplets.erase(quadruplets.begin() + alloc);
+        quadruplets.insert(quadruplets.begin() + alloc, allocation.begin(), allocation.end());
+
+        report += "escape: " + object + " allocated statically (" + std::to_string(size) + " bytes)\n";
+        return true;
+    }
+
+    // Fields that hold strings or objects keep the S prefix, so the collector still finds them
+    std::set<std::string> pointers;
+    std::stringstream offsets(pointer_map);
+    for (std::string offset; std::getline(offsets, offset, ';');) pointers.insert(offset);
+    auto field = [&object, &fields, &pointers](int offset) {
+        auto prefix = (fields.at(offset) == "b") ? "B" : pointers.contains(std::to_string(offset)) ? "S" : "W";
+        return prefix + object.substr(1) + "__f" + std::to_string(offset);
+    };
+
+    // Fields the constructor never assigns start at zero, at top level the constant moves to .data
+    std::vector<Quad> inlined;
+    for (auto &[offset, width]: fields)
+        if (!initialized.contains(offset))
+            inlined.push_back({.arg1 = width == "b" ? "false" : "0", .result = field(offset)});
+
+    // Arguments are replaced by the values passed, the constructor never writes them
+    std::unordered_map<std::string, std::string> values = {{function->args.front(), object}};
+    for (size_t k = 1; k < function->args.size(); k++)
+        values.emplace(function->args.at(k), quadruplets.at(alloc + 1 + k).arg1);
+
+    for (size_t i = function->begin + 1; i < function->end; i++) {
+        auto body = quadruplets.at(i);
+        if (body.op == "arg") continue;
+        for (auto name: {&body.arg1, &body.arg2, &body.result}) {
+            if (values.contains(*name)) *name = values.at(*name);
+            else if (isTemporary(*name)) *name = "t" + std::to_string(temporaryIndex(*name) + caller_temps);
+        }
+        inlined.push_back(body);
+    }
+
+    quadruplets.erase(quadruplets.begin() + alloc, quadruplets.begin() + call + 2);
+    quadruplets.insert(quadruplets.begin() + alloc, inlined.begin(), inlined.end());
+
+    std::vector<Quad> result;
+    for (size_t i = 0; i < quadruplets.size(); i++) {
+        auto &use = quadruplets.at(i);
+        if ((use.op == "push" || use.op == "pop") && use.arg1 == object) continue;
+
+        if (use.op == "+" && use.result == "i" && use.arg1 == object) {
+            auto &access = quadruplets.at(i + 1);
+            auto name = field(std::stoi(use.arg2));
+            for (auto value: {&access.arg1, &access.arg2, &access.result})
+                if (value->starts_with("i*")) *value = name;
+            continue;
+        }
+        result.push_back(use);
+    }
+    quadruplets = result;
+
+    report += "escape: " + object + " replaced by " + std::to_string(fields.size()) + " scalars\n";
+    return true;
+}
+
+void Optimizer::promoteObjects() {
+    int promoted = 0;
+    size_t i = 0;
+    while (i < quadruplets.size()) {
+        if (promoteObject(i)) {
+            promoted++;
+            i = 0;
+            continue;
+        }
+        i++;
+    }
+
+    report += "escape: " + std::to_string(promoted) + " heap allocations removed\n";
+}
+
+void Optimizer::allocateGlobals() {
+    auto runs_once = getRunsOnce();
+    auto functions = getFunctions();
+    int regions = 0, initialized = 0;
+
+    for (size_t a = 0; a < quadruplets.size(); a++) {
+        auto quad = quadruplets.at(a);
+        if (quad.op != "alloc" || !isTemporary(quad.result) || !isInteger(quad.arg1) || !runs_once.at(a)) continue;
+
+        // Created once, so a single region in .data is enough even if the object escapes
+        auto region = "S0__new" + std::to_string(region_count++);
+        std::vector<Quad> allocation = {
+            {.op = "alloc", .arg1 = quad.arg1, .arg2 = quad.arg2, .result = region}
+        };
+        size_t replaced = 1;
+
+        // The address is a label, so it doesn't need a temporary kept alive across the constructor call
+        for (size_t i = a + 1; i < quadruplets.size() && quadruplets.at(i).result != quad.result; i++) {
+            auto &use = quadruplets.at(i);
+            if (use.op == "tag" || use.op == "begin" || use.op == "end") break;
+            if (use.arg1 == quad.result) use.arg1 = region;
+            if (use.arg2 == quad.result) use.arg2 = region;
+        }
+
+        size_t call = a + 1;
+        while (call < quadruplets.size() && quadruplets.at(call).op == "param") call++;
+        auto function = std::find_if(functions.begin(), functions.end(), [&](const Function &function) {
+            return call < quadruplets.size() && quadruplets.at(call).op == "call" && function.name == quadruplets.at(call).arg1;
+        });
+
+        // Constructors that only store their arguments become constant stores the backend moves to .data
+        std::vector<Quad> stores;
+        bool constant = function != functions.end() && !function->nested &&
+            function->args.size() == call - a - 1 && quadruplets.at(a + 1).arg1 == region;
+        for (size_t i = constant ? function->begin + 1 : 0; constant && i < function->end; i++) {
+            auto body = quadruplets.at(i);
+            if (body.op == "arg") continue;
+
+            auto next = quadruplets.at(i + 1);
+            auto arg = std::find(function->args.begin(), function->args.end(), next.arg1);
+            constant = body.op == "+" && body.result == "i" && body.arg1 == function->args.front() &&
+                isInteger(body.arg2) && next.op.empty() && next.result.starts_with("i*");
+            if (!constant) break;
+
+            if (arg != function->args.end()) next.arg1 = quadruplets.at(a + 1 + (arg - function->args.begin())).arg1;
+            constant = isConstant(next.arg1) && !isStringLiteral(next.arg1);
+            stores.push_back({.op = "+", .arg1 = region, .arg2 = body.arg2, .result = "i"});
+            stores.push_back(next);
+            i++;
+        }
+
+        if (constant) {
+            allocation.insert(allocation.begin() + 1, stores.begin(), stores.end());
+            replaced = call - a + 1;
+            initialized++;
+        }
+
+        quadruplets.erase(quadruplets.begin() + a, quadruplets.begin() + a + replaced);
+        quadruplets.insert(quadruplets.begin() + a, allocation.begin(), allocation.end());
+        runs_once = getRunsOnce();
+        functions = getFunctions();
+        a += allocation.size() - 1;
+
+        report += "static: " + region + " (" + quad.arg1 + " bytes)" + (constant ? " initialized in .data" : "") + "\n";
+        regions++;
+    }
+
+    report += "static: " + std::to_string(regions) + " objects in .data, " +
+        std::to_string(initialized) + " constructors removed\n";
+}
+
+// In s = s + x the old string of s can take x at its end when no other name can see it change: s is never copied,
+// passed, returned or stored, only read by string operations and print
+void Optimizer::appendStrings() {
+    std::set<std::string> shared;
+    for (size_t i = 0; i < quadruplets.size(); i++) {
+        auto &quad = quadruplets.at(i);
+        if (quad.op == "arg" || quad.op == "pop") continue;
+        bool printed = quad.op.empty() && quad.result == "p" && i + 1 < quadruplets.size() &&
+            quadruplets.at(i + 1).op == "print";
+        bool consumed = quad.op == "concat" || quad.op == "streql" || quad.op == "strneq" || printed;
+        for (auto name: {quad.arg1, quad.arg2})
+            if (isVariable(name) && !consumed) shared.insert(name);
+    }
+
+    auto owners = getOwners();
+    std::unordered_map<std::string, std::vector<size_t>> regions;
+    for (size_t i = 0; i < quadruplets.size(); i++) regions[owners.at(i)].push_back(i);
+
+    int appended = 0;
+    for (auto &[name, indices]: regions) {
+        std::vector<Quad> body;
+        for (auto i: indices) body.push_back(quadruplets.at(i));
+        auto blocks = getBasicBlocks(body);
+        auto live_in = getLiveTemporaries(body, blocks);
+
+        for (auto &block: blocks) {
+            std::set<std::string> live_out;
+            for (auto next: block.successors)
+                live_out.insert(live_in.at(next).begin(), live_in.at(next).end());
+
+            // t0 = concat S0_s x followed by S0_s = t0, with t0 dead after the copy
+            for (size_t k = block.first; k < block.last; k++) {
+                auto &quad = body.at(k);
+                auto &copy = body.at(k + 1);
+                if (quad.op != "concat" || !isTemporary(quad.result) || !quad.arg1.starts_with("S") ||
+                    !isVariable(quad.arg1) || shared.contains(quad.arg1)) continue;
+                if (!copy.op.empty() || copy.arg1 != quad.result || copy.result != quad.arg1) continue;
+
+                std::optional<bool> dead;
+                for (size_t j = k + 2; j <= block.last && !dead; j++) {
+                    auto &use = body.at(j);
+                    if (use.arg1 == quad.result || use.arg2 == quad.result) dead = false;
+                    else if (use.result == quad.result) dead = true;
+                }
+                if (!dead.value_or(!live_out.contains(quad.result))) continue;
+
+                quadruplets.at(indices.at(k)).op = "append";
+                appended++;
+            }
+        }
+    }
+    report += "append: " + std::to_string(appended) + " string appends made in place\n";
+}
+
+// Strings built by concat or to_str that only feed other string routines or a print go back to the heap after their
+// last use. A string kept only in p moves to a temporary first, since the print clears p
+void Optimizer::freeTemporaryStrings() {
+    auto owners = getOwners();
+    std::unordered_map<std::string, std::vector<size_t>> regions;
+    int next_temp = 0;
+    for (size_t i = 0; i < quadruplets.size(); i++) {
+        auto &quad = quadruplets.at(i);
+        regions[owners.at(i)].push_back(i);
+        for (auto name: {quad.arg1, quad.arg2, quad.result}) next_temp = std::max(next_temp, temporaryIndex(name) + 1);
+    }
+
+    // Quads to insert after each position
+    std::map<size_t, std::vector<Quad>> inserts;
+    int released = 0;
+    for (auto &[name, indices]: regions) {
+        std::vector<Quad> body;
+        for (auto i: indices) body.push_back(quadruplets.at(i));
+        auto blocks = getBasicBlocks(body);
+        auto live_in = getLiveTemporaries(body, blocks);
+
+        for (auto &block: blocks) {
+            std::set<std::string> live_out;
+            for (auto next: block.successors)
+                live_out.insert(live_in.at(next).begin(), live_in.at(next).end());
+
+            for (size_t k = block.first; k <= block.last; k++) {
+                auto &quad = body.at(k);
+                if ((quad.op != "concat" && quad.op != "to_str") || (!isTemporary(quad.result) && quad.result != "p"))
+                    continue;
+
+                // Follow the names holding the string up to its last use, p only lasts until the print
+                std::set<std::string> names = {quad.result};
+                std::optional<size_t> last;
+                bool held = true;
+                bool escapes = false;
+                for (size_t j = k + 1; j <= block.last && !names.empty() && !escapes; j++) {
+                    auto &use = body.at(j);
+                    bool reads = names.contains(use.arg1) || names.contains(use.arg2) ||
+                        (use.op == "print" && names.contains("p"));
+                    if (reads) {
+                        bool consumed = use.op == "concat" || use.op == "append" || use.op == "streql" ||
+                            use.op == "strneq" || use.op == "print" || (use.op.empty() && use.result == "p");
+                        escapes = !consumed || names.contains(use.result);
+                        held = names.contains(quad.result);
+                        last = j;
+                        if (use.op.empty()) names.insert("p");
+                    }
+                    if (use.op == "print") names.erase("p");
+                    else if (!reads) names.erase(use.result);
+                }
+
+                bool live = std::any_of(names.begin(), names.end(), [&live_out](const std::string &held_by) {
+                    return live_out.contains(held_by);
+                });
+                if (escapes || !last || !held || live) continue;
+
+                auto temp = quad.result;
+                if (temp == "p") {
+                    temp = "t" + std::to_string(next_temp++);
+                    quadruplets.at(indices.at(k)).result = temp;
+                    inserts[indices.at(k)].push_back({.arg1 = temp, .result = "p"});
+                }
+                inserts[indices.at(*last)].push_back({.op = "free", .arg1 = temp});
+                released++;
+            }
+        }
+    }
+
+    std::vector<Quad> result;
+    for (size_t i = 0; i < quadruplets.size(); i++) {
+        result.push_back(quadruplets.at(i));
+        if (inserts.contains(i)) result.insert(result.end(), inserts.at(i).begin(), inserts.at(i).end());
+    }
+    quadruplets = result;
+    report += "free: " + std::to_string(released) + " temporary strings released\n";
+}
+
+// Ternaries and if/else statements whose arms only compute values and assign the same name run both arms
+// and keep one with movn. Arms that divide, add, subtract or touch memory keep their branches, as do arms with
+// more than cost_limit operations besides the final assignment, since both always run after the conversion.
+void Optimizer::convertBranches(int cost_limit) {
+    std::unordered_map<std::string, int> references;
+    int next_temp = 0;
+    for (auto &quad: quadruplets) {
+        if (quad.op == "goto" || quad.op.empty()) references[quad.arg1]++;
+        if (quad.op == "if" || quad.op == "ifnot") references[quad.arg2]++;
+        for (auto name: {quad.arg1, quad.arg2, quad.result}) next_temp = std::max(next_temp, temporaryIndex(name) + 1);
+    }
+
+    auto is_tag = [this](size_t k, const std::string &label) {
+        return k < quadruplets.size() && quadruplets.at(k).op == "tag" && quadruplets.at(k).arg1 == label;
+    };
+    auto is_value = [](const std::string &name) {
+        return isTemporary(name) || isVariable(name) || isConstant(name);
+    };
+    auto is_cheap = [&is_value](const Quad &quad) {
+        // add, addi and sub trap on overflow, so + and - only run under their original branch
+        bool op = quad.op.empty() || quad.op == "!" || (arithmetic_ops.contains(quad.op) && quad.op != "/" &&
+            quad.op != "%" && quad.op != "+" && quad.op != "-");
+        return op && is_value(quad.arg1) && (quad.arg2.empty() || is_value(quad.arg2)) &&
+            (isTemporary(quad.result) || isVariable(quad.result));
+    };
+    // Arm from first up to the first quad that isn't cheap, the last one must be the assignment
+    auto arm_end = [&](size_t first) {
+        size_t k = first;
+        while (k < quadruplets.size() && is_cheap(quadruplets.at(k))) k++;
+        for (size_t m = first; m + 1 < k; m++)
+            if (!isTemporary(quadruplets.at(m).result)) return first;
+        return (k > first && quadruplets.at(k - 1).op.empty()) ? k : first;
+    };
+
+    int converted = 0;
+    for (size_t i = quadruplets.size(); i-- > 0;) {
+        auto quad = quadruplets.at(i);
+        std::string false_label;
+        size_t first;
+        if (quad.op == "ifnot") {
+            false_label = quad.arg2;
+            first = i + 1;
+        } else if (quad.op == "if" && i + 2 < quadruplets.size() && quadruplets.at(i + 1).op == "goto" &&
+            is_tag(i + 2, quad.arg2) && references[quad.arg2] == 1) {
+            false_label = quadruplets.at(i + 1).arg1;
+            first = i + 3;
+        } else continue;
+        if (!is_value(quad.arg1) || references[false_label] != 1) continue;
+
+        auto then_end = arm_end(first);
+        if (then_end == first) continue;
+        auto target = quadruplets.at(then_end - 1).result;
+
+        // Without else the old value of the target is kept
+        size_t else_first = then_end, else_end = then_end, last = then_end;
+        if (then_end < quadruplets.size() && quadruplets.at(then_end).op == "goto" && is_tag(then_end + 1, false_label)) {
+            auto end_label = quadruplets.at(then_end).arg1;
+            else_first = then_end + 2;
+            else_end = arm_end(else_first);
+            last = else_end;
+            if (else_end == else_first || !is_tag(else_end, end_label) || references[end_label] != 1) continue;
+            if (quadruplets.at(else_end - 1).result != target) continue;
+        } else if (!is_tag(then_end, false_label) || isTemporary(target)) continue;
+
+        int cost = (then_end - first - 1) + ((else_end > else_first) ? else_end - else_first - 1 : 0);
+        if (cost > cost_limit) continue;
+
+        // Both arms reuse the statement's temporaries, so the ones they assign get new names
+        std::vector<Quad> result;
+        auto rename_arm = [&](size_t from, size_t to) {
+            std::unordered_map<std::string, std::string> names;
+            auto rename = [&names](std::string &name) { if (names.contains(name)) name = names.at(name); };
+            for (size_t k = from; k < to; k++) {
+                auto copy = quadruplets.at(k);
+                rename(copy.arg1);
+                rename(copy.arg2);
+                if (k + 1 == to) return copy.arg1;
+                names[copy.result] = "t" + std::to_string(next_temp++);
+                copy.result = names.at(copy.result);
+                result.push_back(copy);
+            }
+            return std::string();
+        };
+        auto then_value = rename_arm(first, then_end);
+        auto else_value = (else_end > else_first) ? rename_arm(else_first, else_end) : target;
+
+        auto selected = "t" + std::to_string(next_temp++);
+        result.push_back({.arg1 = else_value, .result = selected});
+        result.push_back({.op = "movn", .arg1 = then_value, .arg2 = quad.arg1, .result = selected});
+        result.push_back({.arg1 = selected, .result = target});
+
+        quadruplets.erase(quadruplets.begin() + i, quadruplets.begin() + last + 1);
+        quadruplets.insert(quadruplets.begin() + i, result.begin(), result.end());
+        converted++;
+    }
+
+    report += "ifconv: " + std::to_string(converted) + " branches converted to movn\n";
+}
+
+// Loops test their condition at the bottom with a guard at the entry, so each iteration runs one branch
+// instead of two. Jumps to a goto go straight to its target, an if over a goto becomes one ifnot, and jumps
+// to the next quad, code after an unconditional jump and unused labels are removed.
+void Optimizer::optimizeBranches(size_t header_limit) {
+    auto is_jump = [](const Quad &quad) { return quad.op == "goto" || quad.op == "if" || quad.op == "ifnot"; };
+    auto target = [](Quad &quad) -> std::string& { return (quad.op == "goto") ? quad.arg1 : quad.arg2; };
+    auto find_tag = [this](const std::string &label) {
+        return std::find_if(quadruplets.begin(), quadruplets.end(), [&label](const Quad &quad) {
+            return quad.op == "tag" && quad.arg1 == label;
+        }) - quadruplets.begin();
+    };
+    auto before = std::count_if(quadruplets.begin(), quadruplets.end(), is_jump);
+    int inverted = 0, rotated = 0, threaded = 0;
+
+    auto simplify = [&]() {
+        bool changed = true;
+        while (changed) {
+            changed = false;
+
+            // if C L1; goto L2; tag L1 -> ifnot C L2; tag L1
+            for (size_t i = 0; i + 2 < quadruplets.size(); i++) {
+                auto &quad = quadruplets.at(i);
+                auto &next = quadruplets.at(i + 1);
+                auto &tag = quadruplets.at(i + 2);
+                if ((quad.op != "if" && quad.op != "ifnot") || next.op != "goto" || tag.op != "tag" || tag.arg1 != quad.arg2) continue;
+                quad = {.op = (quad.op == "if") ? "ifnot" : "if", .arg1 = quad.arg1, .arg2 = next.arg1};
+                quadruplets.erase(quadruplets.begin() + i + 1);
+                inverted++;
+                changed = true;
+            }
+
+            // Jumps to a label followed by a goto take the last target of the chain, unless it is a cycle
+            std::unordered_map<std::string, size_t> labels;
+            for (size_t i = 0; i < quadruplets.size(); i++)
+                if (quadruplets.at(i).op == "tag") labels.emplace(quadruplets.at(i).arg1, i);
+            for (auto &quad: quadruplets) {
+                if (!is_jump(quad)) continue;
+                std::set<std::string> chain = {target(quad)};
+                auto label = target(quad);
+                bool cycle = false;
+                while (labels.contains(label) && !cycle) {
+                    size_t next = labels.at(label);
+                    while (next < quadruplets.size() && quadruplets.at(next).op == "tag") next++;
+                    if (next >= quadruplets.size() || quadruplets.at(next).op != "goto") break;
+                    label = quadruplets.at(next).arg1;
+                    cycle = !chain.insert(label).second;
+                }
+                if (cycle || label == target(quad)) continue;
+                target(quad) = label;
+                threaded++;
+                changed = true;
+            }
+
+            // Code after an unconditional jump runs only if a label follows. catch quads mark where try ranges
+            // start and end, so they stay even there
+            std::vector<Quad> result;
+            bool unreachable = false;
+            for (auto &quad: quadruplets) {
+                if (quad.op == "tag" || quad.op == "begin" || quad.op == "end") unreachable = false;
+                if (!unreachable || isCatch(quad)) result.push_back(quad);
+                if (quad.op == "goto" || quad.op == "return") unreachable = true;
+            }
+            changed |= result.size() != quadruplets.size();
+            quadruplets = result;
+            while (removeRedundantJumps(result)) {
+                quadruplets = result;
+                changed = true;
+            }
+        }
+    };
+    simplify();
+
+    // tag B; H; ifnot C E; body; goto B; tag E -> H; ifnot C E; tag B'; body; tag B; H; if C B'; tag E
+    for (size_t k = quadruplets.size(); k-- > 0;) {
+        if (quadruplets.at(k).op != "tag") continue;
+        auto begin = quadruplets.at(k).arg1;
+
+        size_t h = k + 1;
+        while (h < quadruplets.size() && h - k - 1 <= header_limit) {
+            auto &op = quadruplets.at(h).op;
+            if (is_jump(quadruplets.at(h)) || op == "tag" || op == "return" || op == "begin" || op == "end" || op == "iferr") break;
+            h++;
+        }
+        if (h >= quadruplets.size() || h - k - 1 > header_limit || quadruplets.at(h).op != "ifnot") continue;
+        auto condition = quadruplets.at(h);
+        if (integerValue(condition.arg1)) continue;
+
+        size_t end = find_tag(condition.arg2);
+        if (end >= quadruplets.size() || end <= h + 1) continue;
+        auto &back = quadruplets.at(end - 1);
+        if (back.op != "goto" || back.arg1 != begin) continue;
+
+        auto body = "l" + std::to_string(label_count++);
+        std::vector<Quad> bottom = {{.op = "tag", .arg1 = begin}};
+        bottom.insert(bottom.end(), quadruplets.begin() + k + 1, quadruplets.begin() + h);
+        bottom.push_back({.op = "if", .arg1 = condition.arg1, .arg2 = body});
+
+        quadruplets.erase(quadruplets.begin() + end - 1);
+        quadruplets.insert(quadruplets.begin() + end - 1, bottom.begin(), bottom.end());
+        quadruplets.insert(quadruplets.begin() + h + 1, {.op = "tag", .arg1 = body});
+        quadruplets.erase(quadruplets.begin() + k);
+        rotated++;
+    }
+    simplify();
+
+    auto after = std::count_if(quadruplets.begin(), quadruplets.end(), is_jump);
+    report += "branches: " + std::to_string(rotated) + " loops rotated, " + std::to_string(threaded) + " jumps threaded, " +
+        std::to_string(inverted) + " if/goto pairs merged, " + std::to_string(before) + " -> " + std::to_string(after) + " branches\n";
+}
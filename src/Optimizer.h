@@ -0,0 +1,92 @@
+#pragma once
+#include <unordered_map>
+#include <optional>
+#include <vector>
+#include <string>
+#include <set>
+
+#include "IRGenerator.h"
+
+namespace CompiScript {
+
+/*
+Subrutina del CI delimitada por los operadores begin y end.
+name - Etiqueta de la subrutina
+begin - Indice del cuadruplo begin
+end - Indice del cuadruplo end
+args - Variables recibidas con el operador arg, en orden
+nested - Indica si la subrutina contiene otras subrutinas (funciones anidadas o bloques catch)
+*/
+struct Function {
+    std::string name;
+    size_t begin = 0;
+    size_t end = 0;
+    std::vector<std::string> args;
+    bool nested = false;
+};
+
+/*
+Bloque basico dentro de una secuencia de cuadruplos.
+first, last - Indices del primer y ultimo cuadruplo del bloque
+successors - Indices de los bloques a los que puede saltar
+*/
+struct BasicBlock {
+    size_t first;
+    size_t last;
+    std::vector<size_t> successors;
+};
+
+/*
+Grafo de llamadas del CI. El codigo fuera de subrutinas se representa con el nodo "main".
+callees - Subrutinas invocadas desde cada nodo, por llamadas o como bloque catch
+*/
+struct CallGraph {
+    std::unordered_map<std::string, std::set<std::string>> callees;
+};
+
+class Optimizer {
+    private:
+    std::vector<Quad> quadruplets;
+    std::string report;
+    int label_count;
+    int clone_count;
+    int region_count;
+
+    std::vector<Function> getFunctions();
+    std::vector<BasicBlock> getBasicBlocks(const std::vector<Quad> &body);
+    std::vector<std::set<std::string>> getLiveTemporaries(const std::vector<Quad> &body,
+        const std::vector<BasicBlock> &blocks);
+
+    bool propagateConstants(std::vector<Quad> &body);
+    bool removeUnreachableCode(std::vector<Quad> &body);
+    bool removeDeadTemporaries(std::vector<Quad> &body);
+    bool removeRedundantJumps(std::vector<Quad> &body);
+    void foldConstants(std::vector<Quad> &body);
+
+    std::vector<std::string> getOwners();
+    std::vector<bool> getRunsOnce();
+    CallGraph getCallGraph();
+    std::set<std::string> getPureFunctions();
+    std::optional<std::string> evaluateCall(const std::vector<Function> &functions, const std::string &name,
+        const std::vector<std::string> &args, int &steps, int depth = 0);
+    bool argumentEscapes(const std::string &name, size_t index, std::set<std::string> &visiting);
+    bool promoteObject(size_t alloc);
+
+    public:
+    Optimizer(const std::vector<Quad> &quadruplets);
+
+    void specializeFunctions(int growth_limit = 25);
+    void evaluatePureCalls(int step_limit = 10000);
+    void removeDeadFunctions();
+    void promoteObjects();
+    void allocateGlobals();
+    void appendStrings();
+    void freeTemporaryStrings();
+    void convertBranches(int cost_limit = 4);
+    void optimizeBranches(size_t header_limit = 8);
+
+    const std::vector<Quad>& getQuadruplets();
+    std::string getReport();
+};
+
+}
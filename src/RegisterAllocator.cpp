@@ -0,0 +1,591 @@
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <stack>
+#include <tuple>
+
+#include "RegisterAllocator.h"
+
+using namespace CompiScript;
+
+const std::vector<std::string> RegisterAllocator::temporary_registers = {
+    "$t0", "$t1", "$t2", "$t3", "$t4", "$t5", "$t8", "$t9"
+};
+const std::vector<std::string> RegisterAllocator::saved_registers = {
+    "$s0", "$s1", "$s2", "$s3", "$s4", "$s5", "$s6", "$s7"
+};
+
+static bool isTemporary(const std::string &value) {
+    return value.size() > 1 && value.front() == 't' && std::all_of(value.begin() + 1, value.end(), ::isdigit);
+}
+
+static bool isVariable(const std::string &value) {
+    return value.size() > 2 &&
+        (value.front() == 'W' || value.front() == 'B' || value.front() == 'S') &&
+        std::isdigit(value.at(1)) && value.contains("_");
+}
+
+static bool isCall(const Quad &quad) {
+    return quad.op == "call";
+}
+
+static bool isCopy(const Quad &quad) {
+    return quad.op.empty() && !quad.arg1.starts_with("i*") && !quad.result.starts_with("i*");
+}
+
+RegisterAllocator::RegisterAllocator(const std::vector<Quad> &quadruplets, const std::set<std::string> &static_regions):
+    quadruplets(quadruplets),
+    static_regions(static_regions)
+{
+    // Arguments without an assignment have no label in .data, they only live in registers
+    for (auto &quad: quadruplets)
+        if (quad.op == "arg") arguments.insert(quad.arg1);
+    for (auto &quad: quadruplets)
+        arguments.erase(quad.result);
+
+    buildRegions();
+    for (size_t r = 0; r < regions.size(); r++)
+        buildIntervals(r);
+}
+
+// The address in i and the value of a switch live across several quads, err and case die in the next one
+bool RegisterAllocator::isAllocatable(const std::string &name) {
+    return isTemporary(name) || name == "i" || name == "switch" || (isVariable(name) && !static_regions.contains(name));
+}
+
+// Saved registers not reserved for promoted variables
+std::vector<std::string> RegisterAllocator::getSaved(const Region &region) {
+    auto registers = saved_registers;
+    for (auto &promotion: region.promoted) std::erase(registers, promotion.reg);
+    return registers;
+}
+
+bool RegisterAllocator::isMemory(const std::string &name) {
+    return isVariable(name) && !arguments.contains(name);
+}
+
+std::vector<std::string> RegisterAllocator::getUses(const Quad &quad) {
+    std::vector<std::string> names;
+    if (quad.op == "arg" || quad.op == "pop" || quad.op == "call" || quad.op == "goto" ||
+        quad.op == "tag" || quad.op == "iferr" || quad.op == "print")
+        return names;
+
+    names.push_back(quad.arg1);
+    // movn keeps the old value of its result when the condition is zero
+    if (quad.op == "movn") names.push_back(quad.result);
+    if (quad.op != "to_str" && quad.op != "param" && quad.op != "push" && quad.op != "return" &&
+        quad.op != "if" && quad.op != "ifnot" && quad.op != "alloc")
+        names.push_back(quad.arg2);
+    // Loads and stores through i*w or i*b read the address in i
+    if (quad.result.starts_with("i*")) names.push_back(quad.result);
+    for (auto &name: names) if (name.starts_with("i*")) name = "i";
+
+    std::erase_if(names, [this](const std::string &name) { return !isAllocatable(name); });
+    return names;
+}
+
+std::vector<std::string> RegisterAllocator::getDefs(const Quad &quad) {
+    auto name = (quad.op == "arg" || quad.op == "pop") ? quad.arg1 : quad.result;
+    if (!isAllocatable(name)) return {};
+    return {name};
+}
+
+void RegisterAllocator::buildRegions() {
+    regions.push_back({.name = "main"});
+    std::stack<size_t> open;
+    open.push(0);
+    for (size_t i = 0; i < quadruplets.size(); i++) {
+        auto &quad = quadruplets.at(i);
+        if (quad.op == "begin") {
+            regions.push_back({.name = quad.arg1});
+            open.push(regions.size() - 1);
+            continue;
+        }
+        if (quad.op == "end") {
+            if (open.size() > 1) open.pop();
+            continue;
+        }
+        regions.at(open.top()).quads.push_back(i);
+    }
+}
+
+void RegisterAllocator::buildIntervals(size_t r) {
+    auto &region = regions.at(r);
+    auto &positions = region.quads;
+    auto count = positions.size();
+    if (count == 0) return;
+
+    std::unordered_map<std::string, size_t> labels;
+    for (size_t k = 0; k < count; k++)
+        if (quadruplets.at(positions.at(k)).op == "tag") labels.emplace(quadruplets.at(positions.at(k)).arg1, k);
+
+    std::vector<std::vector<size_t>> successors(count);
+    std::vector<std::set<std::string>> use(count), def(count);
+    for (size_t k = 0; k < count; k++) {
+        auto &quad = quadruplets.at(positions.at(k));
+        if (quad.op == "goto" && labels.contains(quad.arg1)) successors.at(k).push_back(labels.at(quad.arg1));
+        if ((quad.op == "if" || quad.op == "ifnot") && labels.contains(quad.arg2)) successors.at(k).push_back(labels.at(quad.arg2));
+        if (quad.op != "goto" && quad.op != "return" && k + 1 < count) successors.at(k).push_back(k + 1);
+
+        for (auto &name: getUses(quad)) use.at(k).insert(name);
+        for (auto &name: getDefs(quad)) def.at(k).insert(name);
+    }
+
+    // Loop depth: every quad between a label and a branch back to it is inside one more loop
+    std::vector<int> depth(count, 0);
+    for (size_t k = 0; k < count; k++)
+        for (auto next: successors.at(k))
+            if (next <= k) for (size_t m = next; m <= k; m++) depth.at(m)++;
+
+    std::vector<std::set<std::string>> live_in(count), live_out(count);
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t k = count; k-- > 0;) {
+            std::set<std::string> out;
+            for (auto next: successors.at(k)) out.insert(live_in.at(next).begin(), live_in.at(next).end());
+
+            auto in = use.at(k);
+            for (auto &name: out) if (!def.at(k).contains(name)) in.insert(name);
+            if (in != live_in.at(k) || out != live_out.at(k)) {
+                live_in.at(k) = in;
+                live_out.at(k) = out;
+                changed = true;
+            }
+        }
+    }
+
+    // Variables assigned here are written back at calls, prints, checks and the epilogue, so from their last assignment
+    // up to those points their value must stay in their register
+    std::set<std::string> written;
+    for (auto &names: def)
+        for (auto &name: names) if (isMemory(name)) written.insert(name);
+    std::vector<std::set<std::string>> pending_in(count), pending_out(count);
+    changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t k = count; k-- > 0;) {
+            auto &quad = quadruplets.at(positions.at(k));
+            auto out = (successors.at(k).empty() && quad.op != "return") ? written : std::set<std::string>();
+            for (auto next: successors.at(k)) out.insert(pending_in.at(next).begin(), pending_in.at(next).end());
+
+            std::set<std::string> in;
+            if (isCall(quad) || quad.op == "print" || quad.op == "iferr" || quad.op == "return") in = written;
+            for (auto &name: out) if (!def.at(k).contains(name)) in.insert(name);
+            if (in != pending_in.at(k) || out != pending_out.at(k)) {
+                pending_in.at(k) = in;
+                pending_out.at(k) = out;
+                changed = true;
+            }
+        }
+    }
+
+    // Webs: a node is a value live into a quad (use) or assigned by it (def), joined along
+    // control flow edges. Variables are split at calls because they are reloaded from memory.
+    std::map<std::tuple<size_t, std::string, bool>, size_t> nodes;
+    std::vector<size_t> parent;
+    auto node = [&](size_t k, const std::string &name, bool is_def) {
+        auto key = std::make_tuple(k, name, is_def);
+        if (!nodes.contains(key)) {
+            nodes.emplace(key, parent.size());
+            parent.push_back(parent.size());
+        }
+        return nodes.at(key);
+    };
+    auto find = [&parent](size_t id) {
+        while (parent.at(id) != id) id = parent.at(id) = parent.at(parent.at(id));
+        return id;
+    };
+
+    for (size_t k = 0; k < count; k++) {
+        for (auto &name: live_in.at(k)) node(k, name, false);
+        for (auto &name: def.at(k)) node(k, name, true);
+    }
+    for (size_t k = 0; k < count; k++) {
+        // The value a movn keeps and the one it assigns must share a location
+        if (quadruplets.at(positions.at(k)).op == "movn")
+            for (auto &name: def.at(k)) parent.at(find(node(k, name, true))) = find(node(k, name, false));
+
+        bool call = isCall(quadruplets.at(positions.at(k)));
+        for (auto next: successors.at(k)) {
+            for (auto &name: live_in.at(next)) {
+                if (call && isMemory(name)) continue;
+                auto from = node(k, name, def.at(k).contains(name));
+                parent.at(find(from)) = find(node(next, name, false));
+            }
+        }
+    }
+
+    std::unordered_map<size_t, size_t> webs;
+    std::vector<std::vector<size_t>> live_webs(count);
+    std::vector<std::optional<size_t>> def_web(count);
+    std::vector<bool> varying, overwritten;
+    for (auto &[key, id]: nodes) {
+        auto &[k, name, is_def] = key;
+        auto root = find(id);
+        // Nodes come in program order, so the first one seen starts the interval
+        if (!webs.contains(root)) {
+            webs.emplace(root, region.intervals.size());
+            region.intervals.push_back({.name = name, .start = k, .end = k, .starts_with_def = is_def});
+            varying.push_back(isMemory(name));
+            overwritten.push_back(false);
+        }
+        auto &interval = region.intervals.at(webs.at(root));
+        if (k == interval.start && !is_def) interval.starts_with_def = false;
+        interval.end = std::max(interval.end, k);
+
+        auto &quad = quadruplets.at(positions.at(k));
+        bool live_after = !is_def && live_out.at(k).contains(name) && !def.at(k).contains(name);
+        if (live_after && isCall(quad) && !isMemory(name)) interval.crosses_call = true;
+        if (live_after && (quad.op == "to_str" || quad.op == "concat" || quad.op == "append" || quad.op == "streql" ||
+            quad.op == "strneq"))
+            interval.crosses_runtime = true;
+        if (!is_def && live_out.at(k).contains(name) && quad.op == "print") interval.crosses_print = true;
+        auto &pending = (is_def) ? pending_out.at(k) : pending_in.at(k);
+        interval.written_back.insert(pending.begin(), pending.end());
+
+        if (is_def || use.at(k).contains(name)) interval.weight += std::pow(10, depth.at(k));
+
+        // Arguments may stay in the register they arrive in until a param reuses it
+        if (quad.op == "param") overwritten.at(webs.at(root)) = true;
+        if (is_def && quad.op == "arg") {
+            size_t index = 0;
+            while (index < k && quadruplets.at(positions.at(k - index - 1)).op == "arg") index++;
+            if (index < 4) interval.incoming = "$a" + std::to_string(index);
+        }
+
+        // Values that only ever get the same constant can be loaded again instead of spilled
+        if (is_def) {
+            bool constant = isCopy(quad) && !isAllocatable(quad.arg1) && !quad.arg1.empty() &&
+                !(quad.arg1 == "i" || quad.arg1 == "err" || quad.arg1 == "ret" || quad.arg1 == "p" ||
+                  quad.arg1 == "catch" || quad.arg1 == "switch" || quad.arg1 == "case");
+            if (!constant || (!interval.constant.empty() && interval.constant != quad.arg1)) varying.at(webs.at(root)) = true;
+            else interval.constant = quad.arg1;
+        }
+
+        auto entry = std::make_pair(r, webs.at(root));
+        if (is_def) {
+            defs[positions.at(k)].insert_or_assign(name, entry);
+            def_web.at(k) = webs.at(root);
+        } else {
+            uses[positions.at(k)].insert_or_assign(name, entry);
+            live_webs.at(k).push_back(webs.at(root));
+        }
+    }
+    for (size_t i = 0; i < region.intervals.size(); i++) {
+        if (varying.at(i)) region.intervals.at(i).constant.clear();
+        if (overwritten.at(i)) region.intervals.at(i).incoming.clear();
+    }
+
+    // Values live at the same time interfere, except a value assigned by a quad and those that die in it
+    region.interference.resize(region.intervals.size());
+    auto interfere = [&region](size_t a, size_t b) {
+        if (a == b) return;
+        region.interference.at(a).insert(b);
+        region.interference.at(b).insert(a);
+    };
+    for (size_t k = 0; k < count; k++) {
+        for (auto a: live_webs.at(k))
+            for (auto b: live_webs.at(k)) interfere(a, b);
+        if (!def_web.at(k)) continue;
+
+        auto &quad = quadruplets.at(positions.at(k));
+        std::optional<size_t> source;
+        if (isCopy(quad) && uses.contains(positions.at(k)) && uses.at(positions.at(k)).contains(quad.arg1))
+            source = uses.at(positions.at(k)).at(quad.arg1).second;
+        if (source && *source != *def_web.at(k)) region.moves.push_back({*source, *def_web.at(k)});
+
+        for (auto next: successors.at(k))
+            for (auto b: live_webs.at(next))
+                if (b != source) interfere(*def_web.at(k), b);
+    }
+
+    for (auto &name: live_in.front())
+        if (isMemory(name)) region.entry_loads.push_back(name);
+
+    // A catch handler may also change variables, but only when a check fails, so those reloads go out of line
+    for (size_t k = 0; k + 1 < count; k++) {
+        if (!isCall(quadruplets.at(positions.at(k))) && quadruplets.at(positions.at(k)).op != "iferr") continue;
+        for (auto &name: live_in.at(k + 1))
+            if (isMemory(name)) call_reloads[positions.at(k)].push_back({name, positions.at(k + 1)});
+    }
+}
+
+void RegisterAllocator::linearScan(Region &region) {
+    auto &intervals = region.intervals;
+    std::vector<size_t> order(intervals.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&intervals](size_t a, size_t b) {
+        return intervals.at(a).start < intervals.at(b).start;
+    });
+
+    auto spill = [this, &region](Interval &interval) {
+        interval.location.reg.clear();
+        if (!isMemory(interval.name)) interval.location.slot = region.slots++;
+    };
+
+    std::vector<size_t> active;
+    std::set<std::string> busy;
+    for (auto current: order) {
+        auto &interval = intervals.at(current);
+
+        if (interval.promoted) continue;
+
+        // A register is free again once its last use is done, even at the quad that assigns the next value
+        std::erase_if(active, [&](size_t other) {
+            auto &expired = intervals.at(other);
+            bool done = expired.end < interval.start || (expired.end == interval.start && interval.starts_with_def);
+            if (done) busy.erase(expired.location.reg);
+            return done;
+        });
+
+        // Callees only preserve the $s registers, the same ones to_str and concat leave alone
+        std::vector<std::string> candidates = getSaved(region);
+        if (!interval.crosses_runtime && !interval.crosses_call)
+            candidates.insert(candidates.begin(), temporary_registers.begin(), temporary_registers.end());
+
+        auto free = std::find_if(candidates.begin(), candidates.end(), [&busy](const std::string &reg) {
+            return !busy.contains(reg);
+        });
+        if (free != candidates.end()) {
+            interval.location.reg = *free;
+            busy.insert(*free);
+            active.push_back(current);
+            continue;
+        }
+
+        // Spill whichever live value ends last
+        auto victim = active.end();
+        for (auto it = active.begin(); it != active.end(); it++) {
+            auto &other = intervals.at(*it);
+            if (std::find(candidates.begin(), candidates.end(), other.location.reg) == candidates.end()) continue;
+            if (other.end > interval.end && (victim == active.end() || other.end > intervals.at(*victim).end))
+                victim = it;
+        }
+        if (victim == active.end()) {
+            spill(interval);
+            continue;
+        }
+        interval.location.reg = intervals.at(*victim).location.reg;
+        spill(intervals.at(*victim));
+        *victim = current;
+    }
+}
+
+void RegisterAllocator::colorGraph(Region &region) {
+    auto &intervals = region.intervals;
+    auto size = intervals.size();
+
+    // Every value starts as its own node
+    std::vector<size_t> alias(size);
+    std::iota(alias.begin(), alias.end(), 0);
+    auto find = [&alias](size_t id) {
+        while (alias.at(id) != id) id = alias.at(id) = alias.at(alias.at(id));
+        return id;
+    };
+    auto adjacent = region.interference;
+    auto saved = getSaved(region);
+    auto colors = [&intervals, &saved](size_t id) {
+        auto &interval = intervals.at(id);
+        return (interval.crosses_runtime || interval.crosses_call) ? saved.size() : saved.size() + temporary_registers.size();
+    };
+
+    // Briggs coalescing: merge both ends of a copy when the merged node has fewer than K neighbors of significant degree
+    for (auto [from, to]: region.moves) {
+        auto a = find(from), b = find(to);
+        if (a == b || adjacent.at(a).contains(b)) continue;
+        if (intervals.at(a).promoted || intervals.at(b).promoted) continue;
+
+        auto limit = std::min(colors(a), colors(b));
+        std::set<size_t> neighbors = adjacent.at(a);
+        neighbors.insert(adjacent.at(b).begin(), adjacent.at(b).end());
+        size_t significant = std::count_if(neighbors.begin(), neighbors.end(), [&](size_t other) {
+            return adjacent.at(other).size() >= colors(other);
+        });
+        if (significant >= limit) continue;
+
+        alias.at(b) = a;
+        for (auto other: adjacent.at(b)) {
+            adjacent.at(other).erase(b);
+            adjacent.at(other).insert(a);
+            adjacent.at(a).insert(other);
+        }
+        adjacent.at(b).clear();
+        auto &merged = intervals.at(a);
+        merged.crosses_runtime = merged.crosses_runtime || intervals.at(b).crosses_runtime;
+        merged.crosses_call = merged.crosses_call || intervals.at(b).crosses_call;
+        merged.crosses_print = merged.crosses_print || intervals.at(b).crosses_print;
+        merged.written_back.insert(intervals.at(b).written_back.begin(), intervals.at(b).written_back.end());
+        merged.weight += intervals.at(b).weight;
+        if (merged.incoming != intervals.at(b).incoming) merged.incoming.clear();
+        if (merged.constant != intervals.at(b).constant) merged.constant.clear();
+        if (isMemory(intervals.at(b).name)) merged.constant.clear();
+    }
+
+    std::vector<size_t> nodes;
+    for (size_t id = 0; id < size; id++)
+        if (find(id) == id && !intervals.at(id).promoted) nodes.push_back(id);
+
+    // Simplify: remove nodes with fewer neighbors than colors, or the cheapest one to spill
+    std::vector<size_t> stack;
+    std::set<size_t> removed;
+    auto degree = [&](size_t id) {
+        return std::count_if(adjacent.at(id).begin(), adjacent.at(id).end(), [&](size_t other) {
+            return !removed.contains(other) && !intervals.at(other).promoted;
+        });
+    };
+    while (stack.size() < nodes.size()) {
+        std::optional<size_t> next;
+        for (auto id: nodes) {
+            if (removed.contains(id)) continue;
+            if (static_cast<size_t>(degree(id)) < colors(id)) {
+                next = id;
+                break;
+            }
+            auto cost = [&](size_t node) {
+                auto weight = intervals.at(node).weight;
+                if (!intervals.at(node).constant.empty()) weight /= 2;
+                return weight / (degree(node) + 1);
+            };
+            if (!next || cost(id) < cost(*next)) next = id;
+        }
+        stack.push_back(*next);
+        removed.insert(*next);
+    }
+
+    // Select: prefer the register of a copy partner so the move disappears
+    std::vector<std::string> assigned(size);
+    for (auto it = stack.rbegin(); it != stack.rend(); it++) {
+        auto id = *it;
+        auto partner = [&](size_t other) {
+            return (intervals.at(other).promoted) ? intervals.at(other).location.reg : assigned.at(other);
+        };
+        std::set<std::string> busy;
+        for (auto other: adjacent.at(id)) busy.insert(partner(other));
+
+        // A temporary copied to or from a promoted variable may borrow its register while nothing writes it back
+        auto &interval = intervals.at(id);
+        bool borrow = !isMemory(interval.name) && !interval.crosses_print && !interval.crosses_call;
+        auto copyable = [&](size_t other) {
+            return !intervals.at(other).promoted || (borrow && !interval.written_back.contains(intervals.at(other).name));
+        };
+        std::vector<std::string> candidates;
+        if (!interval.incoming.empty()) candidates.push_back(interval.incoming);
+        for (auto [from, to]: region.moves) {
+            auto a = find(from), b = find(to);
+            if (a == id && copyable(b) && !partner(b).empty()) candidates.push_back(partner(b));
+            if (b == id && copyable(a) && !partner(a).empty()) candidates.push_back(partner(a));
+        }
+        if (!interval.crosses_runtime && !interval.crosses_call)
+            candidates.insert(candidates.end(), temporary_registers.begin(), temporary_registers.end());
+        candidates.insert(candidates.end(), saved.begin(), saved.end());
+
+        for (auto &reg: candidates) {
+            if (busy.contains(reg)) continue;
+            if (intervals.at(id).crosses_runtime && reg.starts_with("$t")) continue;
+            if (intervals.at(id).crosses_call && !reg.starts_with("$s")) continue;
+            if (reg.starts_with("$a") && reg != intervals.at(id).incoming) continue;
+            assigned.at(id) = reg;
+            break;
+        }
+    }
+
+    std::unordered_map<size_t, int> slots;
+    for (size_t id = 0; id < size; id++) {
+        if (intervals.at(id).promoted) continue;
+        auto root = find(id);
+        auto &location = intervals.at(id).location;
+        location.reg = assigned.at(root);
+        if (!location.reg.empty() || isMemory(intervals.at(id).name)) continue;
+
+        // Constants are loaded again where they are used, other values go to the frame
+        if (!intervals.at(root).constant.empty()) location.constant = intervals.at(root).constant;
+        else {
+            if (!slots.contains(root)) slots.emplace(root, region.slots++);
+            location.slot = slots.at(root);
+        }
+    }
+}
+
+void RegisterAllocator::promoteGlobals(size_t count) {
+    for (auto &region: regions) {
+        // Hot variables: accessed inside a loop, or at least three times when nothing forces a write back
+        std::map<std::string, double> weights;
+        for (auto &interval: region.intervals)
+            if (isMemory(interval.name)) weights[interval.name] += interval.weight;
+
+        bool syncs = std::any_of(region.quads.begin(), region.quads.end(), [this](size_t position) {
+            return isCall(quadruplets.at(position)) || quadruplets.at(position).op == "print";
+        });
+        double threshold = (syncs) ? 10 : 3;
+        std::vector<std::pair<std::string, double>> candidates(weights.begin(), weights.end());
+        std::erase_if(candidates, [threshold](auto &candidate) { return candidate.second < threshold; });
+        std::stable_sort(candidates.begin(), candidates.end(), [](auto &a, auto &b) { return a.second > b.second; });
+        if (candidates.size() > count) candidates.resize(count);
+
+        for (size_t i = 0; i < candidates.size(); i++) {
+            auto &name = candidates.at(i).first;
+            Promotion promotion{.name = name, .reg = saved_registers.at(saved_registers.size() - 1 - i)};
+            for (auto position: region.quads)
+                if (defs.contains(position) && defs.at(position).contains(name)) promotion.written = true;
+
+            for (auto &interval: region.intervals) {
+                if (interval.name != name) continue;
+                interval.promoted = true;
+                interval.location.reg = promotion.reg;
+            }
+            region.promoted.push_back(promotion);
+
+            // Promoted variables are loaded at entry and after every call on their own
+            std::erase(region.entry_loads, name);
+            for (auto position: region.quads)
+                if (call_reloads.contains(position))
+                    std::erase_if(call_reloads.at(position), [&name](auto &reload) { return reload.first == name; });
+        }
+    }
+}
+
+void RegisterAllocator::allocateColoring() {
+    for (auto &region: regions)
+        colorGraph(region);
+}
+
+void RegisterAllocator::allocateLinear() {
+    for (auto &region: regions)
+        linearScan(region);
+}
+
+const std::vector<Region>& RegisterAllocator::getRegions() {
+    return regions;
+}
+
+const Region* RegisterAllocator::getRegion(const std::string &name) {
+    for (auto &region: regions)
+        if (region.name == name) return &region;
+    return nullptr;
+}
+
+const Location* RegisterAllocator::getUse(size_t position, const std::string &name) {
+    if (!uses.contains(position) || !uses.at(position).contains(name)) return nullptr;
+    auto [r, i] = uses.at(position).at(name);
+    return &regions.at(r).intervals.at(i).location;
+}
+
+const Location* RegisterAllocator::getDef(size_t position, const std::string &name) {
+    if (!defs.contains(position) || !defs.at(position).contains(name)) return nullptr;
+    auto [r, i] = defs.at(position).at(name);
+    return &regions.at(r).intervals.at(i).location;
+}
+
+std::vector<std::pair<std::string, std::string>> RegisterAllocator::getReloads(size_t position) {
+    std::vector<std::pair<std::string, std::string>> reloads;
+    if (!call_reloads.contains(position)) return reloads;
+
+    for (auto &[name, next]: call_reloads.at(position)) {
+        auto location = getUse(next, name);
+        if (location && !location->reg.empty()) reloads.push_back({name, location->reg});
+    }
+    return reloads;
+}
@@ -0,0 +1,132 @@
+#pragma once
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <map>
+#include <set>
+
+#include "IRGenerator.h"
+
+namespace CompiScript {
+
+/*
+Ubicacion de un valor durante su rango de vida.
+reg - Registro asignado, vacio si el valor vive en memoria
+slot - Posicion en el marco de la subrutina para valores sin registro ni etiqueta, -1 si no usa el marco
+constant - Constante o etiqueta que se vuelve a cargar en cada uso en lugar de derramar el valor
+*/
+struct Location {
+    std::string reg;
+    int slot = -1;
+    std::string constant;
+};
+
+/*
+Rango de vida de un valor (temporal o variable) dentro de una subrutina.
+name - Nombre del valor en el CI
+start, end - Primer y ultimo cuadruplo (en orden lineal) en que el valor esta vivo
+starts_with_def - El rango inicia con una asignacion y no con un uso
+crosses_call - El valor, sin etiqueta en .data, sigue vivo despues de una llamada, solo puede usar registros $s
+crosses_runtime - El valor sigue vivo despues de to_str, concat, streql o strneq, que usan los registros $t
+weight - Costo de derramar el valor, cada acceso pesa 10 elevado a la profundidad de ciclos
+constant - Constante que asignan todas sus definiciones, vacio si alguna no es constante
+incoming - Registro $a en que llega el argumento si ningun param lo sobrescribe mientras esta vivo
+crosses_print - El valor sigue vivo despues de un print, donde se escriben las variables promovidas
+promoted - La variable ocupa un registro $s reservado en toda la subrutina
+written_back - Variables de .data que una llamada, print, chequeo o el epilogo escriben de vuelta mientras el valor esta
+    vivo, su registro tiene que conservarlas
+*/
+struct Interval {
+    std::string name;
+    size_t start;
+    size_t end;
+    bool starts_with_def = false;
+    bool crosses_call = false;
+    bool crosses_runtime = false;
+    double weight = 0;
+    std::string constant;
+    std::string incoming;
+    bool crosses_print = false;
+    bool promoted = false;
+    Location location;
+    std::set<std::string> written_back;
+};
+
+/*
+Variable de .data que se mantiene en un registro durante una subrutina.
+name - Etiqueta de la variable
+reg - Registro $s reservado para ella
+written - La subrutina le asigna valores, asi que hay que escribirla de vuelta en memoria
+*/
+struct Promotion {
+    std::string name;
+    std::string reg;
+    bool written = false;
+};
+
+/*
+Codigo de una subrutina o del programa principal, sin las subrutinas anidadas.
+name - Etiqueta de la subrutina, "main" para el programa principal
+quads - Indices de los cuadruplos en orden
+intervals - Rangos de vida de los valores de la subrutina
+slots - Cantidad de palabras que necesita el marco
+entry_loads - Variables vivas al entrar que se cargan en su registro
+interference - Rangos de vida que no pueden compartir registro con cada rango
+moves - Pares de rangos unidos por una copia, candidatos a compartir registro
+promoted - Variables que viven en un registro $s en toda la subrutina y se escriben en memoria solo
+    en llamadas, print y salidas
+*/
+struct Region {
+    std::string name;
+    std::vector<size_t> quads;
+    std::vector<Interval> intervals;
+    int slots = 0;
+    std::vector<std::string> entry_loads;
+    std::vector<std::set<size_t>> interference;
+    std::vector<std::pair<size_t, size_t>> moves;
+    std::vector<Promotion> promoted;
+};
+
+class RegisterAllocator {
+    private:
+    std::vector<Quad> quadruplets;
+    std::set<std::string> static_regions;
+    std::set<std::string> arguments;
+    std::vector<Region> regions;
+
+    // Interval of each value used or assigned by a quad, indexed by quad position
+    std::unordered_map<size_t, std::map<std::string, std::pair<size_t, size_t>>> uses;
+    std::unordered_map<size_t, std::map<std::string, std::pair<size_t, size_t>>> defs;
+    // Variables reloaded after a call because the callee may overwrite every register
+    std::unordered_map<size_t, std::vector<std::pair<std::string, size_t>>> call_reloads;
+
+    bool isAllocatable(const std::string &name);
+    std::vector<std::string> getSaved(const Region &region);
+    std::vector<std::string> getUses(const Quad &quad);
+    std::vector<std::string> getDefs(const Quad &quad);
+
+    void buildRegions();
+    void buildIntervals(size_t r);
+    void linearScan(Region &region);
+    void colorGraph(Region &region);
+
+    public:
+    static const std::vector<std::string> temporary_registers;
+    static const std::vector<std::string> saved_registers;
+
+    RegisterAllocator(const std::vector<Quad> &quadruplets, const std::set<std::string> &static_regions);
+
+    void promoteGlobals(size_t count = 4);
+    void allocateLinear();
+    void allocateColoring();
+
+    bool isMemory(const std::string &name);
+
+    const std::vector<Region>& getRegions();
+    const Region* getRegion(const std::string &name);
+    const Location* getUse(size_t position, const std::string &name);
+    const Location* getDef(size_t position, const std::string &name);
+    std::vector<std::pair<std::string, std::string>> getReloads(size_t position);
+};
+
+}
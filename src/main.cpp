@@ -1,11 +1,15 @@
+#include <algorithm>
+#include <cctype>
 #include <fstream>
 #include <string>
+#include <vector>
 #include <print>
 
 #include "CompiScriptParser.h"
 #include "CompiScriptLexer.h"
 #include "SemanticChecker.h"
 #include "IRGenerator.h"
+#include "Optimizer.h"
 #include "Mips.h"
 
 int main (int argc, char** argv) {
@@ -40,18 +44,59 @@ int main (int argc, char** argv) {
     CompiScript::CompiScriptParser parser2(&tokens2);
     ir.visitProgram(parser2.program());
 
-    auto mips = CompiScript::Mips(ir.getQuadruplets());
+    std::vector<std::string> options(argv + 2, argv + argc);
+    auto has_option = [&options](const std::string &option) {
+        return std::find(options.begin(), options.end(), option) != options.end();
+    };
+
+    int opt_level = 0;
+    for (auto &option: options)
+        if (option.size() == 3 && option.starts_with("-O") && std::isdigit(option.at(2)))
+            opt_level = option.at(2) - '0';
+    // -Os runs the -O1 passes that do not grow the code
+    bool optimize_size = has_option("-Os");
+    if (optimize_size) opt_level = std::max(opt_level, 1);
+
+    auto allocation = (opt_level >= 2) ? CompiScript::COLORING : CompiScript::GREEDY;
+    if (has_option("-regalloc=greedy")) allocation = CompiScript::GREEDY;
+    if (has_option("-regalloc=linear")) allocation = CompiScript::LINEAR;
+    if (has_option("-regalloc=coloring")) allocation = CompiScript::COLORING;
+
+    auto quadruplets = ir.getQuadruplets();
+    if (opt_level > 0) {
+        auto optimizer = CompiScript::Optimizer(quadruplets);
+        optimizer.evaluatePureCalls();
+        if (!optimize_size) optimizer.specializeFunctions();
+        optimizer.promoteObjects();
+        optimizer.allocateGlobals();
+        optimizer.removeDeadFunctions();
+        optimizer.appendStrings();
+        // The greedy allocator keeps temporaries in $t registers, which the string routines overwrite
+        if (allocation != CompiScript::GREEDY) optimizer.freeTemporaryStrings();
+        optimizer.convertBranches();
+        // Rotated loops repeat their condition before the loop
+        optimizer.optimizeBranches(optimize_size ? 0 : 8);
+        quadruplets = optimizer.getQuadruplets();
+
+        if (has_option("-report"))
+            std::print("{}", optimizer.getReport());
+    }
+
+    bool promote_globals = opt_level >= 2 && allocation != CompiScript::GREEDY;
+    bool schedule = opt_level >= 2 || has_option("-schedule");
+    bool peephole = opt_level >= 1 || has_option("-peephole");
+    auto mips = CompiScript::Mips(quadruplets, allocation, promote_globals, schedule, has_option("-noreorder"), peephole,
+        optimize_size, has_option("-gc"));
     stream.close();
 
-    for (int i = 2; i < argc; i++) {
-        std::string option(argv[i]);
+    for (auto &option: options) {
         if (option == "-print-tables") {
             auto table = checker.getSymbolTable();
             table.printTables();
         }
         if (option == "-tac") {
             std::ofstream file("tac.ir", std::ofstream::out);
-            auto tac = ir.getTAC();
+            auto tac = CompiScript::getTAC(quadruplets);
             file << tac;
             file.close();
         }
@@ -60,6 +105,9 @@ int main (int argc, char** argv) {
             auto assembly = mips.generateAssembly();
             file << assembly;
             file.close();
+
+            if (has_option("-report"))
+                std::print("{}", mips.getReport());
         }
     }
 
@@ -3,6 +3,7 @@
 #include "SemanticChecker.h"
 #include "IRGenerator.h"
 #include "Mips.h"
+#include "Optimizer.h"
 
 #include "test.h"
 
@@ -33,7 +34,8 @@ std::string test_ir_gen(const std::string &stream) {
     return  ir.getTAC();
 }
 
-std::string test_mips_gen(const std::string &stream) {
+std::string test_mips_gen(const std::string &stream, CompiScript::RegisterAllocation allocation, bool promote_globals,
+    bool schedule, bool noreorder, bool garbage_collect) {
     CompiScript::SemanticChecker checker;
     auto input = antlr4::ANTLRInputStream(stream);
     CompiScript::CompiScriptLexer lexer(&input);
@@ -50,7 +52,28 @@ std::string test_mips_gen(const std::string &stream) {
     CompiScript::CompiScriptParser parser2(&tokens2);
     ir.visitProgram(parser2.program());
 
-    CompiScript::Mips asm_gen(ir.getQuadruplets());
+    CompiScript::Mips asm_gen(ir.getQuadruplets(), allocation, promote_globals, schedule, noreorder, false, false,
+        garbage_collect);
 
     return  asm_gen.generateAssembly();
 }
+
+CompiScript::Optimizer test_optimizer(const std::string &stream) {
+    CompiScript::SemanticChecker checker;
+    auto input = antlr4::ANTLRInputStream(stream);
+    CompiScript::CompiScriptLexer lexer(&input);
+    antlr4::CommonTokenStream tokens(&lexer);
+    CompiScript::CompiScriptParser parser(&tokens);
+    checker.visitProgram(parser.program());
+
+    auto table = checker.getSymbolTable();
+    auto ir = CompiScript::IRGenerator(&table);
+    
+    auto input2 = antlr4::ANTLRInputStream(stream);
+    CompiScript::CompiScriptLexer lexer2(&input2);
+    antlr4::CommonTokenStream tokens2(&lexer2);
+    CompiScript::CompiScriptParser parser2(&tokens2);
+    ir.visitProgram(parser2.program());
+
+    return CompiScript::Optimizer(ir.getQuadruplets());
+}
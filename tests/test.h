@@ -2,7 +2,11 @@
 
 #include "SemanticChecker.h"
 #include "IRGenerator.h"
+#include "Optimizer.h"
+#include "Mips.h"
 
 void test_stream(const std::string &stream, CompiScript::SemanticChecker *checker);
 std::string test_ir_gen(const std::string &stream);
-std::string test_mips_gen(const std::string &stream);
+std::string test_mips_gen(const std::string &stream, CompiScript::RegisterAllocation allocation = CompiScript::GREEDY, bool promote_globals = false,
+    bool schedule = false, bool noreorder = false, bool garbage_collect = false);
+CompiScript::Optimizer test_optimizer(const std::string &stream);
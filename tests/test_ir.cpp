@@ -199,7 +199,7 @@ print(perro.hablar());
         t0 = concat i*w " hace ruido." 
         return t0
         end F1_hablar
-        t0 = alloc 4 
+        t0 = alloc 4 0
         param t0  
         param "Firulais"
         call F1_constructor 
@@ -214,7 +214,7 @@ print(perro.hablar());
         t0 = concat i*w " ladra."
         return t0
         end F4_hablar
-        t0 = alloc 4 
+        t0 = alloc 4 0
         param t0  
         param "Firulais"
         call F1_constructor 
@@ -256,22 +256,24 @@ do {
         tag l0
         p = "Mayor a 10"
         print
+        goto l2
         tag l1
         p = "Menor o igual"
         print
         tag l2
+        tag l3
         t0 = < W0_x 5
-        ifnot t0 l3
+        ifnot t0 l4
         t0 = + W0_x 1
         W0_x = t0
-        goto l2
-        tag l3
+        goto l3
         tag l4
+        tag l5
         t0 = - W0_x 1
         W0_x = t0
         t0 = > W0_x 0
-        if t0 l4
-        tag l5
+        if t0 l5
+        tag l6
     )";
 
     expected.erase(remove(expected.begin(), expected.end(), ' '), expected.end());
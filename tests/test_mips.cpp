@@ -16,35 +16,29 @@ let y = !(x < 10 || x > 20);
 let z = (1 + 2) * 3;
                 )");
 
-    std::string expected = R"(.data 
-W0_x:       .word   0 
-B0_y:       .byte   0 
-W0_z:       .word   0 
-.text 
-main: 
-li $t0, 3 
-li $t1, 2 
-mult $t0, $t1 
-mflo $t2 
-li $t0, 5 
-add $t1, $t0, $t2 
-move $s0, $t1 
-sw $s0, W0_x 
-li $t0, 10 
-slt $t1, $s0, $t0 
-li $t0, 20 
-sgt $t2, $s0, $t0 
-or $t0, $t1, $t2 
-not $t3, $t0 
-move $s1, $t3 
-sb $s1, B0_y 
-li $t0, 1 
-li $t1, 2 
-add $t2, $t0, $t1 
-li $t0, 3 
-mult $t2, $t0 
-mflo $t1 
-move $s2, $t1 
+    std::string expected = R"(.data
+W0_x:		.word	0
+B0_y:		.byte	0
+W0_z:		.word	0
+.text
+main:
+li $t0, 3
+sll $t1, $t0, 1
+addi $t0, $t1, 5
+move $s0, $t0
+sw $s0, W0_x
+slti $t0, $s0, 10
+slti $t1, $s0, 21
+xori $t1, $t1, 1
+or $t2, $t0, $t1
+xori $t3, $t2, 1
+move $s1, $t3
+sb $s1, B0_y
+li $t0, 1
+addi $t1, $t0, 2
+sll $at, $t1, 1
+addu $t0, $at, $t1
+move $s2, $t0
 sw $s2, W0_z
 
 jr $ra
@@ -63,6 +57,81 @@ jr $ra
     REQUIRE(expected == generated_mips);
 }
 
+TEST_CASE("Division and modulo by constants asm generation", "[Operation asm]") {
+    auto generated_mips = test_mips_gen(R"(
+let x = 100;
+let q = x / 8;
+let r = x % 8;
+let d = x / 10;
+let m = x % 7;
+let n = x * 10;
+                )");
+
+    std::string expected = R"(.data
+W0_x:		.word	100
+W0_q:		.word	0
+W0_r:		.word	0
+W0_d:		.word	0
+W0_m:		.word	0
+W0_n:		.word	0
+.text
+main:
+lw $s0, W0_x
+sra $at, $s0, 31
+srl $at, $at, 29
+addu $at, $at, $s0
+sra $t0, $at, 3
+move $s1, $t0
+sw $s1, W0_q
+sra $at, $s0, 31
+srl $at, $at, 29
+addu $t0, $s0, $at
+andi $t0, $t0, 7
+subu $t0, $t0, $at
+move $s2, $t0
+sw $s2, W0_r
+li $at, 1717986919
+mult $s0, $at
+mfhi $at
+sra $at, $at, 2
+srl $t0, $at, 31
+addu $t0, $t0, $at
+move $s3, $t0
+sw $s3, W0_d
+li $at, -1840700269
+mult $s0, $at
+mfhi $at
+addu $at, $at, $s0
+sra $at, $at, 2
+srl $t0, $at, 31
+addu $t0, $t0, $at
+li $at, 7
+mul $at, $t0, $at
+subu $t0, $s0, $at
+move $s4, $t0
+sw $s4, W0_m
+sll $at, $s0, 3
+sll $t0, $s0, 1
+addu $t0, $at, $t0
+move $s5, $t0
+sw $s5, W0_n
+
+jr $ra
+
+)";
+
+    std::ofstream out("division_output.s", std::ofstream::out);
+    out << generated_mips;
+    out.close();
+
+    expected.erase(remove(expected.begin(), expected.end(), ' '), expected.end());
+    expected.erase(remove(expected.begin(), expected.end(), '\t'), expected.end());
+    generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), ' '), generated_mips.end());
+    generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), '\t'), generated_mips.end());
+
+    REQUIRE(expected == generated_mips);
+}
+
 TEST_CASE("Function asm generation", "[Function asm]") {
     auto generated_mips = test_mips_gen(R"(
 function saludar(nombre: string): string {
@@ -80,67 +149,192 @@ function crearContador(): integer {
                 )");
 
     std::string expected = R"(.data
+		.word	5
 str0:		.asciiz	"Hola "
+		.word	5
 str1:		.asciiz	"Mundo"
 S0_mensaje:		.word	0
+heap_next:		.word	0
+heap_left:		.word	0
+heap_large:		.word	0
+heap_free:		.space	132
 .text
+heap_alloc:
+# Bloque = palabra con su tamaño + contenido, redondeado a múltiplos de 8. Solo usa $v0, $v1 y $a0, y deja $v1 en cero si
+# la memoria es nueva
+addi $a0, $a0, 11
+srl $a0, $a0, 3
+sll $a0, $a0, 3
+slti $v1, $a0, 257
+beq $v1, $zero, heap_grande
+
+# Clases de 8 a 256 bytes, cada una con su lista de bloques libres
+srl $v1, $a0, 1
+la $v0, heap_free
+addu $v1, $v1, $v0
+lw $v0, 0($v1)
+beq $v0, $zero, heap_bump
+lw $a0, 4($v0)    # siguiente bloque libre, en la primera palabra del contenido
+sw $a0, 0($v1)
+addi $v0, $v0, 4    # retorno: dirección del contenido
+jr $ra
+
+heap_bump:
+# Sin bloques libres se toma el inicio de la región que queda
+lw $v1, heap_left
+subu $v1, $v1, $a0
+bltz $v1, heap_chunk
+sw $v1, heap_left
+lw $v0, heap_next
+sw $a0, 0($v0)
+addu $a0, $v0, $a0
+sw $a0, heap_next
+addi $v0, $v0, 4
+move $v1, $zero    # memoria nueva de sbrk, ya está en cero
+jr $ra
+
+heap_chunk:
+# Pedir 64 KB con sbrk, o el bloque completo si es mayor
+addi $sp, $sp, -8
+sw $t0, 0($sp)
+sw $t1, 4($sp)
+move $t0, $a0
+li $a0, 65536
+slt $t1, $a0, $t0
+movn $a0, $t0, $t1
+li $v0, 9
+syscall
+
+# Si la memoria nueva no sigue a la región actual, lo que quedaba se pierde
+lw $t1, heap_next
+lw $v1, heap_left
+addu $t1, $t1, $v1
+beq $t1, $v0, heap_contigua
+sw $v0, heap_next
+move $v1, $zero
+heap_contigua:
+addu $v1, $v1, $a0
+sw $v1, heap_left
+move $a0, $t0
+lw $t0, 0($sp)
+lw $t1, 4($sp)
+addi $sp, $sp, 8
+j heap_bump
+
+heap_grande:
+# Bloques mayores: el primero de la lista que alcance, sin dividirlo
+addi $sp, $sp, -4
+sw $t0, 0($sp)
+la $v1, heap_large    # dirección del enlace al bloque actual
+heap_buscar:
+lw $v0, 0($v1)
+beq $v0, $zero, heap_sin_bloque
+lw $t0, 0($v0)
+slt $t0, $t0, $a0
+beq $t0, $zero, heap_encontrado
+addi $v1, $v0, 4
+j heap_buscar
+heap_encontrado:
+lw $t0, 4($v0)
+sw $t0, 0($v1)
+lw $t0, 0($sp)
+addi $sp, $sp, 4
+addi $v0, $v0, 4
+jr $ra
+heap_sin_bloque:
+lw $t0, 0($sp)
+addi $sp, $sp, 4
+j heap_bump
+
 concat_strings:
-# Calcular longitud de cadena1
-    move $t0, $a0
-    li $t3, 0
-len1_loop:
-    lb $t1, 0($t0)
-    beq $t1, $zero, len1_done
-    addi $t3, $t3, 1
-    addi $t0, $t0, 1
-    j len1_loop
-len1_done:
-
-    # Calcular longitud de cadena2
-    move $t0, $a1
-    li $t4, 0
-len2_loop:
-    lb $t1, 0($t0)
-    beq $t1, $zero, len2_done
-    addi $t4, $t4, 1
-    addi $t0, $t0, 1
-    j len2_loop
-len2_done:
-
-    # Calcular tamaño total = len1 + len2 + 1 (para '\0')
-    add $t5, $t3, $t4
-    addi $t5, $t5, 1
-
-    move $t0, $a0      # puntero cadena1
-    # Reservar memoria con sbrk
-    li $v0, 9          # syscall sbrk
-    move $a0, $t5      # tamaño en bytes
-    syscall
-    move $t6, $v0      # guardar dirección base en $t6 (retorno)
-
-    # Copiar cadena1 al bloque
-    move $t2, $t6      # puntero destino
-copy1_loop:
-    lb $t1, 0($t0)
-    sb $t1, 0($t2)
-    beq $t1, $zero, copy2_start
-    addi $t0, $t0, 1
-    addi $t2, $t2, 1
-    j copy1_loop
-
-copy2_start:
-    move $t0, $a1      # puntero cadena2
-copy2_loop:
-    lb $t1, 0($t0)
-    sb $t1, 0($t2)
-    beq $t1, $zero, done
-    addi $t0, $t0, 1
-    addi $t2, $t2, 1
-    j copy2_loop
+# Las longitudes están en la palabra anterior a cada cadena
+lw $t3, -4($a0)
+lw $t4, -4($a1)
+
+# Reservar longitud + len1 + len2 + 1 (para '\0') en el heap. Solo se usan $t0 a $t6 y los registros que
+# heap_alloc ya modifica, el resto de los $t siguen siendo de quien llama
+move $t0, $a0    # puntero cadena1
+add $t5, $t3, $t4
+addi $a0, $t5, 5
+addi $sp, $sp, -4
+sw $ra, 0($sp)
+jal heap_alloc    # respeta los registros $t
+lw $ra, 0($sp)
+addi $sp, $sp, 4
+sw $t5, 0($v0)
+addi $t6, $v0, 4    # guardar dirección de los caracteres en $t6 (retorno)
+
+# Copiar cadena1 y después cadena2 con su '\0', $t0 origen, $t2 destino y $t5 bytes
+move $t2, $t6
+move $t5, $t3
+copy_alinear:
+beq $t5, $zero, copy_siguiente
+andi $t1, $t2, 3
+beq $t1, $zero, copy_palabras
+lbu $t1, 0($t0)
+sb $t1, 0($t2)
+addi $t0, $t0, 1
+addi $t2, $t2, 1
+addi $t5, $t5, -1
+j copy_alinear
+copy_palabras:
+# Con el destino alineado se escriben palabras completas
+slti $t1, $t5, 4
+bne $t1, $zero, copy_bytes
+andi $v0, $t0, 3
+subu $t0, $t0, $v0
+beq $v0, $zero, copy_alineadas
+
+# Origen desalineado: cada palabra se arma con el final de una palabra alineada y el inicio de la siguiente.
+# heap_alloc ya usó $a0 y $v1, así que quedan libres
+sll $v0, $v0, 3    # bits que sobran al inicio de la palabra
+subu $v1, $zero, $v0    # 32 - bits, sllv solo usa los 5 bits bajos
+lw $t1, 0($t0)
+copy_desalineadas:
+lw $a0, 4($t0)
+srlv $t1, $t1, $v0
+sllv $t3, $a0, $v1
+or $t1, $t1, $t3
+sw $t1, 0($t2)
+move $t1, $a0
+addi $t0, $t0, 4
+addi $t2, $t2, 4
+addi $t5, $t5, -4
+slti $t3, $t5, 4
+beq $t3, $zero, copy_desalineadas
+srl $v0, $v0, 3
+addu $t0, $t0, $v0
+j copy_bytes
+
+copy_alineadas:
+lw $t1, 0($t0)
+sw $t1, 0($t2)
+addi $t0, $t0, 4
+addi $t2, $t2, 4
+addi $t5, $t5, -4
+slti $t1, $t5, 4
+beq $t1, $zero, copy_alineadas
+
+copy_bytes:
+# Los últimos 0 a 3 bytes
+beq $t5, $zero, copy_siguiente
+lbu $t1, 0($t0)
+sb $t1, 0($t2)
+addi $t0, $t0, 1
+addi $t2, $t2, 1
+addi $t5, $t5, -1
+j copy_bytes
+
+copy_siguiente:
+bltz $t4, done    # cadena2 ya se copió
+move $t0, $a1    # puntero cadena2
+addi $t5, $t4, 1    # incluye el '\0'
+li $t4, -1
+j copy_alinear
 
 done:
-    move $v0, $t6      # retorno: dirección del bloque concatenado
-    jr $ra
+move $v0, $t6    # retorno: dirección del bloque concatenado
+jr $ra
 
 F2_siguiente:
 li $t0, 1
@@ -149,14 +343,16 @@ jr $ra
 
 F0_crearContador:
 addi $sp, -4
-sw $ra, ($sp)
+sw $ra, 0($sp)
 jal F2_siguiente
-lw $ra, ($sp)
-addi $sp, 4
 move $v0, $v0
+lw $ra, 0($sp)
+addi $sp, 4
 jr $ra
 
 F0_saludar:
+addi $sp, -4
+sw $ra, 0($sp)
 la $t0, str0
 addi $sp, -4
 sw $a0, ($sp)
@@ -164,29 +360,27 @@ addi $sp, -4
 sw $a1, ($sp)
 move $a0, $t0
 lw $a1, 4($sp)
-addi $sp, -4
-sw $ra, ($sp)
 jal concat_strings
-lw $ra, ($sp)
-addi $sp, 4
 lw $a1, ($sp)
 addi $sp, 4
 lw $a0, ($sp)
 addi $sp, 4
 move $t1, $v0
 move $v0, $t1
+lw $ra, 0($sp)
+addi $sp, 4
 jr $ra
 
 main:
+addi $sp, -4
+sw $ra, 0($sp)
 la $t0, str1
 move $a0, $t0
-addi $sp, -4
-sw $ra, ($sp)
 jal F0_saludar
-lw $ra, ($sp)
-addi $sp, 4
 move $s0, $v0
 sw $s0, S0_mensaje
+lw $ra, 0($sp)
+addi $sp, 4
 
 jr $ra
 
@@ -218,43 +412,42 @@ let fac = factorial(4);
 W0_fac:		.word	0
 .text
 F0_factorial:
-li $t0, 1
-sle $t1, $a0, $t0
-bne $zero, $t1, l0
+addi $sp, -4
+sw $ra, 0($sp)
+slti $t0, $a0, 2
+bne $zero, $t0, l0
 b l1
 l0:
-li $t0, 1
-move $v0, $t0
+li $t1, 1
+move $v0, $t1
+lw $ra, 0($sp)
+addi $sp, 4
 jr $ra
 
 l1:
-li $t0, 1
-sub $t1, $a0, $t0
+addi $t0, $a0, -1
 addi $sp, -4
 sw $a0, ($sp)
-move $a0, $t1
-addi $sp, -4
-sw $ra, ($sp)
+move $a0, $t0
 jal F0_factorial
-lw $ra, ($sp)
-addi $sp, 4
 lw $a0, ($sp)
 addi $sp, 4
-mult $a0, $v0
-mflo $t0
-move $v0, $t0
+mul $t1, $a0, $v0
+move $v0, $t1
+lw $ra, 0($sp)
+addi $sp, 4
 jr $ra
 
 main:
+addi $sp, -4
+sw $ra, 0($sp)
 li $t0, 4
 move $a0, $t0
-addi $sp, -4
-sw $ra, ($sp)
 jal F0_factorial
-lw $ra, ($sp)
-addi $sp, 4
 move $s0, $v0
 sw $s0, W0_fac
+lw $ra, 0($sp)
+addi $sp, 4
 
 jr $ra
 
@@ -272,213 +465,59 @@ jr $ra
     REQUIRE(expected == generated_mips);
 }
 
-TEST_CASE("Array asm generation", "[Array asm]") {
+TEST_CASE("Function with recursion linear scan asm generation", "[Function asm]") {
     auto generated_mips = test_mips_gen(R"(
-let lista = [1, 2, 3];
-print(lista[0]);
-let matriz = [[1, 2], [3, 4]];
-let num2 = matriz[0][1];
-                )");
+function factorial(n: integer): integer {
+  if (n <= 1) { return 1; }
+  return n * factorial(n - 1);
+}
+let fac = factorial(4);
+                )", CompiScript::LINEAR);
+
     std::string expected = R"(.data
-S0_lista:		.space	12
-err_bad_index_msg:     .asciiz "Out of bounds index was recieved"
-S0_matriz:		.space	16
-W0_num2:		.word	0
+W0_fac:		.word	0
 .text
-to_string: 
-# Guardar el número en $t0
-    move $t0, $a0
-
-    # Caso especial: si el número es 0
-    beq $t0, $zero, es_cero
-
-    # Calcular cantidad de dígitos
-    li $t1, 0              # contador de dígitos
-    move $t2, $t0
-contar_digitos:
-    beq $t2, $zero, reservar_memoria
-    li $t3, 10
-    div $t2, $t3
-    mflo $t2
-    addi $t1, $t1, 1
-    j contar_digitos
-
-es_cero:
-    li $t1, 1              # solo un dígito para '0'
-
-reservar_memoria:
-    addi $t1, $t1, 1       # +1 para '\0'
-    li $v0, 9              # syscall sbrk
-    move $a0, $t1          # tamaño en bytes
-    syscall
-    move $t3, $v0          # dirección base
-    addi $t4, $t3, 0       # puntero destino
-
-    # Si el número era 0, escribir '0' y terminar
-    beq $t0, $zero, escribir_cero
-
-    # Convertir número a ASCII (en orden inverso)
-    move $t2, $t0
-    add $t4, $t4, $t1     # puntero al final
-    addi $t4, $t4, -1      # retroceder para '\0'
-    sb $zero, 0($t4)       # escribir terminador
-    addi $t4, $t4, -1
-
-convertir_loop:
-    beq $t2, $zero, fin_conversion
-    li $t6, 10
-    div $t2, $t6
-    mfhi $t5               # resto
-    mflo $t2               # cociente
-    addi $t5, $t5, 48      # convertir a ASCII
-    sb $t5, 0($t4)
-    addi $t4, $t4, -1
-    j convertir_loop
-
-fin_conversion:
-    move $v0, $t3          # retorno: dirección base
-    jr $ra
-
-escribir_cero:
-    li $t5, 48             # '0'
-    sb $t5, 0($t3)
-    sb $zero, 1($t3)
-    move $v0, $t3
-    jr $ra
-
-main:
-la $s0, S0_lista
-li $t0, 0
-add $t8, $s0, $t0
-li $t0, 1
-sw $t0, ($t8)
-li $t0, 4
-add $t8, $s0, $t0
-li $t0, 2
-sw $t0, ($t8)
-li $t0, 8
-add $t8, $s0, $t0
-li $t0, 3
-sw $t0, ($t8)
-li $t0, 0
-move $t1, $t0
-li $t0, 3
-sge $t8, $t1, $t0
-beq $zero, $t8, no_err0
-beq $zero, $t9, err_bad_index
-la $t8, err_bad_index_msg
+F0_factorial:
 addi $sp, -4
-sw $ra, ($sp)
-la $ra, clean_err0
-jr $t9
-clean_err0:
-la $ra, ($sp)
+sw $ra, 0($sp)
+move $t0, $a0
+slti $t1, $t0, 2
+bne $zero, $t1, l0
+b l1
+l0:
+li $v0, 1
+lw $ra, 0($sp)
 addi $sp, 4
-no_err0:
-move $t8, $zero
-move $t9, $zero
-li $t0, 4
-mult $t1, $t0
-mflo $t1
-add $t8, $s0, $t1
-li $t0, 4
-addi $sp, -4
-sw $a0, ($sp)
-addi $sp, -4
-sw $a1, ($sp)
-lw $a0, ($t8)
-move $a1, $t0
+jr $ra
+
+l1:
+addi $t1, $t0, -1
 addi $sp, -4
-sw $ra, ($sp)
-jal to_string
-lw $ra, ($sp)
-addi $sp, 4
-lw $a1, ($sp)
-addi $sp, 4
-lw $a0, ($sp)
+sw $t0, ($sp)
+move $a0, $t1
+jal F0_factorial
+lw $t0, ($sp)
 addi $sp, 4
-move $v1, $v0
-addi $sp, -4
-sw $a0, ($sp)
-move $a0, $v1
-li $v0, 4
-syscall
-lw $a0, ($sp)
+mul $t0, $t0, $v0
+move $v0, $t0
+lw $ra, 0($sp)
 addi $sp, 4
-move $v0, $zero
-move $v1, $zero
-la $s1, S0_matriz
-li $t0, 0
-add $t8, $s1, $t0
-li $t0, 1
-sw $t0, ($t8)
-li $t0, 4
-add $t8, $s1, $t0
-li $t0, 2
-sw $t0, ($t8)
-li $t0, 8
-add $t8, $s1, $t0
-li $t0, 3
-sw $t0, ($t8)
-li $t0, 12
-add $t8, $s1, $t0
-li $t0, 4
-sw $t0, ($t8)
-li $t0, 0
-move $t1, $t0
-li $t0, 2
-sge $t8, $t1, $t0
-beq $zero, $t8, no_err1
-beq $zero, $t9, err_bad_index
-la $t8, err_bad_index_msg
-addi $sp, -4
-sw $ra, ($sp)
-la $ra, clean_err1
-jr $t9
-clean_err1:
-la $ra, ($sp)
-addi $sp, 4
-no_err1:
-move $t8, $zero
-move $t9, $zero
-li $t0, 2
-mult $t1, $t0
-mflo $t1
-li $t0, 4
-mult $t1, $t0
-mflo $t1
-add $t8, $s1, $t1
-li $t0, 1
-move $t1, $t0
-li $t0, 2
-sge $t8, $t1, $t0
-beq $zero, $t8, no_err2
-beq $zero, $t9, err_bad_index
-la $t8, err_bad_index_msg
+jr $ra
+
+main:
 addi $sp, -4
-sw $ra, ($sp)
-la $ra, clean_err2
-jr $t9
-clean_err2:
-la $ra, ($sp)
+sw $ra, 0($sp)
+li $a0, 4
+jal F0_factorial
+move $t0, $v0
+sw $t0, W0_fac
+lw $ra, 0($sp)
 addi $sp, 4
-no_err2:
-move $t8, $zero
-move $t9, $zero
-li $t0, 4
-mult $t1, $t0
-mflo $t1
-add $t8, $t8, $t1
-lw $s2, ($t8)
 
 jr $ra
 
 )";
 
-    std::ofstream out("array_output.s", std::ofstream::out);
-    out << generated_mips;
-    out.close();
-
     expected.erase(remove(expected.begin(), expected.end(), ' '), expected.end());
     expected.erase(remove(expected.begin(), expected.end(), '\t'), expected.end());
     generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), ' '), generated_mips.end());
@@ -487,177 +526,1485 @@ jr $ra
     REQUIRE(expected == generated_mips);
 }
 
-TEST_CASE("Class asm generation", "[Class asm]") {
+TEST_CASE("Function with recursion graph coloring asm generation", "[Function asm]") {
     auto generated_mips = test_mips_gen(R"(
-class Animal {
-  let nombre: string;
-
-  function constructor(nombre: string) {
-    this.nombre = nombre;
-  }
-
-  function hablar(): string {
-    return this.nombre + " hace ruido.";
-  }
-}
-
-let animal = new Animal("Firulais");
-print(animal.hablar());
-
-class Perro: Animal {
-    function hablar(): string {
-        return this.nombre + " ladra.";
-    }
+function factorial(n: integer): integer {
+  if (n <= 1) { return 1; }
+  return n * factorial(n - 1);
 }
-
-let perro = new Perro("Firulais");
-print(perro.hablar());
-                )");
+let fac = factorial(4);
+                )", CompiScript::COLORING);
 
     std::string expected = R"(.data
-str0:		.asciiz	" hace ruido."
-str1:		.asciiz	"Firulais"
-S0_animal:		.word	0
-str2:		.asciiz	" ladra."
-str3:		.asciiz	"Firulais"
-S0_perro:		.word	0
+W0_fac:		.word	0
 .text
-concat_strings:
-# Calcular longitud de cadena1
-    move $t0, $a0
-    li $t3, 0
-len1_loop:
-    lb $t1, 0($t0)
-    beq $t1, $zero, len1_done
-    addi $t3, $t3, 1
-    addi $t0, $t0, 1
-    j len1_loop
-len1_done:
-
-    # Calcular longitud de cadena2
-    move $t0, $a1
-    li $t4, 0
-len2_loop:
-    lb $t1, 0($t0)
-    beq $t1, $zero, len2_done
-    addi $t4, $t4, 1
-    addi $t0, $t0, 1
-    j len2_loop
-len2_done:
-
-    # Calcular tamaño total = len1 + len2 + 1 (para '\0')
-    add $t5, $t3, $t4
-    addi $t5, $t5, 1
-
-    move $t0, $a0      # puntero cadena1
-    # Reservar memoria con sbrk
-    li $v0, 9          # syscall sbrk
-    move $a0, $t5      # tamaño en bytes
-    syscall
-    move $t6, $v0      # guardar dirección base en $t6 (retorno)
-
-    # Copiar cadena1 al bloque
-    move $t2, $t6      # puntero destino
-copy1_loop:
-    lb $t1, 0($t0)
-    sb $t1, 0($t2)
-    beq $t1, $zero, copy2_start
-    addi $t0, $t0, 1
-    addi $t2, $t2, 1
-    j copy1_loop
-
-copy2_start:
-    move $t0, $a1      # puntero cadena2
-copy2_loop:
-    lb $t1, 0($t0)
-    sb $t1, 0($t2)
-    beq $t1, $zero, done
-    addi $t0, $t0, 1
-    addi $t2, $t2, 1
-    j copy2_loop
-
-done:
-    move $v0, $t6      # retorno: dirección del bloque concatenado
-    jr $ra
-
-F4_hablar:
-li $t0, 0
-add $t8, $a0, $t0
-la $t0, str2
-addi $sp, -4
-sw $a0, ($sp)
-addi $sp, -4
-sw $a1, ($sp)
-lw $a0, ($t8)
-move $a1, $t0
+F0_factorial:
 addi $sp, -4
-sw $ra, ($sp)
-jal concat_strings
-lw $ra, ($sp)
-addi $sp, 4
-lw $a1, ($sp)
-addi $sp, 4
-lw $a0, ($sp)
+sw $ra, 0($sp)
+slti $t0, $a0, 2
+bne $zero, $t0, l0
+b l1
+l0:
+li $v0, 1
+lw $ra, 0($sp)
 addi $sp, 4
-move $t1, $v0
-move $v0, $t1
 jr $ra
 
-F1_hablar:
-li $t0, 0
-add $t8, $a0, $t0
-la $t0, str0
+l1:
+addi $t0, $a0, -1
 addi $sp, -4
 sw $a0, ($sp)
-addi $sp, -4
-sw $a1, ($sp)
-lw $a0, ($t8)
-move $a1, $t0
-addi $sp, -4
-sw $ra, ($sp)
-jal concat_strings
-lw $ra, ($sp)
+move $a0, $t0
+jal F0_factorial
+lw $t0, ($sp)
 addi $sp, 4
-lw $a1, ($sp)
+mul $t0, $t0, $v0
+move $v0, $t0
+lw $ra, 0($sp)
 addi $sp, 4
-lw $a0, ($sp)
+jr $ra
+
+main:
+addi $sp, -4
+sw $ra, 0($sp)
+li $a0, 4
+jal F0_factorial
+move $t0, $v0
+sw $t0, W0_fac
+lw $ra, 0($sp)
 addi $sp, 4
-move $t1, $v0
-move $v0, $t1
+
 jr $ra
 
-F1_constructor:
-li $t0, 0
-add $t8, $a0, $t0
-sw $a1, ($t8)
+)";
+
+    expected.erase(remove(expected.begin(), expected.end(), ' '), expected.end());
+    expected.erase(remove(expected.begin(), expected.end(), '\t'), expected.end());
+    generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), ' '), generated_mips.end());
+    generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), '\t'), generated_mips.end());
+
+    REQUIRE(expected == generated_mips);
+}
+
+TEST_CASE("Function with more values than temporaries linear scan asm generation", "[Function asm]") {
+    auto generated_mips = test_mips_gen(R"(
+function escalar(x: integer): integer {
+  return x * 2 + (x * 3 + (x * 4 + (x * 5 + (x * 6 + (x * 7 + (x * 8 + (x * 9 + x * 10)))))));
+}
+let r = escalar(1);
+                )", CompiScript::LINEAR);
+
+    std::string expected = R"(.data
+W0_r:		.word	0
+.text
+F0_escalar:
+addi $sp, -4
+sw $s0, 0($sp)
+move $t0, $a0
+sll $t1, $t0, 1
+sll $at, $t0, 1
+addu $t2, $at, $t0
+sll $t3, $t0, 2
+sll $at, $t0, 2
+addu $t4, $at, $t0
+sll $at, $t0, 2
+sll $t5, $t0, 1
+addu $t5, $at, $t5
+sll $at, $t0, 3
+subu $t8, $at, $t0
+sll $t9, $t0, 3
+sll $at, $t0, 3
+addu $s0, $at, $t0
+sll $at, $t0, 3
+sll $t0, $t0, 1
+addu $t0, $at, $t0
+add $t0, $s0, $t0
+add $t0, $t9, $t0
+add $t0, $t8, $t0
+add $t0, $t5, $t0
+add $t0, $t4, $t0
+add $t0, $t3, $t0
+add $t0, $t2, $t0
+add $t0, $t1, $t0
+move $v0, $t0
+lw $s0, 0($sp)
+addi $sp, 4
 jr $ra
 
 main:
+addi $sp, -4
+sw $ra, 0($sp)
+li $a0, 1
+jal F0_escalar
+move $t0, $v0
+sw $t0, W0_r
+lw $ra, 0($sp)
+addi $sp, 4
+
+jr $ra
+
+)";
+
+    expected.erase(remove(expected.begin(), expected.end(), ' '), expected.end());
+    expected.erase(remove(expected.begin(), expected.end(), '\t'), expected.end());
+    generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), ' '), generated_mips.end());
+    generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), '\t'), generated_mips.end());
+
+    REQUIRE(expected == generated_mips);
+}
+
+TEST_CASE("Function with recursion scheduled with filled delay slots asm generation", "[Function asm]") {
+    auto generated_mips = test_mips_gen(R"(
+function factorial(n: integer): integer {
+  if (n <= 1) { return 1; }
+  return n * factorial(n - 1);
+}
+let fac = factorial(4);
+                )", CompiScript::COLORING, false, true, true);
+
+    std::string expected = R"(.data
+W0_fac:		.word	0
+.text
+.set noreorder
+F0_factorial:
+addi $sp, -4
+slti $t0, $a0, 2
+bne $zero, $t0, l0
+sw $ra, 0($sp)
+b l1_slot
+addi $t0, $a0, -1
+l0:
+li $v0, 1
+lw $ra, 0($sp)
+jr $ra
+addi $sp, 4
+
+l1:
+addi $t0, $a0, -1
+l1_slot:
+addi $sp, -4
+sw $a0, ($sp)
+jal F0_factorial
+move $a0, $t0
+lw $t0, ($sp)
+addi $sp, 4
+mul $t0, $t0, $v0
+lw $ra, 0($sp)
+addi $sp, 4
+jr $ra
+move $v0, $t0
+
+main:
+addi $sp, -4
+sw $ra, 0($sp)
+jal F0_factorial
+li $a0, 4
+move $t0, $v0
+sw $t0, W0_fac
+lw $ra, 0($sp)
+
+jr $ra
+addi $sp, 4
+
+)";
+
+    expected.erase(remove(expected.begin(), expected.end(), ' '), expected.end());
+    expected.erase(remove(expected.begin(), expected.end(), '\t'), expected.end());
+    generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), ' '), generated_mips.end());
+    generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), '\t'), generated_mips.end());
+
+    REQUIRE(expected == generated_mips);
+}
+
+TEST_CASE("Function with locals in the frame asm generation", "[Function asm]") {
+    auto generated_mips = test_mips_gen(R"(
+function doble(n: integer): integer {
+  let m: integer = n + n;
+  return m;
+}
+let d = doble(4);
+                )");
+
+    std::string expected = R"(.data
+W0_d:		.word	0
+.text
+F0_doble:
+addi $sp, -8
+sw $fp, ($sp)
+move $fp, $sp
+addi $sp, -4
+sw $s0, 0($sp)
+add $t0, $a0, $a0
+move $s0, $t0
+sw $s0, 4($fp)
+move $v0, $s0
+lw $s0, 0($sp)
+addi $sp, 4
+lw $fp, ($sp)
+addi $sp, 8
+jr $ra
+
+main:
+addi $sp, -4
+sw $ra, 0($sp)
+li $t0, 4
+move $a0, $t0
+jal F0_doble
+move $s1, $v0
+sw $s1, W0_d
+lw $ra, 0($sp)
+addi $sp, 4
+
+jr $ra
+
+)";
+
+    expected.erase(remove(expected.begin(), expected.end(), ' '), expected.end());
+    expected.erase(remove(expected.begin(), expected.end(), '\t'), expected.end());
+    generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), ' '), generated_mips.end());
+    generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), '\t'), generated_mips.end());
+
+    REQUIRE(expected == generated_mips);
+}
+
+TEST_CASE("Function with locals across recursive calls asm generation", "[Function asm]") {
+    auto generated_mips = test_mips_gen(R"(
+function sumar(n: integer): integer {
+  let total: integer = n;
+  if (n > 0) { total = total + sumar(n - 1); }
+  return total;
+}
+let s = sumar(10);
+                )");
+
+    std::string expected = R"(.data
+W0_s:		.word	0
+.text
+F0_sumar:
+addi $sp, -12
+sw $fp, ($sp)
+sw $ra, 8($sp)
+move $fp, $sp
+addi $sp, -4
+sw $s0, 0($sp)
+move $s0, $a0
+sw $s0, 4($fp)
+slti $t0, $a0, 1
+xori $t0, $t0, 1
+bne $zero, $t0, l0
+b l1
+l0:
+addi $t0, $a0, -1
+move $a0, $t0
+jal F0_sumar
+add $t1, $s0, $v0
+move $s0, $t1
+sw $s0, 4($fp)
+l1:
+move $v0, $s0
+lw $s0, 0($sp)
+addi $sp, 4
+lw $ra, 8($sp)
+lw $fp, ($sp)
+addi $sp, 12
+jr $ra
+
+main:
+addi $sp, -4
+sw $ra, 0($sp)
+li $t0, 10
+move $a0, $t0
+jal F0_sumar
+move $s1, $v0
+sw $s1, W0_s
+lw $ra, 0($sp)
+addi $sp, 4
+
+jr $ra
+
+)";
+
+    expected.erase(remove(expected.begin(), expected.end(), ' '), expected.end());
+    expected.erase(remove(expected.begin(), expected.end(), '\t'), expected.end());
+    generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), ' '), generated_mips.end());
+    generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), '\t'), generated_mips.end());
+
+    REQUIRE(expected == generated_mips);
+}
+
+TEST_CASE("Function with an assigned argument across a call asm generation", "[Function asm]") {
+    auto generated_mips = test_mips_gen(R"(
+function doble(x: integer): integer {
+  return x * 2;
+}
+function siguiente(n: integer): integer {
+  n = n + 1;
+  let r: integer = doble(2);
+  return n + r;
+}
+let s = siguiente(4);
+                )");
+
+    std::string expected = R"(.data
+W0_s:		.word	0
+.text
+F0_siguiente:
+addi $sp, -16
+sw $fp, ($sp)
+sw $ra, 12($sp)
+move $fp, $sp
+addi $sp, -4
+sw $s0, 0($sp)
+addi $t0, $a0, 1
+move $a0, $t0
+addi $sp, -4
+sw $a0, ($sp)
+li $t1, 2
+move $a0, $t1
+jal F0_doble
+lw $a0, ($sp)
+addi $sp, 4
+move $s0, $v0
+sw $s0, 8($fp)
+add $t0, $a0, $s0
+move $v0, $t0
+lw $s0, 0($sp)
+addi $sp, 4
+lw $ra, 12($sp)
+lw $fp, ($sp)
+addi $sp, 16
+jr $ra
+
+F0_doble:
+sll $t0, $a0, 1
+move $v0, $t0
+jr $ra
+
+main:
+addi $sp, -4
+sw $ra, 0($sp)
+li $t0, 4
+move $a0, $t0
+jal F0_siguiente
+move $s1, $v0
+sw $s1, W0_s
+lw $ra, 0($sp)
+addi $sp, 4
+
+jr $ra
+
+)";
+
+    expected.erase(remove(expected.begin(), expected.end(), ' '), expected.end());
+    expected.erase(remove(expected.begin(), expected.end(), '\t'), expected.end());
+    generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), ' '), generated_mips.end());
+    generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), '\t'), generated_mips.end());
+
+    REQUIRE(expected == generated_mips);
+}
+
+TEST_CASE("Function with stack arguments asm generation", "[Function asm]") {
+    auto generated_mips = test_mips_gen(R"(
+function calcular(a: integer, b: integer, c: integer, d: integer, e: integer, f: integer): integer {
+  return (a - b + c + d - e) * f;
+}
+let r = calcular(1, 2, 3, 4, 5, 6);
+                )");
+
+    std::string expected = R"(.data
+W0_r:		.word	0
+.text
+F0_calcular:
+addi $sp, -4
+sw $fp, ($sp)
+move $fp, $sp
+addi $sp, -8
+sw $s0, 0($sp)
+sw $s1, 4($sp)
+lw $s0, 8($fp)
+lw $s1, 4($fp)
+sub $t0, $a0, $a1
+add $t1, $t0, $a2
+add $t2, $t1, $a3
+sub $t3, $t2, $s0
+mul $t4, $t3, $s1
+move $v0, $t4
+lw $s0, 0($sp)
+lw $s1, 4($sp)
+addi $sp, 8
+lw $fp, ($sp)
+addi $sp, 4
+jr $ra
+
+main:
+addi $sp, -4
+sw $ra, 0($sp)
+li $t0, 1
+move $a0, $t0
+li $t1, 2
+move $a1, $t1
+li $t2, 3
+move $a2, $t2
+li $t3, 4
+move $a3, $t3
+li $t4, 5
+addi $sp, -4
+sw $t4, ($sp)
+li $t5, 6
+addi $sp, -4
+sw $t5, ($sp)
+jal F0_calcular
+addi $sp, 8
+move $s2, $v0
+sw $s2, W0_r
+lw $ra, 0($sp)
+addi $sp, 4
+
+jr $ra
+
+)";
+
+    expected.erase(remove(expected.begin(), expected.end(), ' '), expected.end());
+    expected.erase(remove(expected.begin(), expected.end(), '\t'), expected.end());
+    generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), ' '), generated_mips.end());
+    generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), '\t'), generated_mips.end());
+
+    REQUIRE(expected == generated_mips);
+}
+
+TEST_CASE("Loop with promoted globals asm generation", "[Loop asm]") {
+    auto generated_mips = test_mips_gen(R"(
+let x = 0;
+let total = 0;
+while (x < 10) {
+  total = total + x;
+  x = x + 1;
+}
+                )", CompiScript::COLORING, true);
+
+    std::string expected = R"(.data
+W0_x:		.word	0
+W0_total:		.word	0
+.text
+main:
+lw $s7, W0_x
+lw $s6, W0_total
+l0:
+slti $t0, $s7, 10
+beq $zero, $t0, l1
+add $s6, $s6, $s7
+addi $s7, $s7, 1
+b l0
+l1:
+sw $s7, W0_x
+sw $s6, W0_total
+
+jr $ra
+
+)";
+
+    expected.erase(remove(expected.begin(), expected.end(), ' '), expected.end());
+    expected.erase(remove(expected.begin(), expected.end(), '\t'), expected.end());
+    generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), ' '), generated_mips.end());
+    generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), '\t'), generated_mips.end());
+
+    REQUIRE(expected == generated_mips);
+}
+
+TEST_CASE("Promoted global written before a ternary asm generation", "[Loop asm]") {
+    auto generated_mips = test_mips_gen(R"(
+let x = 0;
+let total = 0;
+while (x < 10) {
+  total = total + x;
+  x = x + 1;
+}
+let y = x > 20 ? 5 : total;
+                )", CompiScript::COLORING, true);
+
+    std::string expected = R"(.data
+W0_x:		.word	0
+W0_total:		.word	0
+W0_y:		.word	0
+.text
+main:
+lw $s7, W0_x
+lw $s6, W0_total
+l0:
+slti $t0, $s7, 10
+beq $zero, $t0, l1
+add $s6, $s6, $s7
+addi $s7, $s7, 1
+b l0
+l1:
+slti $t0, $s7, 21
+xori $t0, $t0, 1
+beq $zero, $t0, l2
+li $t0, 5
+b l3
+l2:
+move $t0, $s6
+l3:
+sw $t0, W0_y
+sw $s7, W0_x
+sw $s6, W0_total
+
+jr $ra
+
+)";
+
+    expected.erase(remove(expected.begin(), expected.end(), ' '), expected.end());
+    expected.erase(remove(expected.begin(), expected.end(), '\t'), expected.end());
+    generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), ' '), generated_mips.end());
+    generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), '\t'), generated_mips.end());
+
+    REQUIRE(expected == generated_mips);
+}
+
+TEST_CASE("Array asm generation", "[Array asm]") {
+    auto generated_mips = test_mips_gen(R"(
+let lista = [1, 2, 3];
+print(lista[0]);
+let matriz = [[1, 2], [3, 4]];
+let num2 = matriz[0][1];
+                )");
+    std::string expected = R"(.data
+S0_lista:		.word	1, 2, 3
+		.word	32
+err_bad_index_msg:     .asciiz "Out of bounds index was recieved"
+to_string_digits:	.ascii	"00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899"
+S0_matriz:		.word	1, 2, 3, 4
+W0_num2:		.word	0
+heap_next:		.word	0
+heap_left:		.word	0
+heap_large:		.word	0
+heap_free:		.space	132
+.text
+to_string:
+# Convertir en un buffer en la pila, de derecha a izquierda y dos dígitos por división
+addi $sp, $sp, -16
+addi $t4, $sp, 15    # puntero al final del buffer
+sb $zero, 0($t4)    # escribir terminador
+move $t0, $a0
+bgez $t0, convertir
+subu $t0, $zero, $t0    # valor absoluto, -2147483648 también es correcto sin signo
+
+convertir:
+li $t6, 100
+la $t7, to_string_digits
+convertir_loop:
+divu $t0, $t6
+mfhi $t5    # resto, de 0 a 99
+mflo $t0    # cociente
+sll $t1, $t5, 1
+addu $t1, $t1, $t7    # par de dígitos en la tabla
+lbu $t2, 0($t1)
+lbu $t3, 1($t1)
+sb $t2, -2($t4)
+sb $t3, -1($t4)
+addi $t4, $t4, -2
+bne $t0, $zero, convertir_loop
+
+# Quitar el cero a la izquierda si el último resto era de un dígito
+slti $t1, $t5, 10
+addu $t4, $t4, $t1
+bgez $a0, reservar_memoria
+li $t1, 45    # '-'
+addi $t4, $t4, -1
+sb $t1, 0($t4)
+
+reservar_memoria:
+addi $t2, $sp, 15
+subu $t2, $t2, $t4    # longitud
+addi $a0, $t2, 8
+li $t1, -4
+and $a0, $a0, $t1    # longitud + caracteres y '\0' en palabras completas
+move $t6, $ra
+jal heap_alloc    # respeta los registros $t
+move $ra, $t6
+sw $t2, 0($v0)
+addi $v0, $v0, 4    # retorno: dirección del primer carácter
+addu $t7, $v0, $t2
+addi $t7, $t7, 1    # fin de la cadena con su '\0'
+
+# Copiar por palabras, cada una con el final de una palabra alineada del buffer y el inicio de la siguiente
+andi $t5, $t4, 3
+subu $t4, $t4, $t5
+sll $t5, $t5, 3    # bits que sobran al inicio de la palabra
+subu $t6, $zero, $t5    # 32 - bits, sllv solo usa los 5 bits bajos
+move $t3, $v0
+lw $t0, 0($t4)
+copiar_loop:
+lw $t1, 4($t4)
+srlv $t0, $t0, $t5
+sllv $t2, $t1, $t6
+movz $t2, $zero, $t5    # con el buffer alineado la palabra ya está completa
+or $t0, $t0, $t2
+sw $t0, 0($t3)
+move $t0, $t1
+addi $t4, $t4, 4
+addi $t3, $t3, 4
+sltu $t2, $t3, $t7
+bne $t2, $zero, copiar_loop
+
+addi $sp, $sp, 16
+jr $ra
+
+heap_alloc:
+# Bloque = palabra con su tamaño + contenido, redondeado a múltiplos de 8. Solo usa $v0, $v1 y $a0, y deja $v1 en cero si
+# la memoria es nueva
+addi $a0, $a0, 11
+srl $a0, $a0, 3
+sll $a0, $a0, 3
+slti $v1, $a0, 257
+beq $v1, $zero, heap_grande
+
+# Clases de 8 a 256 bytes, cada una con su lista de bloques libres
+srl $v1, $a0, 1
+la $v0, heap_free
+addu $v1, $v1, $v0
+lw $v0, 0($v1)
+beq $v0, $zero, heap_bump
+lw $a0, 4($v0)    # siguiente bloque libre, en la primera palabra del contenido
+sw $a0, 0($v1)
+addi $v0, $v0, 4    # retorno: dirección del contenido
+jr $ra
+
+heap_bump:
+# Sin bloques libres se toma el inicio de la región que queda
+lw $v1, heap_left
+subu $v1, $v1, $a0
+bltz $v1, heap_chunk
+sw $v1, heap_left
+lw $v0, heap_next
+sw $a0, 0($v0)
+addu $a0, $v0, $a0
+sw $a0, heap_next
+addi $v0, $v0, 4
+move $v1, $zero    # memoria nueva de sbrk, ya está en cero
+jr $ra
+
+heap_chunk:
+# Pedir 64 KB con sbrk, o el bloque completo si es mayor
+addi $sp, $sp, -8
+sw $t0, 0($sp)
+sw $t1, 4($sp)
+move $t0, $a0
+li $a0, 65536
+slt $t1, $a0, $t0
+movn $a0, $t0, $t1
+li $v0, 9
+syscall
+
+# Si la memoria nueva no sigue a la región actual, lo que quedaba se pierde
+lw $t1, heap_next
+lw $v1, heap_left
+addu $t1, $t1, $v1
+beq $t1, $v0, heap_contigua
+sw $v0, heap_next
+move $v1, $zero
+heap_contigua:
+addu $v1, $v1, $a0
+sw $v1, heap_left
+move $a0, $t0
+lw $t0, 0($sp)
+lw $t1, 4($sp)
+addi $sp, $sp, 8
+j heap_bump
+
+heap_grande:
+# Bloques mayores: el primero de la lista que alcance, sin dividirlo
+addi $sp, $sp, -4
+sw $t0, 0($sp)
+la $v1, heap_large    # dirección del enlace al bloque actual
+heap_buscar:
+lw $v0, 0($v1)
+beq $v0, $zero, heap_sin_bloque
+lw $t0, 0($v0)
+slt $t0, $t0, $a0
+beq $t0, $zero, heap_encontrado
+addi $v1, $v0, 4
+j heap_buscar
+heap_encontrado:
+lw $t0, 4($v0)
+sw $t0, 0($v1)
+lw $t0, 0($sp)
+addi $sp, $sp, 4
+addi $v0, $v0, 4
+jr $ra
+heap_sin_bloque:
+lw $t0, 0($sp)
+addi $sp, $sp, 4
+j heap_bump
+
+err_bad_index:
+li $v0, 4
+la $a0, err_bad_index_msg
+syscall
+li $v0, 10
+syscall
+main:
+addi $sp, -4
+sw $ra, 0($sp)
+move $t0, $zero
+slti $t9, $t0, 3
+beq $zero, $t9, err_bad_index
+sll $t0, $t0, 2
+la $s0, S0_lista
+add $t8, $s0, $t0
+li $t1, 4
+addi $sp, -4
+sw $a0, ($sp)
+addi $sp, -4
+sw $a1, ($sp)
+lw $a0, ($t8)
+move $a1, $t1
+jal to_string
+lw $a1, ($sp)
+addi $sp, 4
+lw $a0, ($sp)
+addi $sp, 4
+move $v1, $v0
+addi $sp, -4
+sw $a0, ($sp)
+move $a0, $v1
+li $v0, 4
+syscall
+lw $a0, ($sp)
+addi $sp, 4
+move $v0, $zero
+move $v1, $zero
+move $t0, $zero
+slti $t9, $t0, 2
+beq $zero, $t9, err_bad_index
+sll $t0, $t0, 1
+sll $t0, $t0, 2
+la $s1, S0_matriz
+add $t8, $s1, $t0
+li $t0, 1
+move $t1, $t0
+slti $t9, $t1, 2
+beq $zero, $t9, err_bad_index
+sll $t1, $t1, 2
+add $t8, $t8, $t1
+lw $s2, ($t8)
+lw $ra, 0($sp)
+addi $sp, 4
+
+jr $ra
+
+)";
+
+    std::ofstream out("array_output.s", std::ofstream::out);
+    out << generated_mips;
+    out.close();
+
+    expected.erase(remove(expected.begin(), expected.end(), ' '), expected.end());
+    expected.erase(remove(expected.begin(), expected.end(), '\t'), expected.end());
+    generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), ' '), generated_mips.end());
+    generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), '\t'), generated_mips.end());
+
+    REQUIRE(expected == generated_mips);
+}
+
+TEST_CASE("Try-Catch asm generation", "[Error asm]") {
+    auto generated_mips = test_mips_gen(R"(
+let lista = [1, 2, 3, 4];
+try {
+  let peligro = lista[100];
+} catch (err) {
+  print("Error atrapado: " + err);
+}
+                )");
+    std::string expected = R"(.data
+S0_lista:		.word	1, 2, 3, 4
+		.word	32
+err_bad_index_msg:     .asciiz "Out of bounds index was recieved"
+W1_peligro:		.word	0
+S0_err:		.word	0
+		.word	16
+str0:		.asciiz	"Error atrapado: "
+heap_next:		.word	0
+heap_left:		.word	0
+heap_large:		.word	0
+heap_free:		.space	132
+err_table:		.word	try0, try0_end, l0, 0
+err_handler:		.word	0
+.text
+heap_alloc:
+# Bloque = palabra con su tamaño + contenido, redondeado a múltiplos de 8. Solo usa $v0, $v1 y $a0, y deja $v1 en cero si
+# la memoria es nueva
+addi $a0, $a0, 11
+srl $a0, $a0, 3
+sll $a0, $a0, 3
+slti $v1, $a0, 257
+beq $v1, $zero, heap_grande
+
+# Clases de 8 a 256 bytes, cada una con su lista de bloques libres
+srl $v1, $a0, 1
+la $v0, heap_free
+addu $v1, $v1, $v0
+lw $v0, 0($v1)
+beq $v0, $zero, heap_bump
+lw $a0, 4($v0)    # siguiente bloque libre, en la primera palabra del contenido
+sw $a0, 0($v1)
+addi $v0, $v0, 4    # retorno: dirección del contenido
+jr $ra
+
+heap_bump:
+# Sin bloques libres se toma el inicio de la región que queda
+lw $v1, heap_left
+subu $v1, $v1, $a0
+bltz $v1, heap_chunk
+sw $v1, heap_left
+lw $v0, heap_next
+sw $a0, 0($v0)
+addu $a0, $v0, $a0
+sw $a0, heap_next
+addi $v0, $v0, 4
+move $v1, $zero    # memoria nueva de sbrk, ya está en cero
+jr $ra
+
+heap_chunk:
+# Pedir 64 KB con sbrk, o el bloque completo si es mayor
+addi $sp, $sp, -8
+sw $t0, 0($sp)
+sw $t1, 4($sp)
+move $t0, $a0
+li $a0, 65536
+slt $t1, $a0, $t0
+movn $a0, $t0, $t1
+li $v0, 9
+syscall
+
+# Si la memoria nueva no sigue a la región actual, lo que quedaba se pierde
+lw $t1, heap_next
+lw $v1, heap_left
+addu $t1, $t1, $v1
+beq $t1, $v0, heap_contigua
+sw $v0, heap_next
+move $v1, $zero
+heap_contigua:
+addu $v1, $v1, $a0
+sw $v1, heap_left
+move $a0, $t0
+lw $t0, 0($sp)
+lw $t1, 4($sp)
+addi $sp, $sp, 8
+j heap_bump
+
+heap_grande:
+# Bloques mayores: el primero de la lista que alcance, sin dividirlo
+addi $sp, $sp, -4
+sw $t0, 0($sp)
+la $v1, heap_large    # dirección del enlace al bloque actual
+heap_buscar:
+lw $v0, 0($v1)
+beq $v0, $zero, heap_sin_bloque
+lw $t0, 0($v0)
+slt $t0, $t0, $a0
+beq $t0, $zero, heap_encontrado
+addi $v1, $v0, 4
+j heap_buscar
+heap_encontrado:
+lw $t0, 4($v0)
+sw $t0, 0($v1)
+lw $t0, 0($sp)
+addi $sp, $sp, 4
+addi $v0, $v0, 4
+jr $ra
+heap_sin_bloque:
+lw $t0, 0($sp)
+addi $sp, $sp, 4
+j heap_bump
+
+concat_strings:
+# Las longitudes están en la palabra anterior a cada cadena
+lw $t3, -4($a0)
+lw $t4, -4($a1)
+
+# Reservar longitud + len1 + len2 + 1 (para '\0') en el heap. Solo se usan $t0 a $t6 y los registros que
+# heap_alloc ya modifica, el resto de los $t siguen siendo de quien llama
+move $t0, $a0    # puntero cadena1
+add $t5, $t3, $t4
+addi $a0, $t5, 5
+addi $sp, $sp, -4
+sw $ra, 0($sp)
+jal heap_alloc    # respeta los registros $t
+lw $ra, 0($sp)
+addi $sp, $sp, 4
+sw $t5, 0($v0)
+addi $t6, $v0, 4    # guardar dirección de los caracteres en $t6 (retorno)
+
+# Copiar cadena1 y después cadena2 con su '\0', $t0 origen, $t2 destino y $t5 bytes
+move $t2, $t6
+move $t5, $t3
+copy_alinear:
+beq $t5, $zero, copy_siguiente
+andi $t1, $t2, 3
+beq $t1, $zero, copy_palabras
+lbu $t1, 0($t0)
+sb $t1, 0($t2)
+addi $t0, $t0, 1
+addi $t2, $t2, 1
+addi $t5, $t5, -1
+j copy_alinear
+copy_palabras:
+# Con el destino alineado se escriben palabras completas
+slti $t1, $t5, 4
+bne $t1, $zero, copy_bytes
+andi $v0, $t0, 3
+subu $t0, $t0, $v0
+beq $v0, $zero, copy_alineadas
+
+# Origen desalineado: cada palabra se arma con el final de una palabra alineada y el inicio de la siguiente.
+# heap_alloc ya usó $a0 y $v1, así que quedan libres
+sll $v0, $v0, 3    # bits que sobran al inicio de la palabra
+subu $v1, $zero, $v0    # 32 - bits, sllv solo usa los 5 bits bajos
+lw $t1, 0($t0)
+copy_desalineadas:
+lw $a0, 4($t0)
+srlv $t1, $t1, $v0
+sllv $t3, $a0, $v1
+or $t1, $t1, $t3
+sw $t1, 0($t2)
+move $t1, $a0
+addi $t0, $t0, 4
+addi $t2, $t2, 4
+addi $t5, $t5, -4
+slti $t3, $t5, 4
+beq $t3, $zero, copy_desalineadas
+srl $v0, $v0, 3
+addu $t0, $t0, $v0
+j copy_bytes
+
+copy_alineadas:
+lw $t1, 0($t0)
+sw $t1, 0($t2)
+addi $t0, $t0, 4
+addi $t2, $t2, 4
+addi $t5, $t5, -4
+slti $t1, $t5, 4
+beq $t1, $zero, copy_alineadas
+
+copy_bytes:
+# Los últimos 0 a 3 bytes
+beq $t5, $zero, copy_siguiente
+lbu $t1, 0($t0)
+sb $t1, 0($t2)
+addi $t0, $t0, 1
+addi $t2, $t2, 1
+addi $t5, $t5, -1
+j copy_bytes
+
+copy_siguiente:
+bltz $t4, done    # cadena2 ya se copió
+move $t0, $a1    # puntero cadena2
+addi $t5, $t4, 1    # incluye el '\0'
+li $t4, -1
+j copy_alinear
+
+done:
+move $v0, $t6    # retorno: dirección del bloque concatenado
+jr $ra
+
+err_bad_index:
+li $v0, 4
+la $a0, err_bad_index_msg
+syscall
+li $v0, 10
+syscall
+err_bad_index_throw:
+# 0($sp): direccion despues del chequeo que fallo, la deja ahi el stub
+# Guardar los registros que el manejador puede modificar y el manejador de la llamada actual
+addi $sp, $sp, -72
+sw $t0, 0($sp)
+sw $t1, 4($sp)
+sw $t2, 8($sp)
+sw $t3, 12($sp)
+sw $t4, 16($sp)
+sw $t5, 20($sp)
+sw $t6, 24($sp)
+sw $t7, 28($sp)
+sw $a0, 32($sp)
+sw $a1, 36($sp)
+sw $a2, 40($sp)
+sw $a3, 44($sp)
+sw $v0, 48($sp)
+sw $v1, 52($sp)
+sw $ra, 56($sp)
+sw $t8, 60($sp)
+lw $t0, err_handler
+sw $t0, 64($sp)
+sw $t9, 68($sp)
+lw $t9, 72($sp)
+
+# Buscar el primer rango con inicio < $t9 <= fin, los internos se cierran antes y van primero en la tabla
+la $t0, err_table
+move $t1, $zero
+buscar_rango:
+lw $t2, 0($t0)    # inicio, 0 al final de la tabla
+beq $t2, $zero, fin_busqueda
+sltu $t3, $t2, $t9
+beq $t3, $zero, siguiente_rango
+lw $t2, 4($t0)    # fin
+sltu $t3, $t2, $t9
+bne $t3, $zero, siguiente_rango
+lw $t1, 8($t0)    # manejador
+j fin_busqueda
+siguiente_rango:
+addi $t0, $t0, 12
+j buscar_rango
+
+fin_busqueda:
+# Fuera de todo rango el chequeo está en una función llamada dentro de un try, y se usa el manejador que
+# dejó la llamada. Mientras corre, sus propios errores ya no vuelven a él
+bne $t1, $zero, llamar_manejador
+lw $t1, 64($sp)
+sw $zero, err_handler
+# Sin manejador se usa el de por defecto, que termina el programa
+beq $t1, $zero, err_bad_index
+llamar_manejador:
+la $v0, err_bad_index_msg
+jalr $t1
+
+lw $t0, 64($sp)
+sw $t0, err_handler
+lw $t0, 0($sp)
+lw $t1, 4($sp)
+lw $t2, 8($sp)
+lw $t3, 12($sp)
+lw $t4, 16($sp)
+lw $t5, 20($sp)
+lw $t6, 24($sp)
+lw $t7, 28($sp)
+lw $a0, 32($sp)
+lw $a1, 36($sp)
+lw $a2, 40($sp)
+lw $a3, 44($sp)
+lw $v0, 48($sp)
+lw $v1, 52($sp)
+lw $ra, 56($sp)
+lw $t8, 60($sp)
+lw $t9, 68($sp)
+addi $sp, $sp, 72
+jr $ra
+
+err_bad_index_stub0:
+addi $sp, $sp, -4
+sw $ra, 0($sp)
+jal err_bad_index_throw
+lw $at, 0($sp)
+lw $ra, 4($sp)
+addi $sp, $sp, 8
+jr $at
+
+err_throw0:
+addi $sp, $sp, -4
+sw $ra, 0($sp)
+la $ra, err_resume0
+b err_bad_index_stub0
+
+l0:
+addi $sp, -4
+sw $ra, 0($sp)
+addi $sp, -4
+sw $s2, 0($sp)
+move $s2, $v0
+sw $s2, S0_err
+la $t0, str0
+addi $sp, -4
+sw $a0, ($sp)
+addi $sp, -4
+sw $a1, ($sp)
+move $a0, $t0
+move $a1, $s2
+jal concat_strings
+lw $a1, ($sp)
+addi $sp, 4
+lw $a0, ($sp)
+addi $sp, 4
+move $t1, $v0
+move $v1, $t1
+addi $sp, -4
+sw $a0, ($sp)
+move $a0, $v1
+li $v0, 4
+syscall
+lw $a0, ($sp)
+addi $sp, 4
+move $v0, $zero
+move $v1, $zero
+lw $s2, 0($sp)
+addi $sp, 4
+lw $ra, 0($sp)
+addi $sp, 4
+jr $ra
+
+main:
+addi $sp, -4
+sw $ra, 0($sp)
+try0:
+li $t0, 100
+move $t1, $t0
+slti $t9, $t1, 4
+beq $zero, $t9, err_throw0
+err_resume0:
+sll $t1, $t1, 2
+la $s0, S0_lista
+add $t8, $s0, $t1
+lw $s1, ($t8)
+try0_end:
+lw $ra, 0($sp)
+addi $sp, 4
+
+jr $ra
+
+)";
+
+    expected.erase(remove(expected.begin(), expected.end(), ' '), expected.end());
+    expected.erase(remove(expected.begin(), expected.end(), '\t'), expected.end());
+    generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), ' '), generated_mips.end());
+    generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), '\t'), generated_mips.end());
+
+    REQUIRE(expected == generated_mips);
+}
+
+TEST_CASE("Identical functions with try blocks kept by folding", "[Error asm]") {
+    auto optimizer = test_optimizer(R"(
+function primero(k: integer): integer {
+  try {
+    return k;
+  } catch (err) {
+    print("fallo");
+  }
+  return 0;
+}
+function segundo(k: integer): integer {
+  try {
+    return k;
+  } catch (err) {
+    print("fallo");
+  }
+  return 0;
+}
+print(primero(5) + segundo(6));
+                )");
+    CompiScript::Mips asm_gen(optimizer.getQuadruplets(), CompiScript::GREEDY, false, false, false, false, true);
+    auto assembly = asm_gen.generateAssembly();
+
+    // err_table names the try labels of both functions, so neither can be folded into the other
+    REQUIRE(asm_gen.getReport().find("fold: 0 identical functions folded\n") != std::string::npos);
+    REQUIRE(assembly.find("err_table:\t\t.word\ttry0, try0_end, l0, try1, try1_end, l1, 0\n") != std::string::npos);
+    REQUIRE(assembly.find("try1:") != std::string::npos);
+    REQUIRE(assembly.find("try1_end:") != std::string::npos);
+}
+
+TEST_CASE("Class asm generation", "[Class asm]") {
+    auto generated_mips = test_mips_gen(R"(
+class Animal {
+  let nombre: string;
+
+  function constructor(nombre: string) {
+    this.nombre = nombre;
+  }
+
+  function hablar(): string {
+    return this.nombre + " hace ruido.";
+  }
+}
+
+let animal = new Animal("Firulais");
+print(animal.hablar());
+
+class Perro: Animal {
+    function hablar(): string {
+        return this.nombre + " ladra.";
+    }
+}
+
+let perro = new Perro("Firulais");
+print(perro.hablar());
+                )");
+
+    std::string expected = R"(.data
+		.word	12
+str0:		.asciiz	" hace ruido."
+		.word	8
+str1:		.asciiz	"Firulais"
+S0_animal:		.word	0
+		.word	7
+str2:		.asciiz	" ladra."
+S0_perro:		.word	0
+heap_next:		.word	0
+heap_left:		.word	0
+heap_large:		.word	0
+heap_free:		.space	132
+.text
+heap_calloc:
+# Objetos y arreglos empiezan en cero, solo hace falta limpiar los bloques reutilizados
+addi $sp, $sp, -4
+sw $ra, 0($sp)
+jal heap_alloc
+lw $ra, 0($sp)
+addi $sp, $sp, 4
+beq $v1, $zero, heap_limpio
+lw $a0, -4($v0)
+addu $a0, $a0, $v0
+addi $a0, $a0, -4    # fin del bloque
+move $v1, $v0
+heap_limpiar:
+sw $zero, 0($v1)
+addi $v1, $v1, 4
+bne $v1, $a0, heap_limpiar
+heap_limpio:
+jr $ra
+
+heap_alloc:
+# Bloque = palabra con su tamaño + contenido, redondeado a múltiplos de 8. Solo usa $v0, $v1 y $a0, y deja $v1 en cero si
+# la memoria es nueva
+addi $a0, $a0, 11
+srl $a0, $a0, 3
+sll $a0, $a0, 3
+slti $v1, $a0, 257
+beq $v1, $zero, heap_grande
+
+# Clases de 8 a 256 bytes, cada una con su lista de bloques libres
+srl $v1, $a0, 1
+la $v0, heap_free
+addu $v1, $v1, $v0
+lw $v0, 0($v1)
+beq $v0, $zero, heap_bump
+lw $a0, 4($v0)    # siguiente bloque libre, en la primera palabra del contenido
+sw $a0, 0($v1)
+addi $v0, $v0, 4    # retorno: dirección del contenido
+jr $ra
+
+heap_bump:
+# Sin bloques libres se toma el inicio de la región que queda
+lw $v1, heap_left
+subu $v1, $v1, $a0
+bltz $v1, heap_chunk
+sw $v1, heap_left
+lw $v0, heap_next
+sw $a0, 0($v0)
+addu $a0, $v0, $a0
+sw $a0, heap_next
+addi $v0, $v0, 4
+move $v1, $zero    # memoria nueva de sbrk, ya está en cero
+jr $ra
+
+heap_chunk:
+# Pedir 64 KB con sbrk, o el bloque completo si es mayor
+addi $sp, $sp, -8
+sw $t0, 0($sp)
+sw $t1, 4($sp)
+move $t0, $a0
+li $a0, 65536
+slt $t1, $a0, $t0
+movn $a0, $t0, $t1
+li $v0, 9
+syscall
+
+# Si la memoria nueva no sigue a la región actual, lo que quedaba se pierde
+lw $t1, heap_next
+lw $v1, heap_left
+addu $t1, $t1, $v1
+beq $t1, $v0, heap_contigua
+sw $v0, heap_next
+move $v1, $zero
+heap_contigua:
+addu $v1, $v1, $a0
+sw $v1, heap_left
+move $a0, $t0
+lw $t0, 0($sp)
+lw $t1, 4($sp)
+addi $sp, $sp, 8
+j heap_bump
+
+heap_grande:
+# Bloques mayores: el primero de la lista que alcance, sin dividirlo
+addi $sp, $sp, -4
+sw $t0, 0($sp)
+la $v1, heap_large    # dirección del enlace al bloque actual
+heap_buscar:
+lw $v0, 0($v1)
+beq $v0, $zero, heap_sin_bloque
+lw $t0, 0($v0)
+slt $t0, $t0, $a0
+beq $t0, $zero, heap_encontrado
+addi $v1, $v0, 4
+j heap_buscar
+heap_encontrado:
+lw $t0, 4($v0)
+sw $t0, 0($v1)
+lw $t0, 0($sp)
+addi $sp, $sp, 4
+addi $v0, $v0, 4
+jr $ra
+heap_sin_bloque:
+lw $t0, 0($sp)
+addi $sp, $sp, 4
+j heap_bump
+
+concat_strings:
+# Las longitudes están en la palabra anterior a cada cadena
+lw $t3, -4($a0)
+lw $t4, -4($a1)
+
+# Reservar longitud + len1 + len2 + 1 (para '\0') en el heap. Solo se usan $t0 a $t6 y los registros que
+# heap_alloc ya modifica, el resto de los $t siguen siendo de quien llama
+move $t0, $a0    # puntero cadena1
+add $t5, $t3, $t4
+addi $a0, $t5, 5
+addi $sp, $sp, -4
+sw $ra, 0($sp)
+jal heap_alloc    # respeta los registros $t
+lw $ra, 0($sp)
+addi $sp, $sp, 4
+sw $t5, 0($v0)
+addi $t6, $v0, 4    # guardar dirección de los caracteres en $t6 (retorno)
+
+# Copiar cadena1 y después cadena2 con su '\0', $t0 origen, $t2 destino y $t5 bytes
+move $t2, $t6
+move $t5, $t3
+copy_alinear:
+beq $t5, $zero, copy_siguiente
+andi $t1, $t2, 3
+beq $t1, $zero, copy_palabras
+lbu $t1, 0($t0)
+sb $t1, 0($t2)
+addi $t0, $t0, 1
+addi $t2, $t2, 1
+addi $t5, $t5, -1
+j copy_alinear
+copy_palabras:
+# Con el destino alineado se escriben palabras completas
+slti $t1, $t5, 4
+bne $t1, $zero, copy_bytes
+andi $v0, $t0, 3
+subu $t0, $t0, $v0
+beq $v0, $zero, copy_alineadas
+
+# Origen desalineado: cada palabra se arma con el final de una palabra alineada y el inicio de la siguiente.
+# heap_alloc ya usó $a0 y $v1, así que quedan libres
+sll $v0, $v0, 3    # bits que sobran al inicio de la palabra
+subu $v1, $zero, $v0    # 32 - bits, sllv solo usa los 5 bits bajos
+lw $t1, 0($t0)
+copy_desalineadas:
+lw $a0, 4($t0)
+srlv $t1, $t1, $v0
+sllv $t3, $a0, $v1
+or $t1, $t1, $t3
+sw $t1, 0($t2)
+move $t1, $a0
+addi $t0, $t0, 4
+addi $t2, $t2, 4
+addi $t5, $t5, -4
+slti $t3, $t5, 4
+beq $t3, $zero, copy_desalineadas
+srl $v0, $v0, 3
+addu $t0, $t0, $v0
+j copy_bytes
+
+copy_alineadas:
+lw $t1, 0($t0)
+sw $t1, 0($t2)
+addi $t0, $t0, 4
+addi $t2, $t2, 4
+addi $t5, $t5, -4
+slti $t1, $t5, 4
+beq $t1, $zero, copy_alineadas
+
+copy_bytes:
+# Los últimos 0 a 3 bytes
+beq $t5, $zero, copy_siguiente
+lbu $t1, 0($t0)
+sb $t1, 0($t2)
+addi $t0, $t0, 1
+addi $t2, $t2, 1
+addi $t5, $t5, -1
+j copy_bytes
+
+copy_siguiente:
+bltz $t4, done    # cadena2 ya se copió
+move $t0, $a1    # puntero cadena2
+addi $t5, $t4, 1    # incluye el '\0'
+li $t4, -1
+j copy_alinear
+
+done:
+move $v0, $t6    # retorno: dirección del bloque concatenado
+jr $ra
+
+F4_hablar:
+addi $sp, -4
+sw $ra, 0($sp)
+addi $t8, $a0, 0
+la $t0, str2
+addi $sp, -4
+sw $a0, ($sp)
+addi $sp, -4
+sw $a1, ($sp)
+lw $a0, ($t8)
+move $a1, $t0
+jal concat_strings
+lw $a1, ($sp)
+addi $sp, 4
+lw $a0, ($sp)
+addi $sp, 4
+move $t1, $v0
+move $v0, $t1
+lw $ra, 0($sp)
+addi $sp, 4
+jr $ra
+
+F1_hablar:
+addi $sp, -4
+sw $ra, 0($sp)
+addi $t8, $a0, 0
+la $t0, str0
+addi $sp, -4
+sw $a0, ($sp)
+addi $sp, -4
+sw $a1, ($sp)
+lw $a0, ($t8)
+move $a1, $t0
+jal concat_strings
+lw $a1, ($sp)
+addi $sp, 4
+lw $a0, ($sp)
+addi $sp, 4
+move $t1, $v0
+move $v0, $t1
+lw $ra, 0($sp)
+addi $sp, 4
+jr $ra
+
+F1_constructor:
+addi $t8, $a0, 0
+sw $a1, ($t8)
+jr $ra
+
+main:
+addi $sp, -4
+sw $ra, 0($sp)
 li $t0, 4
 addi $sp, -4
 sw $a0, ($sp)
 move $a0, $t0
-li $v0, 9
-syscall
+jal heap_calloc
 lw $a0, ($sp)
 addi $sp, 4
 move $t1, $v0
 move $a0, $t1
 la $t0, str1
 move $a1, $t0
-addi $sp, -4
-sw $ra, ($sp)
 jal F1_constructor
-lw $ra, ($sp)
-addi $sp, 4
 move $s0, $t1
 sw $s0, S0_animal
 move $a0, $s0
-addi $sp, -4
-sw $ra, ($sp)
 jal F1_hablar
-lw $ra, ($sp)
-addi $sp, 4
 move $v1, $v0
 addi $sp, -4
 sw $a0, ($sp)
@@ -672,27 +2019,18 @@ li $t0, 4
 addi $sp, -4
 sw $a0, ($sp)
 move $a0, $t0
-li $v0, 9
-syscall
+jal heap_calloc
 lw $a0, ($sp)
 addi $sp, 4
 move $t1, $v0
 move $a0, $t1
-la $t0, str3
+la $t0, str1
 move $a1, $t0
-addi $sp, -4
-sw $ra, ($sp)
 jal F1_constructor
-lw $ra, ($sp)
-addi $sp, 4
 move $s1, $t1
 sw $s1, S0_perro
 move $a0, $s1
-addi $sp, -4
-sw $ra, ($sp)
 jal F4_hablar
-lw $ra, ($sp)
-addi $sp, 4
 move $v1, $v0
 addi $sp, -4
 sw $a0, ($sp)
@@ -703,6 +2041,8 @@ lw $a0, ($sp)
 addi $sp, 4
 move $v0, $zero
 move $v1, $zero
+lw $ra, 0($sp)
+addi $sp, 4
 
 jr $ra
 
@@ -719,3 +2059,472 @@ jr $ra
 
     REQUIRE(expected == generated_mips);
 }
+
+TEST_CASE("Class with garbage collection asm generation", "[Class asm]") {
+    auto generated_mips = test_mips_gen(R"(
+class Animal {
+  let nombre: string;
+
+  function constructor(nombre: string) {
+    this.nombre = nombre;
+  }
+}
+
+let animal = new Animal("Firulais");
+print(animal.nombre);
+                )", CompiScript::GREEDY, false, false, false, true);
+
+    REQUIRE(generated_mips.contains("gc_map0:\t\t.word\t1, 0\n"));
+    REQUIRE(generated_mips.contains("gc_roots:\t\t.word\tS0_animal, gc_map0, 0\n"));
+    REQUIRE(generated_mips.contains("main:\nsw $sp, gc_stack_top\n"));
+    REQUIRE(generated_mips.contains("move $a0, $t0\nla $v1, gc_map0\njal gc_object\n"));
+    REQUIRE(generated_mips.contains("jal gc_stats\n"));
+    REQUIRE(generated_mips.contains("gc_collect:\n"));
+}
+
+TEST_CASE("String comparison asm generation", "[String asm]") {
+    auto generated_mips = test_mips_gen(R"(
+let a = "hola";
+let b = a + " mundo";
+let igual = a == b;
+let distinto = b != "hola";
+                )");
+
+    std::string expected = R"(.data
+		.word	4
+str0:		.asciiz	"hola"
+S0_a:		.word	0
+		.word	6
+str1:		.asciiz	" mundo"
+S0_b:		.word	0
+B0_igual:		.byte	0
+B0_distinto:		.byte	0
+heap_next:		.word	0
+heap_left:		.word	0
+heap_large:		.word	0
+heap_free:		.space	132
+.text
+heap_alloc:
+# Bloque = palabra con su tamaño + contenido, redondeado a múltiplos de 8. Solo usa $v0, $v1 y $a0, y deja $v1 en cero si
+# la memoria es nueva
+addi $a0, $a0, 11
+srl $a0, $a0, 3
+sll $a0, $a0, 3
+slti $v1, $a0, 257
+beq $v1, $zero, heap_grande
+
+# Clases de 8 a 256 bytes, cada una con su lista de bloques libres
+srl $v1, $a0, 1
+la $v0, heap_free
+addu $v1, $v1, $v0
+lw $v0, 0($v1)
+beq $v0, $zero, heap_bump
+lw $a0, 4($v0)    # siguiente bloque libre, en la primera palabra del contenido
+sw $a0, 0($v1)
+addi $v0, $v0, 4    # retorno: dirección del contenido
+jr $ra
+
+heap_bump:
+# Sin bloques libres se toma el inicio de la región que queda
+lw $v1, heap_left
+subu $v1, $v1, $a0
+bltz $v1, heap_chunk
+sw $v1, heap_left
+lw $v0, heap_next
+sw $a0, 0($v0)
+addu $a0, $v0, $a0
+sw $a0, heap_next
+addi $v0, $v0, 4
+move $v1, $zero    # memoria nueva de sbrk, ya está en cero
+jr $ra
+
+heap_chunk:
+# Pedir 64 KB con sbrk, o el bloque completo si es mayor
+addi $sp, $sp, -8
+sw $t0, 0($sp)
+sw $t1, 4($sp)
+move $t0, $a0
+li $a0, 65536
+slt $t1, $a0, $t0
+movn $a0, $t0, $t1
+li $v0, 9
+syscall
+
+# Si la memoria nueva no sigue a la región actual, lo que quedaba se pierde
+lw $t1, heap_next
+lw $v1, heap_left
+addu $t1, $t1, $v1
+beq $t1, $v0, heap_contigua
+sw $v0, heap_next
+move $v1, $zero
+heap_contigua:
+addu $v1, $v1, $a0
+sw $v1, heap_left
+move $a0, $t0
+lw $t0, 0($sp)
+lw $t1, 4($sp)
+addi $sp, $sp, 8
+j heap_bump
+
+heap_grande:
+# Bloques mayores: el primero de la lista que alcance, sin dividirlo
+addi $sp, $sp, -4
+sw $t0, 0($sp)
+la $v1, heap_large    # dirección del enlace al bloque actual
+heap_buscar:
+lw $v0, 0($v1)
+beq $v0, $zero, heap_sin_bloque
+lw $t0, 0($v0)
+slt $t0, $t0, $a0
+beq $t0, $zero, heap_encontrado
+addi $v1, $v0, 4
+j heap_buscar
+heap_encontrado:
+lw $t0, 4($v0)
+sw $t0, 0($v1)
+lw $t0, 0($sp)
+addi $sp, $sp, 4
+addi $v0, $v0, 4
+jr $ra
+heap_sin_bloque:
+lw $t0, 0($sp)
+addi $sp, $sp, 4
+j heap_bump
+
+concat_strings:
+# Las longitudes están en la palabra anterior a cada cadena
+lw $t3, -4($a0)
+lw $t4, -4($a1)
+
+# Reservar longitud + len1 + len2 + 1 (para '\0') en el heap. Solo se usan $t0 a $t6 y los registros que
+# heap_alloc ya modifica, el resto de los $t siguen siendo de quien llama
+move $t0, $a0    # puntero cadena1
+add $t5, $t3, $t4
+addi $a0, $t5, 5
+addi $sp, $sp, -4
+sw $ra, 0($sp)
+jal heap_alloc    # respeta los registros $t
+lw $ra, 0($sp)
+addi $sp, $sp, 4
+sw $t5, 0($v0)
+addi $t6, $v0, 4    # guardar dirección de los caracteres en $t6 (retorno)
+
+# Copiar cadena1 y después cadena2 con su '\0', $t0 origen, $t2 destino y $t5 bytes
+move $t2, $t6
+move $t5, $t3
+copy_alinear:
+beq $t5, $zero, copy_siguiente
+andi $t1, $t2, 3
+beq $t1, $zero, copy_palabras
+lbu $t1, 0($t0)
+sb $t1, 0($t2)
+addi $t0, $t0, 1
+addi $t2, $t2, 1
+addi $t5, $t5, -1
+j copy_alinear
+copy_palabras:
+# Con el destino alineado se escriben palabras completas
+slti $t1, $t5, 4
+bne $t1, $zero, copy_bytes
+andi $v0, $t0, 3
+subu $t0, $t0, $v0
+beq $v0, $zero, copy_alineadas
+
+# Origen desalineado: cada palabra se arma con el final de una palabra alineada y el inicio de la siguiente.
+# heap_alloc ya usó $a0 y $v1, así que quedan libres
+sll $v0, $v0, 3    # bits que sobran al inicio de la palabra
+subu $v1, $zero, $v0    # 32 - bits, sllv solo usa los 5 bits bajos
+lw $t1, 0($t0)
+copy_desalineadas:
+lw $a0, 4($t0)
+srlv $t1, $t1, $v0
+sllv $t3, $a0, $v1
+or $t1, $t1, $t3
+sw $t1, 0($t2)
+move $t1, $a0
+addi $t0, $t0, 4
+addi $t2, $t2, 4
+addi $t5, $t5, -4
+slti $t3, $t5, 4
+beq $t3, $zero, copy_desalineadas
+srl $v0, $v0, 3
+addu $t0, $t0, $v0
+j copy_bytes
+
+copy_alineadas:
+lw $t1, 0($t0)
+sw $t1, 0($t2)
+addi $t0, $t0, 4
+addi $t2, $t2, 4
+addi $t5, $t5, -4
+slti $t1, $t5, 4
+beq $t1, $zero, copy_alineadas
+
+copy_bytes:
+# Los últimos 0 a 3 bytes
+beq $t5, $zero, copy_siguiente
+lbu $t1, 0($t0)
+sb $t1, 0($t2)
+addi $t0, $t0, 1
+addi $t2, $t2, 1
+addi $t5, $t5, -1
+j copy_bytes
+
+copy_siguiente:
+bltz $t4, done    # cadena2 ya se copió
+move $t0, $a1    # puntero cadena2
+addi $t5, $t4, 1    # incluye el '\0'
+li $t4, -1
+j copy_alinear
+
+done:
+move $v0, $t6    # retorno: dirección del bloque concatenado
+jr $ra
+
+equal_strings:
+# Mismo puntero: iguales sin leerlas
+li $v0, 1
+beq $a0, $a1, equal_done
+li $v0, 0
+beq $a0, $zero, equal_done
+beq $a1, $zero, equal_done
+
+# Con longitudes distintas no hace falta comparar los caracteres
+lw $t0, -4($a0)
+lw $t1, -4($a1)
+bne $t0, $t1, equal_done
+
+# Las dos cadenas empiezan alineadas, se comparan las palabras completas y después los 0 a 3 bytes restantes
+move $t2, $a0
+move $t3, $a1
+srl $t4, $t0, 2
+andi $t0, $t0, 3
+equal_palabras:
+beq $t4, $zero, equal_bytes
+lw $t5, 0($t2)
+lw $t6, 0($t3)
+bne $t5, $t6, equal_done
+addi $t2, $t2, 4
+addi $t3, $t3, 4
+addi $t4, $t4, -1
+j equal_palabras
+equal_bytes:
+beq $t0, $zero, equal_si
+lbu $t5, 0($t2)
+lbu $t6, 0($t3)
+bne $t5, $t6, equal_done
+addi $t2, $t2, 1
+addi $t3, $t3, 1
+addi $t0, $t0, -1
+j equal_bytes
+equal_si:
+li $v0, 1
+equal_done:
+jr $ra
+
+main:
+addi $sp, -4
+sw $ra, 0($sp)
+la $t0, str0
+move $s0, $t0
+sw $s0, S0_a
+la $t1, str1
+addi $sp, -4
+sw $a0, ($sp)
+addi $sp, -4
+sw $a1, ($sp)
+move $a0, $s0
+move $a1, $t1
+jal concat_strings
+lw $a1, ($sp)
+addi $sp, 4
+lw $a0, ($sp)
+addi $sp, 4
+move $t2, $v0
+move $s1, $t2
+sw $s1, S0_b
+addi $sp, -4
+sw $a0, ($sp)
+addi $sp, -4
+sw $a1, ($sp)
+move $a0, $s0
+move $a1, $s1
+jal equal_strings
+lw $a1, ($sp)
+addi $sp, 4
+lw $a0, ($sp)
+addi $sp, 4
+move $t2, $v0
+move $s2, $t2
+sb $s2, B0_igual
+addi $sp, -4
+sw $a0, ($sp)
+addi $sp, -4
+sw $a1, ($sp)
+move $a0, $s1
+move $a1, $t0
+jal equal_strings
+lw $a1, ($sp)
+addi $sp, 4
+lw $a0, ($sp)
+addi $sp, 4
+xori $t2, $v0, 1
+move $s3, $t2
+sb $s3, B0_distinto
+lw $ra, 0($sp)
+addi $sp, 4
+
+jr $ra
+
+)";
+
+    expected.erase(remove(expected.begin(), expected.end(), ' '), expected.end());
+    expected.erase(remove(expected.begin(), expected.end(), '\t'), expected.end());
+    generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), ' '), generated_mips.end());
+    generated_mips.erase(remove(generated_mips.begin(), generated_mips.end(), '\t'), generated_mips.end());
+
+    REQUIRE(expected == generated_mips);
+}
+
+TEST_CASE("Machine code blocks and printing", "[Machine code]") {
+    std::string text = R"(F0_doble:
+add $v0, $a0, $a0
+jr $ra
+
+main:
+addi $sp, -4
+sw $ra, 0($sp)
+li $a0, 4
+jal F0_doble
+sw $v0, W0_d
+l0:
+bne $zero, $v0, l0
+lw $ra, 0($sp)
+addi $sp, 4
+jr $ra
+)";
+    auto code = MachineCode(text, {"main", "F0_doble"});
+    auto &functions = code.getFunctions();
+
+    REQUIRE(functions.size() == 2);
+    REQUIRE(functions.at(0).name == "F0_doble");
+    REQUIRE(functions.at(1).name == "main");
+    // Each branch ends a block, the blank line after jr $ra starts one without label
+    REQUIRE(functions.at(0).blocks.size() == 2);
+    REQUIRE(functions.at(1).blocks.size() == 4);
+    REQUIRE(functions.at(1).blocks.at(2).label == "l0");
+
+    auto &store = functions.at(1).blocks.at(0).instrs.at(1);
+    REQUIRE(store.opcode == SW);
+    REQUIRE(store.operands.at(1).kind == MachineOperand::MEM);
+    REQUIRE(store.operands.at(1).value == "0");
+    REQUIRE(store.operands.at(1).base == "$sp");
+    REQUIRE(getInstrInfo(functions.at(1).blocks.at(1).instrs.at(0)).defs.contains("$at"));
+
+    REQUIRE(code.print() == text);
+}
+
+TEST_CASE("Peephole rules on machine code", "[Machine code]") {
+    auto code = MachineCode(R"(main:
+addi $sp, -4
+sw $ra, 0($sp)
+li $t0, 5
+sw $t0, W0_x
+lw $t1, W0_x
+move $s0, $t1
+add $t2, $s0, $s0
+move $s0, $t2
+addi $sp, -4
+sw $a0, ($sp)
+addi $sp, -4
+sw $a1, ($sp)
+move $a0, $s0
+jal to_string
+lw $a1, ($sp)
+addi $sp, 4
+lw $a0, ($sp)
+addi $sp, 4
+b l0
+l0:
+lw $ra, 0($sp)
+addi $sp, 4
+jr $ra
+)", {"main"});
+    code.peephole();
+
+    std::string expected = R"(main:
+addi $sp, -12
+sw $ra, 8($sp)
+li $t0, 5
+sw $t0, W0_x
+move $t1, $t0
+add $t2, $t0, $t0
+move $s0, $t2
+sw $a0, 4($sp)
+sw $a1, ($sp)
+move $a0, $t2
+jal to_string
+lw $a1, ($sp)
+lw $a0, 4($sp)
+addi $sp, 8
+l0:
+lw $ra, 0($sp)
+addi $sp, 4
+jr $ra
+)";
+
+    REQUIRE(code.print() == expected);
+    REQUIRE(code.getReport().contains("store-to-load 1, copy-propagation 3, redundant-move 1, stack-merge 3, branch-to-next 1"));
+}
+
+TEST_CASE("Outlining and identical function folding on machine code", "[Machine code]") {
+    auto code = MachineCode(R"(F0_a:
+add $v0, $a0, $a1
+jr $ra
+F0_b:
+add $v0, $a0, $a1
+jr $ra
+main:
+addi $sp, -4
+sw $ra, 0($sp)
+li $a0, 1
+li $a1, 2
+sw $a0, W0_x
+sw $a1, W0_y
+jal F0_a
+li $a0, 1
+li $a1, 2
+sw $a0, W0_x
+sw $a1, W0_y
+jal F0_b
+lw $ra, 0($sp)
+addi $sp, 4
+jr $ra
+)", {"F0_a", "F0_b", "main"});
+    code.foldIdentical();
+    code.outline();
+
+    std::string expected = R"(F0_a:
+add $v0, $a0, $a1
+jr $ra
+main:
+addi $sp, -4
+sw $ra, 0($sp)
+jal outlined0
+jal F0_a
+jal outlined0
+jal F0_a
+lw $ra, 0($sp)
+addi $sp, 4
+jr $ra
+outlined0:
+li $a0, 1
+li $a1, 2
+sw $a0, W0_x
+sw $a1, W0_y
+jr $ra
+)";
+
+    REQUIRE(code.print() == expected);
+    REQUIRE(code.getReport() == "fold: 1 identical functions folded\noutline: 2 sequences into 1 stubs, 1 instructions saved\n");
+}
@@ -0,0 +1,589 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "test.h"
+
+using namespace CompiScript;
+
+
+TEST_CASE("Function specialization for constant arguments", "[Specialization]") {
+    auto optimizer = test_optimizer(R"(
+function escalar(x: integer, factor: integer): integer {
+  if (factor == 1) {
+    return x;
+  }
+  return x * factor;
+}
+
+let a = escalar(5, 1);
+let b = escalar(7, 1);
+let c = escalar(7, 3);
+print(a + b + c);
+                )");
+    optimizer.specializeFunctions();
+    auto generated_tac = getTAC(optimizer.getQuadruplets());
+
+    std::string expected = R"(begin F0_escalar 
+arg W1_x 
+arg W1_factor 
+t0 = == W1_factor 1
+if t0 l0
+goto l1 
+tag l0 
+return W1_x 
+tag l1 
+t0 = * W1_x W1_factor
+return t0 
+end F0_escalar 
+call F0_escalar__s0 
+W0_a =  ret 
+call F0_escalar__s1 
+W0_b =  ret 
+call F0_escalar__s2 
+W0_c =  ret 
+t0 = + W0_a W0_b
+t1 = + t0 W0_c
+p = to_str t1 4
+print  
+begin F0_escalar__s0 
+return 5 
+end F0_escalar__s0 
+begin F0_escalar__s1 
+return 7 
+end F0_escalar__s1 
+begin F0_escalar__s2 
+return 21 
+end F0_escalar__s2 
+)";
+
+    expected.erase(remove(expected.begin(), expected.end(), ' '), expected.end());
+    generated_tac.erase(remove(generated_tac.begin(), generated_tac.end(), ' '), generated_tac.end());
+
+    REQUIRE(expected == generated_tac);
+    REQUIRE(optimizer.getReport().contains("3 clones created"));
+}
+
+TEST_CASE("Compile-time evaluation of pure calls", "[Pure evaluation]") {
+    auto optimizer = test_optimizer(R"(
+function factorial(n: integer): integer {
+  if (n <= 1) {
+    return 1;
+  }
+  return n * factorial(n - 1);
+}
+
+function contar(n: integer): integer {
+  print(n);
+  return n;
+}
+
+let a = factorial(5);
+let c = contar(3);
+                )");
+    optimizer.evaluatePureCalls();
+    auto generated_tac = getTAC(optimizer.getQuadruplets());
+
+    std::string expected = R"(begin F0_factorial 
+arg W1_n 
+t0 = <= W1_n 1
+if t0 l0
+goto l1 
+tag l0 
+return 1 
+tag l1 
+t0 = - W1_n 1
+push W1_n 
+param t0 
+call F0_factorial 
+pop W1_n 
+t1 = * W1_n ret
+return t1 
+end F0_factorial 
+begin F0_contar 
+arg W3_n 
+p = to_str W3_n 4
+print  
+return W3_n 
+end F0_contar 
+W0_a =  120 
+param 3 
+call F0_contar 
+W0_c =  ret 
+)";
+
+    expected.erase(remove(expected.begin(), expected.end(), ' '), expected.end());
+    generated_tac.erase(remove(generated_tac.begin(), generated_tac.end(), ' '), generated_tac.end());
+
+    REQUIRE(expected == generated_tac);
+    REQUIRE(optimizer.getReport().contains("F0_factorial(5) = 120"));
+}
+
+TEST_CASE("Dead function and method elimination", "[Dead functions]") {
+    auto optimizer = test_optimizer(R"(
+class Animal {
+  let nombre: string;
+
+  function constructor(nombre: string) {
+    this.nombre = nombre;
+  }
+
+  function hablar(): string {
+    return this.nombre + " hace ruido.";
+  }
+
+  function dormir(): string {
+    return this.nombre + " duerme.";
+  }
+}
+
+function nunca(): integer {
+  return 1;
+}
+
+let animal = new Animal("Firulais");
+print(animal.hablar());
+                )");
+    optimizer.removeDeadFunctions();
+    auto generated_tac = getTAC(optimizer.getQuadruplets());
+
+    std::string expected = R"(begin F1_constructor 
+arg S2_this 
+arg S2_nombre 
+i = + S2_this 0
+i*w =  S2_nombre 
+end F1_constructor 
+begin F1_hablar 
+arg S3_this 
+i = + S3_this 0
+t0 = concat i*w " hace ruido."
+return t0 
+end F1_hablar 
+t0 = alloc 4 0
+param t0 
+param "Firulais" 
+call F1_constructor 
+S0_animal =  t0 
+param S0_animal 
+call F1_hablar 
+p =  ret 
+print  
+)";
+
+    expected.erase(remove(expected.begin(), expected.end(), ' '), expected.end());
+    generated_tac.erase(remove(generated_tac.begin(), generated_tac.end(), ' '), generated_tac.end());
+
+    REQUIRE(expected == generated_tac);
+    REQUIRE(optimizer.getReport().contains("2 functions removed"));
+}
+
+TEST_CASE("Escape analysis and scalar replacement of objects", "[Escape]") {
+    auto optimizer = test_optimizer(R"(
+class Punto {
+  let x: integer;
+  let y: integer;
+
+  function constructor(x: integer, y: integer) {
+    this.x = x;
+    this.y = y;
+  }
+
+  function getX(): integer {
+    return this.x;
+  }
+}
+
+let p = new Punto(3, 4);
+let a = p.x;
+let b = p.y;
+print(a + b);
+
+let q = new Punto(1, 2);
+print(q.getX());
+                )");
+    optimizer.promoteObjects();
+    auto generated_tac = getTAC(optimizer.getQuadruplets());
+
+    std::string expected = R"(begin F1_constructor 
+arg S2_this 
+arg W2_x 
+arg W2_y 
+i = + S2_this 0
+i*w =  W2_x 
+i = + S2_this 4
+i*w =  W2_y 
+end F1_constructor 
+begin F1_getX 
+arg S3_this 
+i = + S3_this 0
+return i*w 
+end F1_getX 
+W0_p__f0 =  3 
+W0_p__f4 =  4 
+W0_a =  W0_p__f0 
+W0_b =  W0_p__f4 
+t0 = + W0_a W0_b
+p = to_str t0 4
+print  
+S0_q = alloc 8 
+param S0_q 
+param 1 
+param 2 
+call F1_constructor 
+param S0_q 
+call F1_getX 
+p = to_str ret 4
+print  
+)";
+
+    expected.erase(remove(expected.begin(), expected.end(), ' '), expected.end());
+    generated_tac.erase(remove(generated_tac.begin(), generated_tac.end(), ' '), generated_tac.end());
+
+    REQUIRE(expected == generated_tac);
+    REQUIRE(optimizer.getReport().contains("2 heap allocations removed"));
+}
+
+TEST_CASE("Scalar replacement of fields the constructor never assigns", "[Escape]") {
+    auto optimizer = test_optimizer(R"(
+class Contador {
+  let inicio: integer;
+  let total: integer;
+
+  function constructor(inicio: integer) {
+    this.inicio = inicio;
+  }
+}
+
+let c = new Contador(3);
+let a = c.inicio;
+let b = c.total;
+print(a + b);
+                )");
+    optimizer.promoteObjects();
+    auto generated_tac = getTAC(optimizer.getQuadruplets());
+
+    std::string expected = R"(begin F1_constructor 
+arg S2_this 
+arg W2_inicio 
+i = + S2_this 0
+i*w =  W2_inicio 
+end F1_constructor 
+W0_c__f4 =  0 
+W0_c__f0 =  3 
+W0_a =  W0_c__f0 
+W0_b =  W0_c__f4 
+t0 = + W0_a W0_b
+p = to_str t0 4
+print  
+)";
+
+    expected.erase(remove(expected.begin(), expected.end(), ' '), expected.end());
+    generated_tac.erase(remove(generated_tac.begin(), generated_tac.end(), ' '), generated_tac.end());
+
+    REQUIRE(expected == generated_tac);
+
+    // At top level the field is declared in .data instead of being assigned
+    auto mips = Mips(optimizer.getQuadruplets());
+    REQUIRE(mips.generateAssembly().contains("W0_c__f4:\t\t.word\t0\n"));
+}
+
+TEST_CASE("Static allocation of top-level objects", "[Static objects]") {
+    auto optimizer = test_optimizer(R"(
+class Punto {
+  let x: integer;
+  let y: integer;
+
+  function constructor(x: integer, y: integer) {
+    this.x = x;
+    this.y = y;
+  }
+
+  function getX(): integer {
+    return this.x;
+  }
+}
+
+let q = new Punto(1, 2);
+print(q.getX());
+                )");
+    optimizer.allocateGlobals();
+    auto generated_tac = getTAC(optimizer.getQuadruplets());
+
+    std::string expected = R"(begin F1_constructor 
+arg S2_this 
+arg W2_x 
+arg W2_y 
+i = + S2_this 0
+i*w =  W2_x 
+i = + S2_this 4
+i*w =  W2_y 
+end F1_constructor 
+begin F1_getX 
+arg S3_this 
+i = + S3_this 0
+return i*w 
+end F1_getX 
+S0__new0 = alloc 8 
+i = + S0__new0 0
+i*w =  1 
+i = + S0__new0 4
+i*w =  2 
+S0_q =  S0__new0 
+param S0_q 
+call F1_getX 
+p = to_str ret 4
+print  
+)";
+
+    expected.erase(remove(expected.begin(), expected.end(), ' '), expected.end());
+    generated_tac.erase(remove(generated_tac.begin(), generated_tac.end(), ' '), generated_tac.end());
+
+    REQUIRE(expected == generated_tac);
+    REQUIRE(optimizer.getReport().contains("1 constructors removed"));
+}
+
+TEST_CASE("If-conversion of ternaries and if/else assignments", "[If-conversion]") {
+    auto optimizer = test_optimizer(R"(
+let x = 7;
+let y = 3;
+let m = x > y ? x : y;
+if (x < y) {
+  m = y * 2;
+} else {
+  m = x;
+}
+if (y > m) {
+  m = y;
+}
+m = m < 100 ? m + 1 : m;
+print(m);
+                )");
+    optimizer.convertBranches();
+    auto generated_tac = getTAC(optimizer.getQuadruplets());
+
+    std::string expected = R"(W0_x =  7 
+W0_y =  3 
+t1 = > W0_x W0_y
+t6 =  W0_y 
+t6 = movn W0_x t1
+t0 =  t6 
+W0_m =  t0 
+t0 = < W0_x W0_y
+t4 = * W0_y 2
+t5 =  W0_x 
+t5 = movn t4 t0
+W0_m =  t5 
+t0 = > W0_y W0_m
+t3 =  W0_m 
+t3 = movn W0_y t0
+W0_m =  t3 
+t1 = < W0_m 100
+ifnot t1 l7
+t2 = + W0_m 1
+t0 =  t2 
+goto l8 
+tag l7 
+t0 =  W0_m 
+tag l8 
+W0_m =  t0 
+p = to_str W0_m 4
+print  
+)";
+
+    expected.erase(remove(expected.begin(), expected.end(), ' '), expected.end());
+    generated_tac.erase(remove(generated_tac.begin(), generated_tac.end(), ' '), generated_tac.end());
+
+    REQUIRE(expected == generated_tac);
+    REQUIRE(optimizer.getReport().contains("3 branches converted"));
+}
+
+TEST_CASE("Loop rotation and jump threading", "[Branches]") {
+    auto optimizer = test_optimizer(R"(
+let s = 0;
+let j = 0;
+while (j < 10) {
+  j = j + 1;
+  if (j == 3) {
+    continue;
+  }
+  if (j > 7) {
+    break;
+  }
+  s = s + j;
+}
+print(s);
+                )");
+    optimizer.optimizeBranches();
+    auto generated_tac = getTAC(optimizer.getQuadruplets());
+
+    std::string expected = R"(W0_s =  0 
+W0_j =  0 
+t0 = < W0_j 10
+ifnot t0 l1
+tag l6 
+t0 = + W0_j 1
+W0_j =  t0 
+t0 = == W0_j 3
+if t0 l0
+t0 = > W0_j 7
+if t0 l1
+t0 = + W0_s W0_j
+W0_s =  t0 
+tag l0 
+t0 = < W0_j 10
+if t0 l6
+tag l1 
+p = to_str W0_s 4
+print  
+)";
+
+    expected.erase(remove(expected.begin(), expected.end(), ' '), expected.end());
+    generated_tac.erase(remove(generated_tac.begin(), generated_tac.end(), ' '), generated_tac.end());
+
+    REQUIRE(expected == generated_tac);
+    REQUIRE(optimizer.getReport().contains("1 loops rotated"));
+    REQUIRE(optimizer.getReport().contains("8 -> 4 branches"));
+}
+
+TEST_CASE("Try ranges closed after break", "[Branches]") {
+    auto optimizer = test_optimizer(R"(
+let lista = [1, 2, 3];
+let i = 0;
+while (i < 5) {
+  try {
+    i = i + 1;
+    break;
+  } catch (err) {
+    print(err);
+  }
+}
+let x = lista[i];
+                )");
+    optimizer.optimizeBranches();
+    auto generated_tac = getTAC(optimizer.getQuadruplets());
+
+    std::string expected = R"(S0_lista = alloc 12 
+i = + S0_lista 0
+i*w =  1 
+i = + S0_lista 4
+i*w =  2 
+i = + S0_lista 8
+i*w =  3 
+W0_i =  0 
+t0 = < W0_i 5
+ifnot t0 l1
+tag l3 
+catch =  l2 
+t0 = + W0_i 1
+W0_i =  t0 
+goto l1 
+catch =  0 
+begin l2 
+S1_err =  err 
+p =  S1_err 
+print  
+end l2 
+t0 = < W0_i 5
+if t0 l3
+tag l1 
+t0 =  W0_i 
+err = >= t0 3
+iferr err_bad_index 
+t0 = * t0 4
+i = + S0_lista t0
+W0_x =  i*w 
+)";
+
+    expected.erase(remove(expected.begin(), expected.end(), ' '), expected.end());
+    generated_tac.erase(remove(generated_tac.begin(), generated_tac.end(), ' '), generated_tac.end());
+
+    REQUIRE(expected == generated_tac);
+
+    // The bounds check after the loop is outside the try range
+    auto assembly = Mips(optimizer.getQuadruplets()).generateAssembly();
+    REQUIRE(assembly.find("try0_end:") < assembly.find("err_resume0:"));
+}
+
+TEST_CASE("Release of temporary strings", "[Free strings]") {
+    auto optimizer = test_optimizer(R"(
+let nombre = "Ana";
+let edad = 21;
+let saludo = "Hola " + nombre;
+print("Edad: " + edad + ".");
+print(saludo + " " + nombre);
+print(edad);
+                )");
+    optimizer.freeTemporaryStrings();
+    auto generated_tac = getTAC(optimizer.getQuadruplets());
+
+    std::string expected = R"(S0_nombre =  "Ana" 
+W0_edad =  21 
+t0 = concat "Hola " S0_nombre
+S0_saludo =  t0 
+t0 = to_str W0_edad 4
+t1 = concat "Edad: " t0
+free t0 
+t2 = concat t1 "."
+free t1 
+p =  t2 
+print  
+free t2 
+t0 = concat S0_saludo " "
+t1 = concat t0 S0_nombre
+free t0 
+p =  t1 
+print  
+free t1 
+t3 = to_str W0_edad 4
+p =  t3 
+print  
+free t3 
+)";
+
+    expected.erase(remove(expected.begin(), expected.end(), ' '), expected.end());
+    generated_tac.erase(remove(generated_tac.begin(), generated_tac.end(), ' '), generated_tac.end());
+
+    REQUIRE(expected == generated_tac);
+    REQUIRE(optimizer.getReport().contains("free: 6 temporary strings released"));
+}
+
+TEST_CASE("In-place string append", "[Append]") {
+    auto optimizer = test_optimizer(R"(
+let s = "";
+let a = "";
+let i = 0;
+while (i < 3) {
+  s = s + "x";
+  a = a + "y";
+  i = i + 1;
+}
+let b = a;
+print(s + b);
+                )");
+    optimizer.appendStrings();
+    auto generated_tac = getTAC(optimizer.getQuadruplets());
+
+    std::string expected = R"(S0_s =  "" 
+S0_a =  "" 
+W0_i =  0 
+tag l0 
+t0 = < W0_i 3
+ifnot t0 l1
+t0 = append S0_s "x"
+S0_s =  t0 
+t0 = concat S0_a "y"
+S0_a =  t0 
+t0 = + W0_i 1
+W0_i =  t0 
+goto l0 
+tag l1 
+S0_b =  S0_a 
+t0 = concat S0_s S0_b
+p =  t0 
+print  
+)";
+
+    expected.erase(remove(expected.begin(), expected.end(), ' '), expected.end());
+    generated_tac.erase(remove(generated_tac.begin(), generated_tac.end(), ' '), generated_tac.end());
+
+    REQUIRE(expected == generated_tac);
+    REQUIRE(optimizer.getReport().contains("append: 1 string appends made in place"));
+}